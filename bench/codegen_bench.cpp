@@ -0,0 +1,179 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "lexer.hpp"
+#include "AST.hpp"
+#include "parser.hpp"
+#include "simplify.hpp"
+#include "codegen.hpp"
+#include "generator.hpp"
+
+/*
+ * コード生成のスケーリングベンチマーク
+ * 文の数だけを変えたmain一つのプログラムを生成し、字句解析・構文解析、簡約、コード生成の時間を表示する
+ * 文あたりの時間が文の数によらずほぼ一定なら、コード生成は関数の大きさに対して線形
+ */
+
+/*
+ * 計測結果
+ */
+struct CodeGenResult {
+	int Statements;
+	size_t Instructions;
+	double Frontend; // 字句解析・構文解析
+	double Simplify;
+	double CodeGen;
+};
+
+/*
+ * 生成したプログラムを一時ファイルに書き出す
+ * @param ソースコード、書き出したファイル名
+ * @return 成功：true、失敗：false
+ */
+static bool writeTemp(const std::string& src, std::string& path) {
+	char name[] = "/tmp/codegen_bench_XXXXXX";
+	int fd = mkstemp(name);
+	if (fd < 0) {
+		return false;
+	}
+	close(fd);
+	path = name;
+	FILE* fp = fopen(name, "wb");
+	if (not fp or fwrite(src.data(), 1, src.size(), fp) != src.size()) {
+		if (fp) {
+			fclose(fp);
+		}
+		unlink(name);
+		return false;
+	}
+	fclose(fp);
+	return true;
+}
+
+/*
+ * 一つのプログラムを計測する
+ * @param 入力ファイル名、簡約するか、変数をSSA形式で直接生成するか、結果の書き込み先
+ * @return 成功：true、失敗：false
+ */
+static bool measure(const std::string& input_file, bool simplify, bool direct_ssa, CodeGenResult& result) {
+	double t0 = getSeconds();
+	TokenStream* ts = LexicalAnalysis(input_file);
+	if (not ts) {
+		fprintf(stderr, "error at lexer\n");
+		return false;
+	}
+	Parser* parser = new Parser(ts);
+	if (not parser->doParse()) {
+		fprintf(stderr, "err at parser\n");
+		SAFE_DELETE(parser);
+		return false;
+	}
+	TranslationUnitAST& t_unit = parser->getAST();
+	double t1 = getSeconds();
+	if (simplify) {
+		Simplifier().doSimplify(t_unit);
+	}
+	double t2 = getSeconds();
+	CodeGen* codegen = new CodeGen();
+	codegen->setDirectSSA(direct_ssa);
+	bool ok = codegen->doCodeGen(t_unit, input_file, "", false);
+	double t3 = getSeconds();
+	if (ok) {
+		result.Instructions = codegen->getModule().getInstructionCount();
+	} else {
+		fprintf(stderr, "err at codegen\n");
+	}
+	SAFE_DELETE(codegen);
+	SAFE_DELETE(parser);
+	result.Frontend = t1 - t0;
+	result.Simplify = t2 - t1;
+	result.CodeGen = t3 - t2;
+	return ok;
+}
+
+static void printHelp() {
+	fprintf(stdout, "usage: codegen_bench [options]\n");
+	fprintf(stdout, "  -stmts <n>,...    statements in main, comma separated (default 100000,200000,500000,1000000)\n");
+	fprintf(stdout, "  -depth <n>        parenthesized expression depth (default 2)\n");
+	fprintf(stdout, "  -locals <n>       extra local variables (default 0)\n");
+	fprintf(stdout, "  -annotations <pct> chance of a `$` annotation after each assignment (default 10)\n");
+	fprintf(stdout, "  -seed <n>         generator seed (default 1)\n");
+	fprintf(stdout, "  -no-simplify      skip the AST simplifier\n");
+	fprintf(stdout, "  -direct-ssa       keep variables in SSA registers instead of alloca/load/store\n");
+}
+
+int main(int argc, char** argv) {
+	ProgramGenerator gen;
+	gen.Functions = 1;
+	gen.CommentPercent = 0;
+	std::vector<int> sizes = {100000, 200000, 500000, 1000000};
+	bool simplify = true;
+	bool direct_ssa = false;
+	for (int i = 1; i < argc; i++) {
+		const char* opt = argv[i];
+		if (strcmp(opt, "-h") == 0) {
+			printHelp();
+			return 0;
+		} else if (strcmp(opt, "-no-simplify") == 0) {
+			simplify = false;
+			continue;
+		} else if (strcmp(opt, "-direct-ssa") == 0) {
+			direct_ssa = true;
+			continue;
+		}
+		const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+		if (not val) {
+			fprintf(stderr, "%s の値がありません\n", opt);
+			return 1;
+		} else if (strcmp(opt, "-stmts") == 0) {
+			sizes.clear();
+			for (const char* p = val; *p; ) {
+				char* end;
+				long n = strtol(p, &end, 10);
+				if (end == p or n < 1) {
+					fprintf(stderr, "-stmts には1以上の数をカンマ区切りで指定してください\n");
+					return 1;
+				}
+				sizes.push_back(n);
+				p = *end == ',' ? end + 1 : end;
+			}
+		} else if (strcmp(opt, "-depth") == 0) {
+			gen.Depth = atoi(val);
+		} else if (strcmp(opt, "-locals") == 0) {
+			gen.Locals = atoi(val);
+		} else if (strcmp(opt, "-annotations") == 0) {
+			gen.AnnotatePercent = atoi(val);
+		} else if (strcmp(opt, "-seed") == 0) {
+			gen.Seed = strtoull(val, NULL, 10);
+		} else {
+			fprintf(stderr, "%s は不明なオプションです\n", opt);
+			return 1;
+		}
+		i++;
+	}
+
+	fprintf(stdout, "%10s %12s %10s %10s %10s %12s\n", "stmts", "insts", "parse s", "simplify s", "codegen s", "codegen us/stmt");
+	for (int stmts : sizes) {
+		gen.Statements = stmts;
+		std::string input_file;
+		if (not writeTemp(gen.generate(), input_file)) {
+			fprintf(stderr, "一時ファイルを作れません\n");
+			return 1;
+		}
+		CodeGenResult result = {stmts, 0, 0, 0, 0};
+		bool ok = measure(input_file, simplify, direct_ssa, result);
+		unlink(input_file.c_str());
+		if (not ok) {
+			return 1;
+		}
+		fprintf(stdout, "%10d %12zu %10.3f %10.3f %10.3f %12.3f\n", result.Statements, result.Instructions,
+			result.Frontend, result.Simplify, result.CodeGen, result.CodeGen / stmts * 1e6);
+		fflush(stdout);
+	}
+	fprintf(stdout, "peak RSS:  %.1f MB\n", getPeakRSS() / 1024.0);
+	return 0;
+}
@@ -0,0 +1,197 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "lexer.hpp"
+#include "AST.hpp"
+#include "parser.hpp"
+#include "generator.hpp"
+
+/*
+ * フロントエンド(字句解析・構文解析)のベンチマーク
+ * 生成したDummyCプログラム、または指定したファイルに対して
+ * LexicalAnalysisとParser::doParseだけを実行し、処理速度とピークRSSを表示する
+ */
+
+/*
+ * ASTのノード数を数える
+ * 式・文のノードは関数本文ごとの配列の長さを足すだけでよい
+ */
+static size_t countNodes(TranslationUnitAST& tunit, size_t& node_bytes) {
+	size_t n = 1;
+	node_bytes = 0;
+	for (int i = 0; tunit.getPrototype(i); i++) {
+		n++;
+	}
+	for (int i = 0; FunctionAST* func = tunit.getFunction(i); i++) {
+		FunctionStmtAST* body = func->getBody();
+		n += 3; // FunctionAST, PrototypeAST, FunctionStmtAST
+		for (int j = 0; body->getArrayDecl(j); j++) {
+			n++;
+		}
+		for (int j = 0; body->getVariableDecl(j); j++) {
+			n++;
+		}
+		n += body->getNodeNum();
+		node_bytes += body->getNodeBytes();
+	}
+	return n;
+}
+
+static void printHelp() {
+	fprintf(stdout, "usage: frontend_bench [options]\n");
+	fprintf(stdout, "  -functions <n>    number of functions (default 1000)\n");
+	fprintf(stdout, "  -stmts <n>        statements per function (default 50)\n");
+	fprintf(stdout, "  -depth <n>        parenthesized expression depth (default 2)\n");
+	fprintf(stdout, "  -arrays <n>       array declarations per function (default 1)\n");
+	fprintf(stdout, "  -locals <n>       extra local variables per function (default 0)\n");
+	fprintf(stdout, "  -comments <pct>   chance of a comment before each statement (default 10)\n");
+	fprintf(stdout, "  -annotations <pct> chance of a `$` annotation after each assignment (default 10)\n");
+	fprintf(stdout, "  -seed <n>         generator seed (default 1)\n");
+	fprintf(stdout, "  -emit <file>      write the generated program and exit\n");
+	fprintf(stdout, "  -input <file>     benchmark an existing file instead of generating one\n");
+	fprintf(stdout, "  -repeat <n>       report the best of n runs (default 3)\n");
+	fprintf(stdout, "  -lex-kernel <name> auto, scalar, sse42, avx2\n");
+	fprintf(stdout, "  -lex-threads <n>  lex on n threads (0: number of CPUs, default 1)\n");
+	fprintf(stdout, "  -parse-threads <n> parse function bodies on n threads (0: number of CPUs, default 1)\n");
+}
+
+int main(int argc, char** argv) {
+	ProgramGenerator gen;
+	std::string emit_file, input_file;
+	int repeat = 3;
+	int lex_threads = 1;
+	int parse_threads = 1;
+	for (int i = 1; i < argc; i++) {
+		const char* opt = argv[i];
+		const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(opt, "-h") == 0) {
+			printHelp();
+			return 0;
+		} else if (not val) {
+			fprintf(stderr, "%s の値がありません\n", opt);
+			return 1;
+		} else if (strcmp(opt, "-functions") == 0) {
+			gen.Functions = atoi(val);
+		} else if (strcmp(opt, "-stmts") == 0) {
+			gen.Statements = atoi(val);
+		} else if (strcmp(opt, "-depth") == 0) {
+			gen.Depth = atoi(val);
+		} else if (strcmp(opt, "-arrays") == 0) {
+			gen.Arrays = atoi(val);
+		} else if (strcmp(opt, "-locals") == 0) {
+			gen.Locals = atoi(val);
+		} else if (strcmp(opt, "-comments") == 0) {
+			gen.CommentPercent = atoi(val);
+		} else if (strcmp(opt, "-annotations") == 0) {
+			gen.AnnotatePercent = atoi(val);
+		} else if (strcmp(opt, "-seed") == 0) {
+			gen.Seed = strtoull(val, NULL, 10);
+		} else if (strcmp(opt, "-emit") == 0) {
+			emit_file = val;
+		} else if (strcmp(opt, "-input") == 0) {
+			input_file = val;
+		} else if (strcmp(opt, "-repeat") == 0) {
+			repeat = atoi(val);
+		} else if (strcmp(opt, "-lex-threads") == 0) {
+			lex_threads = atoi(val);
+		} else if (strcmp(opt, "-parse-threads") == 0) {
+			parse_threads = atoi(val);
+		} else if (strcmp(opt, "-lex-kernel") == 0) {
+			if (not setLexKernel(val)) {
+				fprintf(stderr, "-lex-kernel %s はこのCPUでは使えません\n", val);
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "%s は不明なオプションです\n", opt);
+			return 1;
+		}
+		i++;
+	}
+	if (gen.Functions < 1) {
+		fprintf(stderr, "-functions には1以上を指定してください\n");
+		return 1;
+	}
+
+	// 入力の用意
+	bool is_temp = false;
+	if (input_file.empty() or not emit_file.empty()) {
+		std::string src = gen.generate();
+		if (emit_file.empty()) {
+			char path[] = "/tmp/frontend_bench_XXXXXX";
+			int fd = mkstemp(path);
+			if (fd < 0) {
+				fprintf(stderr, "一時ファイルを作れません\n");
+				return 1;
+			}
+			close(fd);
+			emit_file = path;
+			is_temp = true;
+		}
+		FILE* fp = fopen(emit_file.c_str(), "wb");
+		if (not fp or fwrite(src.data(), 1, src.size(), fp) != src.size()) {
+			fprintf(stderr, "%s に書き込めません\n", emit_file.c_str());
+			return 1;
+		}
+		fclose(fp);
+		if (not is_temp) {
+			return 0;
+		}
+		input_file = emit_file;
+	}
+
+	// 計測
+	double best_lex = 1e30, best_parse = 1e30;
+	size_t bytes = 0, tokens = 0, nodes = 0, arena_allocs = 0, arena_bytes = 0, node_bytes = 0;
+	bool ok = true;
+	for (int r = 0; r < repeat and ok; r++) {
+		double t0 = getSeconds();
+		TokenStream* ts = lex_threads == 1 ? LexicalAnalysis(input_file) : ParallelLexicalAnalysis(input_file, lex_threads);
+		double t1 = getSeconds();
+		if (not ts) {
+			fprintf(stderr, "error at lexer\n");
+			ok = false;
+			break;
+		}
+		tokens = ts->getTokenNum();
+		Parser* parser = new Parser(ts);
+		parser->setThreads(parse_threads);
+		double t2 = getSeconds();
+		ok = parser->doParse();
+		double t3 = getSeconds();
+		if (ok) {
+			nodes = countNodes(parser->getAST(), node_bytes);
+			arena_allocs = parser->getAST().getArena().getAllocNum();
+			arena_bytes = parser->getAST().getArena().getAllocBytes();
+		}
+		SAFE_DELETE(parser);
+		best_lex = std::min(best_lex, t1 - t0);
+		best_parse = std::min(best_parse, t3 - t2);
+	}
+	FILE* fp = fopen(input_file.c_str(), "rb");
+	if (fp) {
+		fseek(fp, 0, SEEK_END);
+		bytes = ftell(fp);
+		fclose(fp);
+	}
+	if (is_temp) {
+		unlink(input_file.c_str());
+	}
+	if (not ok) {
+		fprintf(stderr, "err at parser or lexer\n");
+		return 1;
+	}
+
+	double mb = bytes / 1e6;
+	fprintf(stdout, "input:     %.2f MB, %zu tokens, %zu AST nodes\n", mb, tokens, nodes);
+	fprintf(stdout, "kernel:    %s, %d lex thread(s), %d parse thread(s)\n", getLexKernel()->Name, lex_threads, parse_threads);
+	fprintf(stdout, "lex:       %.3f s  %8.1f MB/s  %8.2f Mtokens/s\n", best_lex, mb / best_lex, tokens / best_lex / 1e6);
+	fprintf(stdout, "parse:     %.3f s  %8.1f MB/s  %8.2f Mnodes/s\n", best_parse, mb / best_parse, nodes / best_parse / 1e6);
+	fprintf(stdout, "total:     %.3f s  %8.1f MB/s\n", best_lex + best_parse, mb / (best_lex + best_parse));
+	fprintf(stdout, "AST arena: %zu allocations, %.1f MB\n", arena_allocs, arena_bytes / 1e6);
+	fprintf(stdout, "AST nodes: %.1f MB (%zu bytes/node)\n", node_bytes / 1e6, sizeof(ExprNode));
+	fprintf(stdout, "peak RSS:  %.1f MB\n", getPeakRSS() / 1024.0);
+	return 0;
+}
@@ -0,0 +1,217 @@
+#ifndef BENCH_GENERATOR_HPP
+#define BENCH_GENERATOR_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <sys/resource.h>
+
+/*
+ * ベンチマーク共通の計測用関数
+ */
+inline double getSeconds() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline long getPeakRSS() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss; // KB
+}
+
+/*
+ * ベンチマーク用DummyCプログラム生成クラス
+ * 同じ設定とSeedからは常に同じプログラムを生成する
+ */
+class ProgramGenerator {
+public:
+	int Functions = 1000; // 関数の数(最後の一つはmain)
+	int Statements = 50; // 関数あたりの文の数
+	int Depth = 2; // 式の括弧の深さ
+	int Arrays = 1; // 関数あたりの配列宣言の数
+	int Locals = 0; // 関数あたりのx, y, z以外のローカル変数の数
+	int CommentPercent = 10; // 文の前にコメントを置く確率(%)
+	int AnnotatePercent = 10; // 代入の後に`$`注釈を置く確率(%)
+	uint64_t Seed = 1;
+
+private:
+	uint64_t State;
+	std::string Out;
+
+	uint64_t next();
+	int random(int n) { return next() % n; }
+	bool chance(int percent) { return random(100) < percent; }
+	std::string arrayName(int func, int i) { return "a" + std::to_string(func * Arrays + i); }
+	std::string localName(int i);
+	void emitOperand(int params);
+	void emitFactor(int params, int depth);
+	void emitExpression(int params, int depth);
+	void emitComment();
+	void emitFunction(int index);
+public:
+	std::string generate();
+};
+
+/*
+ * 乱数(xorshift64*)
+ */
+inline uint64_t ProgramGenerator::next() {
+	State ^= State >> 12;
+	State ^= State << 25;
+	State ^= State >> 27;
+	return State * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * i番目のローカル変数名(x, y, zの後にv0, v1, ...)
+ */
+inline std::string ProgramGenerator::localName(int i) {
+	static const char* const locals[] = {"x", "y", "z"};
+	return i < 3 ? locals[i] : "v" + std::to_string(i - 3);
+}
+
+/*
+ * 変数、引数、または定数を一つ出力する
+ */
+inline void ProgramGenerator::emitOperand(int params) {
+	int r = random(params + 4 + Locals);
+	if (r < params) {
+		Out += "p";
+		Out += std::to_string(r);
+	} else if (r < params + 3 + Locals) {
+		Out += localName(r - params);
+	} else {
+		Out += std::to_string(random(1000));
+	}
+}
+
+/*
+ * 因子を出力する(深さが残っていれば括弧でくくった式)
+ */
+inline void ProgramGenerator::emitFactor(int params, int depth) {
+	if (depth > 0 and chance(50)) {
+		Out += "(";
+		emitExpression(params, depth - 1);
+		Out += ")";
+	} else {
+		emitOperand(params);
+	}
+}
+
+/*
+ * 式を出力する
+ * 項は因子一つか「因子 * 因子」、それを+と-でつなぐ
+ */
+inline void ProgramGenerator::emitExpression(int params, int depth) {
+	int terms = 1 + random(3);
+	for (int i = 0; i < terms; i++) {
+		if (i > 0) {
+			Out += random(2) ? " + " : " - ";
+		}
+		emitFactor(params, depth);
+		if (chance(30)) {
+			Out += random(4) ? " * " : " / ";
+			emitFactor(params, depth);
+		}
+	}
+}
+
+/*
+ * コメントを一つ出力する
+ */
+inline void ProgramGenerator::emitComment() {
+	if (random(2)) {
+		Out += "\t// generated statement ";
+		Out += std::to_string(random(100000));
+		Out += "\n";
+	} else {
+		Out += "\t/*\n\t * generated block comment ";
+		Out += std::to_string(random(100000));
+		Out += "\n\t */\n";
+	}
+}
+
+/*
+ * 関数を一つ出力する
+ * 宣言は配列、変数の順(パーサの制約)
+ * 配列名はパーサで関数をまたいで共有されるので、関数ごとに別の名前にする
+ * 引数はindex % 4個、index > 0なら一つ前の関数を呼ぶ
+ */
+inline void ProgramGenerator::emitFunction(int index) {
+	bool is_main = index == Functions - 1;
+	int params = is_main ? 0 : index % 4;
+	if (CommentPercent > 0) {
+		Out += "/* function ";
+		Out += std::to_string(index);
+		Out += " */\n";
+	}
+	Out += "int ";
+	Out += is_main ? "main" : "f" + std::to_string(index);
+	Out += "(";
+	for (int i = 0; i < params; i++) {
+		Out += i ? ", int p" : "int p";
+		Out += std::to_string(i);
+	}
+	Out += ") {\n";
+	for (int i = 0; i < Arrays; i++) {
+		Out += "\tarray " + arrayName(index, i) + "[" + std::to_string(1 + random(100)) + "];\n";
+	}
+	for (int i = 0; i < 3 + Locals; i++) {
+		Out += "\tint " + localName(i) + ";\n";
+	}
+	for (int i = 0; i < Statements; i++) {
+		if (chance(CommentPercent)) {
+			emitComment();
+		}
+		int kind = random(10);
+		if (kind == 0 and Arrays > 0) { // 配列の要素を増やす
+			std::string a = arrayName(index, random(Arrays));
+			if (chance(AnnotatePercent)) {
+				Out += "\t" + a + " $ " + std::to_string(1 + random(1 << 20)) + ";\n";
+			}
+			Out += "\t" + a + " inc 0;\n";
+		} else if (kind == 1 and index > 0) { // 関数呼び出し
+			int callee = index - 1;
+			Out += "\tx = f" + std::to_string(callee) + "(";
+			for (int j = 0; j < callee % 4; j++) {
+				if (j) {
+					Out += ", ";
+				}
+				emitOperand(params);
+			}
+			Out += ");\n";
+		} else if (kind == 2) {
+			Out += "\tprintnum(";
+			emitOperand(params);
+			Out += ");\n";
+		} else { // 代入
+			std::string lhs = localName(random(3 + Locals));
+			Out += "\t";
+			Out += lhs;
+			Out += " = ";
+			emitExpression(params, Depth);
+			Out += ";\n";
+			if (chance(AnnotatePercent)) {
+				Out += "\t";
+				Out += lhs;
+				Out += " $ " + std::to_string(1 + random(1 << 20)) + ";\n";
+			}
+		}
+	}
+	Out += "\treturn x;\n}\n\n";
+}
+
+/*
+ * プログラム全体を生成する
+ * @return 生成したソースコード
+ */
+inline std::string ProgramGenerator::generate() {
+	State = Seed * 0x9e3779b97f4a7c15ULL + 1;
+	Out.clear();
+	for (int i = 0; i < Functions; i++) {
+		emitFunction(i);
+	}
+	return Out;
+}
+
+#endif
@@ -4,9 +4,12 @@
 #include <string>
 #include <map>
 #include <vector>
-#include <llvm/Support/Casting.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/Support/Error.h>
 #include "APP.hpp"
+#include "arena.hpp"
+#include "symbol.hpp"
 
 //
 // AST
@@ -15,60 +18,79 @@
 /*
  * クラス宣言
  */
-class BaseAST;
 class TranslationUnitAST;
 class FunctionAST;
 class PrototypeAST;
 class FunctionStmtAST;
 class VariableDeclAST;
-
 class ArrayDeclAST;
-
-class BinaryExprAST;
-class NullExprAST;
-class CallExprAST;
-class JumpStmtAST;
-class VariableAST;
-class ArrayAST;
-class NumberAST;
+class ExprNode;
 
 /*
- * ASTの種類
+ * 式・文ノードの種類
  */
-enum AstID {
-	BaseID,
-	VariableDeclID,
-	ArrayDeclID,
-	BinaryExprID,
+enum AstID : uint8_t {
 	NullExprID,
+	BinaryExprID,
 	CallExprID,
 	JumpStmtID,
 	VariableID,
-	NumberID
+	ArrayID,
+	NumberID,
+	ElementID, // 配列の要素a[i]
+	LoopStmtID // for文
 };
 
+/*
+ * 二項演算子の種類
+ */
+enum BinaryOp : uint8_t {
+	OP_ASSIGN, // =
+	OP_ANNOTATE, // $
+	OP_INC, // inc
+	OP_ADD, // +
+	OP_SUB, // -
+	OP_MUL, // *
+	OP_DIV // /
+};
+
+/*
+ * 関数本文のノード配列の添字
+ */
+typedef uint32_t NodeIndex;
+const NodeIndex InvalidNode = UINT32_MAX;
+
 const int64_t Infty = (int64_t)(INT32_MAX) << 2;
 
-// 基底
-class BaseAST {
-	AstID ID;
-	// int64_t Upper;
-public:
-	BaseAST(AstID id) : ID(id) {}
-	// BaseAST(AstID id) : ID(id), Upper(Infty) {}
-	virtual ~BaseAST() {}
-	AstID getValueID() const { return ID; }
-	// void UpdateUpper(int64_t x) { Upper = x; }
-	// int64_t getUpper() { return Upper; }	
+/*
+ * 値の範囲[Lower, Upper]
+ * 分からない側はINT64_MIN、INT64_MAXにする
+ */
+struct ValueRange {
+	int64_t Lower;
+	int64_t Upper;
+	static ValueRange unknown() { return {INT64_MIN, INT64_MAX}; }
+	bool isUnknown() const { return Lower == INT64_MIN and Upper == INT64_MAX; }
+	bool hasUpper() const { return Upper != INT64_MAX; }
 };
 
+/*
+ * Symbolの文字列をLLVMの名前として使うための変換
+ */
+inline llvm::StringRef getSymbolRef(Symbol sym) {
+	std::string_view name = getSymbolName(sym);
+	return llvm::StringRef(name.data(), name.size());
+}
+
 // ソースコード
+// 配下の全ノードを確保するArenaを持ち、破棄時にまとめて解放する
 class TranslationUnitAST {
+	Arena Nodes;
 	std::vector<PrototypeAST*> Prototypes;
 	std::vector<FunctionAST*> Functions;
 public:
 	TranslationUnitAST() {}
-	~TranslationUnitAST();
+	Arena& getArena() { return Nodes; }
 	bool addPrototype(PrototypeAST* proto);
 	bool addFunction(FunctionAST* func);
 	bool empty();
@@ -89,188 +111,210 @@ public:
 };
 
 // 関数宣言
+// 戻り値と引数の範囲は、関数定義ならコード生成が、インターフェースファイルから読んだ宣言なら読み込み時に埋める
 class PrototypeAST {
-	std::string Name;
-	std::vector<std::string> Params;
+	Symbol Name;
+	llvm::ArrayRef<Symbol> Params; // Arena上の配列
+	ValueRange Result;
+	ValueRange* ParamRanges; // Arena上の配列(NULLなら全て不明)
 public:
-	PrototypeAST(const std::string& name, const std::vector<std::string>& params)
-		: Name(name), Params(params) {}
-	std::string getName() { return Name; }
-	std::string getParamName(int i) { if (i < Params.size()) { return Params.at(i); } else {return NULL; } }
+	PrototypeAST(Symbol name, llvm::ArrayRef<Symbol> params, ValueRange* param_ranges = NULL)
+		: Name(name), Params(params), Result(ValueRange::unknown()), ParamRanges(param_ranges) {}
+	Symbol getSymbol() { return Name; }
+	llvm::StringRef getName() { return getSymbolRef(Name); }
+	Symbol getParamSymbol(int i) { return Params[i]; }
+	llvm::StringRef getParamName(int i) { if ((size_t)i < Params.size()) { return getSymbolRef(Params[i]); } else { return llvm::StringRef(); } }
 	int getParamNum() { return Params.size(); }
+	ValueRange getResultRange() { return Result; }
+	bool setResultRange(ValueRange range) { Result = range; return true; }
+	ValueRange getParamRange(int i) { return ParamRanges ? ParamRanges[i] : ValueRange::unknown(); }
+	bool setParamRange(int i, ValueRange range) {
+		if (not ParamRanges) {
+			return false;
+		}
+		ParamRanges[i] = range;
+		return true;
+	}
 };
 
 // 関数定義
 class FunctionAST {
 	PrototypeAST* Proto;
-	FunctionStmtAST* Body;
+	FunctionStmtAST* Body; // 差分コンパイルで前回のコード生成結果をそのまま使う関数と、コード生成し終えて本文を解放した関数ではNULL
 public:
 	FunctionAST(PrototypeAST* proto, FunctionStmtAST* body) : Proto(proto), Body(body) {}
-	~FunctionAST();
-	std::string getName() { return Proto->getName(); }
+	llvm::StringRef getName() { return Proto->getName(); }
 	PrototypeAST* getPrototype() { return Proto; }
 	FunctionStmtAST* getBody() { return Body; }
+	bool setBody(FunctionStmtAST* body) { Body = body; return true; }
 };
 
-// 関数定義（本文）
-class FunctionStmtAST {
-	std::vector<VariableDeclAST*> VariableDecls;
-	std::vector<ArrayDeclAST*> ArrayDecls;
-	std::vector<BaseAST*> StmtLists;
+// 式・文のノード(12バイト)
+// 関数本文ごとの連続配列に格納し、子は同じ配列の添字で指す(子は必ず親より前にある)
+class ExprNode {
+	AstID ID;
+	BinaryOp Op; // BinaryExprのみ
+	uint32_t First; // BinaryExpr: 左辺、JumpStmt: 式、LoopStmt: 初期化の代入、CallExpr・Variable・Array・Element: Symbol、Number: 値の下位32bit
+	uint32_t Second; // BinaryExpr: 右辺、CallExpr: 引数リストの位置、LoopStmt: for文のリストの位置、Element: 添字の式、Number: 値の上位32bit
 public:
-	FunctionStmtAST() {}
-	~FunctionStmtAST();
-	bool addVariableDeclaration(VariableDeclAST* vdecl);
-	bool addArrayDeclaration(ArrayDeclAST* vdecl);
-	bool addStatement(BaseAST* stmt) { StmtLists.push_back(stmt); return true; }
-	VariableDeclAST* getVariableDecl(int i) { if (i < VariableDecls.size()) { return VariableDecls.at(i); } else { return NULL; } }
-	ArrayDeclAST* getArrayDecl(int i) { if (i < ArrayDecls.size()) { return ArrayDecls.at(i); } else { return NULL; } }
-	BaseAST* getStatement(int i) { if (i < StmtLists.size()) { return StmtLists.at(i); } else { return NULL; } }
+	ExprNode(AstID id, BinaryOp op, uint32_t first, uint32_t second)
+		: ID(id), Op(op), First(first), Second(second) {}
+	ExprNode(int64_t val)
+		: ID(NumberID), Op(OP_ASSIGN), First((uint32_t)val), Second((uint32_t)((uint64_t)val >> 32)) {}
+	AstID getValueID() const { return ID; }
+	BinaryOp getOp() const { return Op; }
+	NodeIndex getLHS() const { return First; }
+	NodeIndex getRHS() const { return Second; }
+	NodeIndex getExpr() const { return First; }
+	Symbol getSymbol() const { return First; }
+	llvm::StringRef getName() const { return getSymbolRef(First); }
+	int64_t getNumberValue() const { return (int64_t)(((uint64_t)Second << 32) | First); }
+	uint32_t getArgList() const { return Second; }
+	uint32_t getLoopList() const { return Second; }
+	NodeIndex getIndex() const { return Second; }
 };
+static_assert(sizeof(ExprNode) == 12, "ExprNode should stay 12 bytes");
 
 // 変数宣言
-class VariableDeclAST : public BaseAST {
+class VariableDeclAST {
 public:
 	typedef enum {
 		param,
 		local
 	} DeclType;
 private:
-	std::string Name;
+	Symbol Name;
 	DeclType Type;
 public:
-	VariableDeclAST(const std::string& name) : BaseAST(VariableDeclID), Name(name) {}
-	static inline bool classof(VariableDeclAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == VariableDeclID;
-	}
-	~VariableDeclAST() {}
-	bool setDeclType(DeclType type) { Type = type; return true; }
-	std::string getName() { return Name; }
-	DeclType getType() { return Type; }
+	VariableDeclAST(Symbol name, DeclType type) : Name(name), Type(type) {}
+	Symbol getSymbol() const { return Name; }
+	llvm::StringRef getName() const { return getSymbolRef(Name); }
+	DeclType getType() const { return Type; }
 };
 
 // array decl
-class ArrayDeclAST : public BaseAST {
+// 初期化子は`= fill(v)`(全要素をv)か`= {v0, v1, ...}`(足りない要素は0)
+class ArrayDeclAST {
 public:
 	typedef enum {
 		param,
 		local
 	} DeclType;
+	typedef enum {
+		no_init,
+		fill_init,
+		list_init
+	} InitType;
 private:
-	std::string Name;
+	Symbol Name;
 	size_t Size;
 	DeclType Type;
+	InitType Init;
+	int64_t FillValue; // fill(v)のv
+	uint32_t InitList; // {...}の値の、関数本文のArrayInitsでの先頭
+	uint32_t InitNum; // {...}の値の数
 public:
-	ArrayDeclAST(const std::string& name, size_t size) : BaseAST(VariableDeclID), Name(name), Size(size) {}
-	static inline bool classof(ArrayDeclAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == ArrayDeclID;
-	}
-	~ArrayDeclAST() {}
-	bool setDeclType(DeclType type) { Type = type; return true; }
-	std::string getName() { return Name; }
-	size_t getSize() { return Size; }
-	DeclType getType() { return Type; }
-};
-
-// 二項演算
-class BinaryExprAST : public BaseAST {
-	std::string Op;
-	BaseAST* LHS, * RHS;
-public:
-	BinaryExprAST(std::string op, BaseAST* lhs, BaseAST* rhs)
-		: BaseAST(BinaryExprID), Op(op), LHS(lhs), RHS(rhs) {
-		// (*this).UpdateUpper(lhs->getUpper() + rhs->getUpper());
-	}
-	~BinaryExprAST() { SAFE_DELETE(LHS); SAFE_DELETE(RHS); }
-	static inline bool classof(BinaryExprAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == BinaryExprID;
-	}
-	std::string getOp() { return Op; }
-	BaseAST* getLHS() { return LHS; }
-	BaseAST* getRHS() { return RHS; }
+	ArrayDeclAST(Symbol name, size_t size, DeclType type) : Name(name), Size(size), Type(type), Init(no_init), FillValue(0), InitList(0), InitNum(0) {}
+	Symbol getSymbol() const { return Name; }
+	llvm::StringRef getName() const { return getSymbolRef(Name); }
+	size_t getSize() const { return Size; }
+	DeclType getType() const { return Type; }
+	InitType getInit() const { return Init; }
+	int64_t getFillValue() const { return FillValue; }
+	uint32_t getInitList() const { return InitList; }
+	uint32_t getInitNum() const { return InitNum; }
+	bool setFill(int64_t val) { Init = fill_init; FillValue = val; return true; }
+	bool setInitList(uint32_t list, uint32_t num) { Init = list_init; InitList = list; InitNum = num; return true; }
 };
 
-// ;
-class NullExprAST : public BaseAST {
+// 関数定義（本文）
+// 宣言・式・文は全て値としてArena上の連続配列に持ち、ノード間は添字でつなぐ
+// ノードはSimplifierがその場で書き換える(子を持つノードを子の写しや整数に置き換えるだけなので、添字は変わらない)
+class FunctionStmtAST {
+	llvm::ArrayRef<VariableDeclAST> VariableDecls;
+	llvm::ArrayRef<ArrayDeclAST> ArrayDecls;
+	llvm::MutableArrayRef<ExprNode> Nodes;
+	llvm::ArrayRef<NodeIndex> ArgLists; // 関数呼び出しごとに[引数の数, 引数...]
+	llvm::ArrayRef<NodeIndex> StmtLists;
+	llvm::ArrayRef<int64_t> ArrayInits; // 配列の初期化子{...}の値を宣言の順に並べたもの
+	llvm::ArrayRef<NodeIndex> LoopLists; // for文ごとに[最初のノード, 上限の式, 増分の整数, 本文の文の数, 本文の文...]
+	llvm::ArrayRef<ValueRange> Ranges; // ノードごとの値の範囲(Simplifierが埋める、それまでは空)
 public:
-	NullExprAST() : BaseAST(NullExprID) {}
-	static inline bool classof(NullExprAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == NullExprID;
-	}
-};
+	FunctionStmtAST(llvm::ArrayRef<VariableDeclAST> vdecls, llvm::ArrayRef<ArrayDeclAST> adecls,
+		llvm::MutableArrayRef<ExprNode> nodes, llvm::ArrayRef<NodeIndex> arg_lists, llvm::ArrayRef<NodeIndex> stmts,
+		llvm::ArrayRef<int64_t> array_inits, llvm::ArrayRef<NodeIndex> loop_lists)
+		: VariableDecls(vdecls), ArrayDecls(adecls), Nodes(nodes), ArgLists(arg_lists), StmtLists(stmts), ArrayInits(array_inits), LoopLists(loop_lists) {}
+	const VariableDeclAST* getVariableDecl(int i) const { if ((size_t)i < VariableDecls.size()) { return &VariableDecls[i]; } else { return NULL; } }
+	const ArrayDeclAST* getArrayDecl(int i) const { if ((size_t)i < ArrayDecls.size()) { return &ArrayDecls[i]; } else { return NULL; } }
+	NodeIndex getStatement(int i) const { if ((size_t)i < StmtLists.size()) { return StmtLists[i]; } else { return InvalidNode; } }
+	const ExprNode& getNode(NodeIndex i) const { return Nodes[i]; }
+	size_t getNodeNum() const { return Nodes.size(); }
+	size_t getNodeBytes() const { return Nodes.size() * sizeof(ExprNode) + (ArgLists.size() + LoopLists.size()) * sizeof(NodeIndex); }
+	llvm::ArrayRef<int64_t> getArrayInit(const ArrayDeclAST* adecl) const { return ArrayInits.slice(adecl->getInitList(), adecl->getInitNum()); }
+	int getArgNum(NodeIndex call) const { return ArgLists[Nodes[call].getArgList()]; }
+	NodeIndex getArg(NodeIndex call, int i) const { return ArgLists[Nodes[call].getArgList() + 1 + i]; }
+	// for文のノードは[最初のノード, for文)の範囲に続けて並ぶ(初期化・上限・本文の式は全てこの中にある)
+	NodeIndex getLoopBegin(NodeIndex loop) const { return LoopLists[Nodes[loop].getLoopList()]; }
+	NodeIndex getLoopLimit(NodeIndex loop) const { return LoopLists[Nodes[loop].getLoopList() + 1]; }
+	NodeIndex getLoopStep(NodeIndex loop) const { return LoopLists[Nodes[loop].getLoopList() + 2]; }
+	int getLoopStmtNum(NodeIndex loop) const { return LoopLists[Nodes[loop].getLoopList() + 3]; }
+	NodeIndex getLoopStmt(NodeIndex loop, int i) const { return LoopLists[Nodes[loop].getLoopList() + 4 + i]; }
+	bool setNode(NodeIndex i, const ExprNode& node) { Nodes[i] = node; return true; }
+	bool setRanges(llvm::ArrayRef<ValueRange> ranges) { Ranges = ranges; return true; }
 
-// 関数呼び出し
-class CallExprAST : public BaseAST {
-	std::string Callee;
-	std::vector<BaseAST*> Args;
-public:
-	CallExprAST(const std::string& callee, std::vector<BaseAST*>& args)
-		: BaseAST(CallExprID), Callee(callee), Args(args) {}
-	~CallExprAST();
-	std::string getCallee() { return Callee; }
-	BaseAST* getArgs(int i) { if (i < Args.size()) { return Args.at(i); } else { return NULL; } }
-	static inline bool classof(CallExprAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == CallExprID;
+	/*
+	 * ノードの値の範囲を取得する
+	 * 範囲を求めていなければ、整数はその値、それ以外は不明とする
+	 * @param ノードの添字
+	 * @return 値の範囲
+	 */
+	ValueRange getRange(NodeIndex i) const {
+		if (not Ranges.empty()) {
+			return Ranges[i];
+		} else if (Nodes[i].getValueID() == NumberID) {
+			return {Nodes[i].getNumberValue(), Nodes[i].getNumberValue()};
+		} else {
+			return ValueRange::unknown();
+		}
 	}
 };
 
-// ジャンプ（今回はreturn）
-class JumpStmtAST : public BaseAST {
-	BaseAST* Expr;
+// 関数本文の組み立て用
+// 構文解析中はここにノードを追加し、関数の終わりにArenaへちょうどの大きさで写してFunctionStmtASTにする
+// 関数ごとに使い回すので、作業用の配列は最も大きい関数の分だけ確保すれば済む
+class FunctionStmtBuilder {
+	std::vector<VariableDeclAST> VariableDecls;
+	std::vector<ArrayDeclAST> ArrayDecls;
+	std::vector<ExprNode> Nodes;
+	std::vector<NodeIndex> ArgLists;
+	std::vector<NodeIndex> StmtLists;
+	std::vector<int64_t> ArrayInits;
+	std::vector<NodeIndex> LoopLists;
 public:
-	JumpStmtAST(BaseAST* expr) : BaseAST(JumpStmtID), Expr(expr) {}
-	~JumpStmtAST() { SAFE_DELETE(Expr); }
-	BaseAST* getExpr() { return Expr; }
-	static inline bool classof(JumpStmtAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == JumpStmtID;
-	}
-};
+	bool addVariableDeclaration(const VariableDeclAST& vdecl) { VariableDecls.push_back(vdecl); return true; }
+	bool addArrayDeclaration(const ArrayDeclAST& adecl) { ArrayDecls.push_back(adecl); return true; }
+	uint32_t addArrayInit(const std::vector<int64_t>& values) { ArrayInits.insert(ArrayInits.end(), values.begin(), values.end()); return ArrayInits.size() - values.size(); }
+	bool addStatement(NodeIndex stmt) { StmtLists.push_back(stmt); return true; }
 
-// 変数参照（整数）
-class VariableAST : public BaseAST {
-	std::string Name;
-public:
-	VariableAST(const std::string& name) : BaseAST(VariableID), Name(name) {}
-	~VariableAST() {}
-	static inline bool classof(VariableAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == VariableID;
-	}
-	std::string getName() { return Name; }
-};
+	// ノード追加(追加したノードの添字を返す)
+	NodeIndex addNullExpr() { return addNode(ExprNode(NullExprID, OP_ASSIGN, 0, 0)); }
+	NodeIndex addBinaryExpr(BinaryOp op, NodeIndex lhs, NodeIndex rhs) { return addNode(ExprNode(BinaryExprID, op, lhs, rhs)); }
+	NodeIndex addCallExpr(Symbol callee, const std::vector<NodeIndex>& args);
+	NodeIndex addJumpStmt(NodeIndex expr) { return addNode(ExprNode(JumpStmtID, OP_ASSIGN, expr, 0)); }
+	NodeIndex addVariable(Symbol name) { return addNode(ExprNode(VariableID, OP_ASSIGN, name, 0)); }
+	NodeIndex addArray(Symbol name) { return addNode(ExprNode(ArrayID, OP_ASSIGN, name, 0)); }
+	NodeIndex addElement(Symbol name, NodeIndex index) { return addNode(ExprNode(ElementID, OP_ASSIGN, name, index)); }
+	NodeIndex addLoopStmt(NodeIndex begin, NodeIndex init, NodeIndex limit, NodeIndex step, const std::vector<NodeIndex>& stmts);
+	NodeIndex addNumber(int64_t val) { return addNode(ExprNode(val)); }
+	const ExprNode& getNode(NodeIndex i) const { return Nodes[i]; }
+	bool setNode(NodeIndex i, const ExprNode& node) { Nodes[i] = node; return true; }
+	NodeIndex getNodeNum() const { return Nodes.size(); }
 
-// 配列参照
-class ArrayAST : public BaseAST {
-	std::string Name;
-public:
-	ArrayAST(const std::string& name) : BaseAST(VariableID), Name(name) {}
-	~ArrayAST() {}
-	static inline bool classof(ArrayAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == VariableID;
-	}
-	std::string getName() { return Name; }
-};
+	bool clear();
+	FunctionStmtAST* build(Arena& arena);
 
-// 整数
-class NumberAST : public BaseAST {
-	int64_t Val; // TODO
-public:
-	NumberAST(int64_t val) : BaseAST(NumberID), Val(val) {
-		//  (*this).UpdateUpper(val);
-	};
-	~NumberAST() {}
-	int64_t getNumberValue() { return Val; }
-	static inline bool classof(NumberAST const*) { return true; }
-	static inline bool classof(BaseAST const* base) {
-		return base->getValueID() == NumberID;
-	}
+private:
+	NodeIndex addNode(const ExprNode& node) { Nodes.push_back(node); return Nodes.size() - 1; }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,95 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "APP.hpp"
+
+/*
+ * バンプポインタ方式のメモリ確保クラス
+ * 大きめのブロックから先頭に向かって順に切り出すだけで、個別の解放はしない
+ * 確保した領域はreleaseまたは破棄時にブロック単位でまとめて解放する
+ * デストラクタが必要な型だけはcreate時に登録しておき、解放時に逆順で呼ぶ
+ */
+class Arena {
+private:
+	struct Cleanup {
+		void (*Destroy)(void*);
+		void* Object;
+	};
+	std::vector<char*> Blocks;
+	std::vector<Cleanup> Cleanups;
+	char* BlockCur;
+	size_t BlockRest;
+	size_t AllocNum;
+	size_t AllocBytes;
+
+	void* allocateSlow(size_t size, size_t align);
+public:
+	Arena() : BlockCur(NULL), BlockRest(0), AllocNum(0), AllocBytes(0) {}
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	~Arena() { release(); }
+
+	/*
+	 * 領域を確保する
+	 * @param サイズ、アラインメント(2の冪)
+	 * @return 確保した領域の先頭
+	 */
+	void* allocate(size_t size, size_t align) {
+		size_t pad = -reinterpret_cast<uintptr_t>(BlockCur) & (align - 1);
+		if (size + pad > BlockRest) {
+			return allocateSlow(size, align);
+		}
+		void* p = BlockCur + pad;
+		BlockCur += size + pad;
+		BlockRest -= size + pad;
+		AllocNum++;
+		AllocBytes += size;
+		return p;
+	}
+
+	/*
+	 * オブジェクトを構築する
+	 * @param コンストラクタの引数
+	 * @return 構築したオブジェクト
+	 */
+	template <class T, class... Args>
+	T* create(Args&&... args) {
+		T* obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if constexpr (not std::is_trivially_destructible<T>::value) {
+			Cleanups.push_back({[](void* p) { static_cast<T*>(p)->~T(); }, obj});
+		}
+		return obj;
+	}
+
+	/*
+	 * 配列をコピーする
+	 * @param コピー元の先頭、要素数
+	 * @return コピー先の先頭(要素数0ならNULL)
+	 */
+	template <class T>
+	T* copyArray(const T* data, size_t n) {
+		static_assert(std::is_trivially_copyable<T>::value, "Arena::copyArray needs a trivially copyable type");
+		if (n == 0) {
+			return NULL;
+		}
+		T* p = static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+		std::copy(data, data + n, p);
+		return p;
+	}
+
+	bool merge(Arena& other);
+	bool release();
+	size_t getAllocNum() const { return AllocNum; }
+	size_t getAllocBytes() const { return AllocBytes; }
+	size_t getBlockNum() const { return Blocks.size(); }
+};
+
+#endif
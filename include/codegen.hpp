@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include <map>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 #include <llvm/ADT/APInt.h>
 // #include <llvm/Constants.h>
@@ -20,11 +22,34 @@
 // #include <llvm/MDBuilder.h>
 // #include <llvm/ValueSymbolTable.h>
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/IR/ConstantRange.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/ModuleSlotTracker.h>
+#include <llvm/IR/ValueHandle.h>
 
 #include "APP.hpp"
 #include "AST.hpp"
 
+/*
+ * 大きい配列の置き場所
+ */
+enum ArrayPlacement {
+	ArrayOnHeap, // 関数の入口でcallocし、returnの前にfreeする
+	ArrayInGlobal // 関数ごとの内部の大域変数(ゼロ初期化、BSS。二回目以降の呼び出しではmemsetで0に戻す)。再入される関数では使えない
+};
+
+/*
+ * 配列の領域([N x iW]へのポインタ)と型
+ */
+struct LocalArray {
+	llvm::Value* Ptr;
+	llvm::ArrayType* Type;
+	bool UpperData; // 要素の演算にupper_dataを付けるか(DowncastPassが要素の型を変えられる配列か)
+};
+
 /*
  * コード生成クラス
  */
@@ -32,28 +57,107 @@ class CodeGen {
 private:
 	llvm::LLVMContext TheContext;
 	llvm::Function* CurFunc; // 現在コード生成中のFunc
+	FunctionStmtAST* CurBody; // 現在コード生成中の関数本文(ノードの添字はこの中を指す)
+	PrototypeAST* CurProto; // 現在コード生成中の関数の宣言(戻り値・引数の範囲を書き込む)
+	ValueRange CurResult; // これまでのreturn文の値の範囲を合わせたもの
+	bool CurReturned;
+	std::unordered_map<Symbol, ValueRange> CalleeRanges; // 宣言の時点で戻り値の範囲が分かっている関数(インターフェースファイルから読んだもの)
+	std::unordered_map<Symbol, std::vector<ValueRange>> CalleeParamRanges; // 宣言の時点で引数の範囲が分かっている関数(同上)
+	int LoopDepth; // 生成中のfor文の本文の深さ
+	SymbolMap<llvm::AllocaInst*> LocalVariables; // 現在の関数の変数・引数のalloca(関数ごとに作り直す)
+	SymbolMap<LocalArray> LocalArrays; // 現在の関数の配列(関数ごとに作り直す)
+	llvm::DenseMap<llvm::Value*, llvm::ConstantRange> ValueRanges; // 現在の関数の値の範囲(配列は領域のポインタに持たせる。関数ごとに作り直す)
+	llvm::DenseMap<Symbol, llvm::ConstantRange> VariableRanges; // 現在の関数の変数・引数の範囲(関数ごとに作り直す)
+	// DirectSSAの場合の、基本ブロックごとの変数の現在の値と、未封鎖のブロックに置いたphi(関数ごとに作り直す)
+	// 値はRAUWに追従するハンドルで持つ(不要なphiを消すと、そのphiを指していた定義は置き換え先になる)
+	bool DirectSSA; // 変数をallocaに置かず、SSA形式の値として直接生成する
+	llvm::DenseMap<llvm::BasicBlock*, SymbolMap<llvm::WeakTrackingVH>> CurrentDefs;
+	llvm::DenseMap<llvm::BasicBlock*, std::vector<std::pair<Symbol, llvm::PHINode*>>> IncompletePhis;
+	llvm::DenseSet<llvm::BasicBlock*> SealedBlocks; // 先行ブロックが全て決まったブロック
+	// Narrowかfor文がある場合の、変数に代入される値の範囲を合わせたものと、配列の`$`の上限(関数ごとに作り直す)
+	bool Narrow; // 値の範囲が収まる最も狭い整数型(i16, i32, i64)で生成する
+	SymbolMap<ValueRange> AssignedRanges;
+	SymbolMap<int64_t> ArrayBounds;
+	// 配列のバイト数がArrayStackLimitを超えたら、スタックではなくLargeArraysに置く
+	size_t ArrayStackLimit;
+	ArrayPlacement LargeArrays;
+	std::vector<llvm::Value*> HeapArrays; // 現在の関数でcallocした領域(returnの前にfreeする)
+	std::vector<llvm::GlobalVariable*> NewGlobals; // 現在の関数で作った大域変数(逐次コード生成で関数と一緒に書き出す)
+	// 配列の要素a[i]の添字の検査と、現在の関数で添字で読み書きする配列(DowncastPassの対象にしない)
+	bool BoundsCheck; // 範囲内と分からない添字を検査する
+	llvm::BasicBlock* BoundsFailBlock; // 添字が範囲外かcallocが失敗したときに止めるブロック(関数ごとに一つ作る)
+	SymbolMap<bool> IndexedArrays;
+	SymbolMap<ValueRange> ElementRanges; // Narrowの場合の、配列の要素に代入される値の範囲を合わせたもの
+	unsigned UpperDataKind; // upper_dataのメタデータの種類
+	std::unordered_map<int64_t, llvm::MDNode*> UpperNodes; // 上限ごとのupper_dataのMDNode
+	std::map<std::tuple<unsigned, int64_t, int64_t>, llvm::MDNode*> RangeNodes; // 型の幅・範囲ごとの!rangeのMDNode
+	SymbolMap<llvm::Function*> Callees; // 呼び出し先のFunction(関数を消す・置き換えるときに作り直す)
 	llvm::Module* Mod; // 生成したModuleを格納
 	llvm::IRBuilder<>* Builder; // LLVM-IRを生成するIRBuilderクラス
+	// 逐次コード生成で関数ごとに書き出す場合の出力先と、書き出し済みの関数・メタデータ
+	llvm::raw_ostream* StreamOut;
+	llvm::ModuleSlotTracker* SlotTracker;
+	llvm::DenseSet<llvm::Function*> WrittenFunctions;
+	llvm::SetVector<llvm::MDNode*> WrittenNodes; // 番号順
 
 public:
 	CodeGen();
 	~CodeGen();
 	bool doCodeGen(TranslationUnitAST& tunit, std::string name, std::string link_file, bool with_jit);
+	bool doIncrementalCodeGen(TranslationUnitAST& tunit, std::string name);
 	llvm::Module& getModule();
+	bool startModule(std::string name, llvm::raw_ostream* out);
+	bool addPrototype(PrototypeAST* proto);
+	bool addFunction(FunctionAST* func);
+	bool finishModule(TranslationUnitAST& tunit);
+	bool setDirectSSA(bool direct_ssa) { DirectSSA = direct_ssa; return true; }
+	bool setNarrow(bool narrow) { Narrow = narrow; return true; }
+	bool setArrayPlacement(size_t stack_limit, ArrayPlacement large_arrays) { ArrayStackLimit = stack_limit; LargeArrays = large_arrays; return true; }
+	bool setBoundsCheck(bool bounds_check) { BoundsCheck = bounds_check; return true; }
 
 private:
+	bool createModule(std::string name);
 	bool generateTranslationUnit(TranslationUnitAST& tunit, std::string name);
+	bool updateTranslationUnit(TranslationUnitAST& tunit);
+	bool orderFunctions(TranslationUnitAST& tunit);
+	bool setArgNames(llvm::Function* func, PrototypeAST* proto);
 	llvm::Function* generateFunctionDefinition(FunctionAST* func, llvm::Module* mod);
 	llvm::Function* generatePrototype(PrototypeAST* proto, llvm::Module* mod);
 	llvm::Value* generateFunctionStatement(FunctionStmtAST* func_stmt);
-	llvm::Value* generateVariableDeclaration(VariableDeclAST* v_decl);
-	llvm::Value* generateArrayDeclaration(ArrayDeclAST* a_decl);
-	llvm::Value* generateStatement(BaseAST* stmt);
-	llvm::Value* generateBinaryExpression(BinaryExprAST* bin_expr);
-	llvm::Value* generateCallExpression(CallExprAST* call_expr);
-	llvm::Value* generateJumpStatement(JumpStmtAST* jump_stmt);
-	llvm::Value* generateVariable(VariableAST* var);
+	bool collectAssignedRanges(NodeIndex expr);
+	llvm::AllocaInst* createEntryAlloca(llvm::Type* type, llvm::StringRef name);
+	llvm::Value* generateVariableDeclaration(const VariableDeclAST* v_decl);
+	llvm::Value* generateArrayDeclaration(const ArrayDeclAST* a_decl);
+	bool generateArrayInitializer(const ArrayDeclAST* a_decl, const LocalArray& array, bool zeroed);
+	llvm::Value* generateStatement(NodeIndex stmt);
+	llvm::Value* generateExpression(NodeIndex expr);
+	llvm::Value* generateBinaryExpression(NodeIndex bin_expr);
+	llvm::Value* generateCallExpression(NodeIndex call_expr);
+	llvm::Value* generateJumpStatement(NodeIndex jump_stmt);
+	llvm::Value* generateLoopStatement(NodeIndex loop);
+	bool narrowArguments(NodeIndex call_expr);
+	bool collectParamRanges(FunctionStmtAST* func_stmt);
+	llvm::Value* generateVariable(Symbol var, ValueRange range);
+	llvm::Value* generateElementPointer(NodeIndex element);
+	bool generateTrapUnless(llvm::Value* cond, const char* ok_name);
+	bool setUpperData(llvm::Instruction* inst, int64_t upper);
+	bool setLoadRange(llvm::LoadInst* load, ValueRange range);
+	bool setRange(llvm::Value* v, llvm::ConstantRange range);
+	const llvm::ConstantRange* findRange(llvm::Value* v);
+	bool setVariableRange(Symbol var, llvm::ConstantRange range);
+	const llvm::ConstantRange* findVariableRange(Symbol var);
+	const llvm::ConstantRange* findOperandRange(NodeIndex expr, llvm::Value* v);
+	bool writeVariable(Symbol var, llvm::BasicBlock* block, llvm::Value* value);
+	llvm::Value* readVariable(Symbol var, llvm::BasicBlock* block);
+	llvm::Value* readVariableRecursive(Symbol var, llvm::BasicBlock* block);
+	llvm::Value* addPhiOperands(Symbol var, llvm::PHINode* phi);
+	llvm::Value* tryRemoveTrivialPhi(llvm::PHINode* phi);
+	bool sealBlock(llvm::BasicBlock* block);
+	llvm::Function* getCallee(Symbol name);
 	llvm::Value* generateNumber(int64_t value);
+	llvm::IntegerType* getIntType(ValueRange range);
+	llvm::IntegerType* getVariableType(Symbol var);
+	llvm::Value* castInt(llvm::Value* v, llvm::Type* type);
 	bool linkModule(llvm::Module* dest, std::string file_name);
 };
 
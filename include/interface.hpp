@@ -0,0 +1,70 @@
+#ifndef INTERFACE_HPP
+#define INTERFACE_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "APP.hpp"
+#include "AST.hpp"
+#include "lexer.hpp"
+
+/*
+ * モジュールインターフェースファイル(.dci)の形式
+ * 翻訳単位が定義した関数のPrototypeと、コード生成で分かった戻り値・引数の範囲を持つ
+ * 固定長のレコードと文字列表だけからなり、mmapした領域をそのまま読む
+ * (書いた環境と同じバイト順・アラインメントで読む前提)
+ *
+ * InterfaceHeader
+ * InterfaceFunction × FunctionNum
+ * InterfaceParam × ParamNum (関数ごとに連続)
+ * 文字列表('\0'終端の名前を並べたもの、StringBytesバイト)
+ */
+struct InterfaceHeader {
+	char Magic[4]; // "DCIF"
+	uint32_t Version;
+	uint32_t FunctionNum;
+	uint32_t ParamNum;
+	uint32_t StringBytes;
+	uint32_t Reserved;
+};
+
+struct InterfaceFunction {
+	uint32_t Name; // 文字列表の位置
+	uint32_t ParamBegin; // InterfaceParamの位置
+	uint32_t ParamNum;
+	uint32_t Reserved;
+	ValueRange Result;
+};
+
+struct InterfaceParam {
+	uint32_t Name;
+	uint32_t Reserved;
+	ValueRange Range;
+};
+
+/*
+ * モジュールインターフェースファイルの読み書きクラス
+ * 読み込みはファイルをmmapして検査するだけで、ソースコードの字句解析・構文解析はしない
+ */
+class ModuleInterface {
+private:
+	SourceBuffer* Buffer;
+	const InterfaceHeader* Header;
+	const InterfaceFunction* Functions;
+	const InterfaceParam* Params;
+	const char* Strings;
+
+	ModuleInterface() : Buffer(NULL), Header(NULL), Functions(NULL), Params(NULL), Strings(NULL) {}
+	bool validate(const std::string& file_name);
+public:
+	~ModuleInterface() { SAFE_DELETE(Buffer); }
+	static ModuleInterface* load(std::string file_name);
+	static bool write(std::string file_name, TranslationUnitAST& tunit);
+
+	int getFunctionNum() const { return Header->FunctionNum; }
+	const InterfaceFunction& getFunction(int i) const { return Functions[i]; }
+	const InterfaceParam& getParam(const InterfaceFunction& func, int i) const { return Params[func.ParamBegin + i]; }
+	std::string_view getString(uint32_t offset) const { return std::string_view(Strings + offset); }
+};
+
+#endif
@@ -3,79 +3,227 @@
 
 #include <cstdio>
 #include <cstdlib>
-#include <fstream>
-#include <list>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "APP.hpp"
+#include "symbol.hpp"
 
 /*
  * token enum
  */
-enum TokenType {
+enum TokenType : uint8_t {
 	TOK_IDENTIFIER,
 	TOK_DIGIT,
 	TOK_SYMBOL,
 	TOK_INT,
 	TOK_ARRAY,
 	TOK_RETURN,
+	TOK_FOR,
 	TOK_EOF
 };
 
 /*
  * 個別 token class
+ * 文字列は持たず、入力バッファ上の位置(Offset, Length)だけを保持する
+ * 識別子の場合はNumberにSymbolを、記号の場合はその文字を格納する
  */
-typedef class Token {
+class Token {
 private:
 	TokenType Type;
-	std::string TokenString;
-	int64_t Number; // TODO
+	uint32_t Length;
+	uint32_t Offset;
 	int Line;
+	int64_t Number; // TODO
 
 public:
-	Token(std::string string, TokenType type, int line)
-		: TokenString(string), Type(type), Line(line) {
-		if (type == TOK_DIGIT) {
-			Number = atoll(string.c_str());
-		} else {
-			Number = 0x7fffffff;
-		}
-	}
-	~Token() {}
+	Token() {}
+	Token(TokenType type, uint32_t offset, uint32_t length, int line, int64_t number)
+		: Type(type), Length(length), Offset(offset), Line(line), Number(number) {}
 
-	TokenType getTokenType() { return Type; }
-	std::string getTokenString() { return TokenString; }
-	int64_t getNumberValue() { return Number; }
+	TokenType getTokenType() const { return Type; }
+	uint32_t getOffset() const { return Offset; }
+	uint32_t getLength() const { return Length; }
+	int64_t getNumberValue() const { return Number; }
+	Symbol getSymbol() const { return (Symbol)Number; }
 	bool setLine(int line) { Line = line; return true; }
+	int getLine() const { return Line; }
+};
+
+/*
+ * 入力ファイル保持クラス
+ * 通常ファイルはmmapし、mmapできないもの(パイプなど)は全体を読み込む
+ */
+class SourceBuffer {
+private:
+	const char* Data;
+	size_t Size;
+	bool Mapped;
+	std::string Storage;
+
+	SourceBuffer() : Data(NULL), Size(0), Mapped(false) {}
+public:
+	~SourceBuffer();
+	static SourceBuffer* open(std::string input_filename);
+	const char* getData() const { return Data; }
+	size_t getSize() const { return Size; }
+	bool isMapped() const { return Mapped; }
+};
+
+/*
+ * 字句解析の内側ループで使う文字種判定カーネル
+ * いずれも[cur, end)を走査し、条件を満たさなくなった位置を返す
+ * 行数は読み飛ばした範囲の改行の数だけlineに加算する
+ */
+struct LexKernel {
+	const char* Name;
+	const char* (*skipSpace)(const char* cur, const char* end, int& line);
+	const char* (*skipAlnum)(const char* cur, const char* end);
+	const char* (*skipDigit)(const char* cur, const char* end);
+	const char* (*findCommentEnd)(const char* cur, const char* end, int& line); // "*/"の'*'、なければend
+};
+
+bool setLexKernel(std::string name);
+const LexKernel* getLexKernel();
+
+/*
+ * 字句解析器
+ * [Cur, End)の範囲から一つずつトークンを切り出す
+ * Offsetは常にBaseからの位置
+ * Finalでない入力の終端でトークンが途切れる場合はLEX_MOREを返すので、
+ * 続きを読み込んでsetInputし直してから再度呼び出す
+ */
+class Lexer {
+public:
+	typedef enum {
+		LEX_TOKEN,
+		LEX_END,
+		LEX_MORE,
+		LEX_ERROR
+	} Result;
+	typedef enum {
+		NO_COMMENT,
+		BLOCK_COMMENT,
+		LINE_COMMENT
+	} CommentState;
+private:
+	const char* Base;
+	const char* Cur;
+	const char* End;
+	bool Final;
+	int Line;
+	CommentState Comment;
+	const LexKernel* Kernel;
+	SymbolTable* Symbols;
+	bool Quiet;
+	bool skipComment();
+public:
+	Lexer(const char* base, const char* begin, const char* end, bool final = true)
+		: Base(base), Cur(begin), End(end), Final(final), Line(0), Comment(NO_COMMENT), Kernel(getLexKernel()),
+		  Symbols(&getSymbolTable()), Quiet(false) {}
+	Result lexToken(Token& token);
+	bool setInput(const char* base, const char* begin, const char* end, bool final) {
+		Base = base; Cur = begin; End = end; Final = final;
+		return true;
+	}
+	bool setCommentState(CommentState comment) { Comment = comment; return true; }
+	bool setSymbolTable(SymbolTable* symbols) { Symbols = symbols; return true; }
+	bool setQuiet(bool quiet) { Quiet = quiet; return true; }
+	const char* getCur() { return Cur; }
 	int getLine() { return Line; }
-} Token;
+	CommentState getCommentState() { return Comment; }
+};
+
+/*
+ * 入力を少しずつ読み込みながらトークンを切り出すクラス
+ * 保持するのは読み込み用のバッファだけなので、パイプからも読める
+ */
+class TokenReader {
+private:
+	int FD;
+	std::vector<char> Buffer;
+	size_t Filled;
+	bool Eof;
+	Lexer Lex;
+
+	TokenReader(int fd);
+	bool fill();
+public:
+	~TokenReader();
+	static TokenReader* open(std::string input_filename);
+	Lexer::Result next(Token& token, std::string& text);
+	int getLine() { return Lex.getLine(); }
+};
 
 /*
  * 切り出したToken格納用クラス
+ * 通常は全トークンを保持する
+ * Readerがある場合は直近Window個だけをリングバッファに保持し、必要になった時点で切り出す
+ * createViewで作るビューは元のトークン列を共有し、読む位置だけを別に持つ
  */
 class TokenStream {
 private:
-	std::vector<Token*> Tokens;
+	SourceBuffer* Source;
+	TokenReader* Reader;
+	std::vector<Token> Tokens;
+	std::vector<std::string> Texts; // リングバッファ時のトークン文字列
+	Token* Data; // トークン列の先頭(ビューの場合は元のTokenStreamのもの)
+	bool IsView;
 	int CurIndex;
+	int Filled; // 切り出し済みのトークン数
+	int Mask;
+	bool Failed;
+
+	int slot(int index) { return index & Mask; }
+	int getLowestIndex() { return Reader and Filled > (int)Tokens.size() ? Filled - (int)Tokens.size() : 0; }
+	bool fetchToken();
+	bool fail();
 public:
-	TokenStream() : CurIndex(0) {}
+	TokenStream(SourceBuffer* source)
+		: Source(source), Reader(NULL), Data(NULL), IsView(false), CurIndex(0), Filled(0), Mask(-1), Failed(false) {}
+	TokenStream(TokenReader* reader, int window);
 	~TokenStream();
 	bool ungetToken(int Times = 1);
 	bool getNextToken();
-	bool pushToken(Token* token) {
+	TokenStream* createView();
+	bool pushToken(const Token& token) {
 		Tokens.push_back(token);
+		Data = Tokens.data();
+		Filled++;
 		return true;
 	}
-	Token getToken();
-	TokenType getCurType() { return Tokens[CurIndex]->getTokenType(); }
-	std::string getCurString() { return Tokens[CurIndex]->getTokenString(); }
-	int64_t getCurNumVal() { return Tokens[CurIndex]->getNumberValue(); }
+	bool reserveTokens(size_t n) { Tokens.reserve(n); Data = Tokens.data(); return true; }
+	Token* appendTokens(size_t n) {
+		Tokens.resize(Tokens.size() + n);
+		Data = Tokens.data();
+		Filled += n;
+		return Data + Tokens.size() - n;
+	}
+	const Token& getToken() { return Data[slot(CurIndex)]; }
+	const Token& getTokenAt(int index) { return Data[slot(index)]; }
+	std::string_view getTokenString(const Token& token) {
+		if (Reader) {
+			return Texts[&token - Data];
+		}
+		return std::string_view(Source->getData() + token.getOffset(), token.getLength());
+	}
+	TokenType getCurType() { return Data[slot(CurIndex)].getTokenType(); }
+	std::string_view getCurString() { return getTokenString(Data[slot(CurIndex)]); }
+	int64_t getCurNumVal() { return Data[slot(CurIndex)].getNumberValue(); }
+	Symbol getCurSymbol() { return Data[slot(CurIndex)].getSymbol(); }
+	char getCurSymbolChar() { return (char)Data[slot(CurIndex)].getNumberValue(); }
 	bool printTokens();
 	int getCurIndex() { return CurIndex; }
-	bool applyTokenIndex(int index) { CurIndex = index; return true; }
+	int getTokenNum() { return Filled; }
+	bool applyTokenIndex(int index);
+	bool hasError() { return Failed; }
+	bool isStreaming() { return Reader != NULL; }
 };
 
 TokenStream* LexicalAnalysis(std::string input_filename);
+TokenStream* StreamingLexicalAnalysis(std::string input_filename, int window);
+TokenStream* ParallelLexicalAnalysis(std::string input_filename, int threads);
 
-#endif
\ No newline at end of file
+#endif
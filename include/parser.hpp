@@ -4,50 +4,152 @@
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
-#include <map>
 #include <string>
 #include <vector>
 #include "APP.hpp"
 #include "AST.hpp"
 #include "lexer.hpp"
 
+struct OperatorInfo;
+struct FunctionSpan;
+class ModuleInterface;
+
+/*
+ * 差分コンパイル用に、前回解析した関数定義ごとに覚えておく情報
+ * Hashが同じで、本文から関数として引いた識別子の結果も同じなら、前回の解析結果をそのまま使える
+ */
+typedef struct {
+	uint64_t Hash; // Prototypeと本文のトークン列(と、先にある関数宣言)のハッシュ
+	std::vector<std::pair<Symbol, int>> Lookups; // 関数として引いた識別子と引数の数(関数でなければ-1)
+} FunctionCacheEntry;
+
+typedef SymbolMap<FunctionCacheEntry> FunctionCache;
+
+/*
+ * 解析した外部宣言を順に受け取るクラス(構文解析しながらコード生成する場合に使う)
+ * 関数宣言は組み込み関数・インターフェースファイルのものから、関数定義は解析し終えるたびに渡す
+ */
+class FunctionConsumer {
+public:
+	virtual ~FunctionConsumer() {}
+	virtual bool consumePrototype(PrototypeAST* proto) = 0;
+	// 本文はarenaにあり、呼び出しから戻ると解放される(FunctionASTの本文はNULLになる)
+	virtual bool consumeFunction(FunctionAST* func, Arena& arena) = 0;
+};
+
 /*
  * 構文解析・意味解析クラス
+ * 先読み1トークンの予測型構文解析で、一度読んだトークンに戻ることはない
+ * 式は演算子の優先順位表を使うPratt法で解析する
+ * スレッド数を指定すると、関数宣言を先に全て読んでから関数本文を並列に解析する
+ * FunctionCacheを渡すと、前回から変わっていない関数定義は本文を解析せず、FunctionASTの本文をNULLにする
+ * インターフェースファイルを渡すと、そこにある関数を組み込み関数と同じく最初から宣言済みとして扱う
+ * FunctionConsumerを渡すと逐次に解析し、関数本文は受け手に渡した後すぐに解放する(ASTに残るのは宣言だけ)
  */
 typedef class Parser {
 private:
 	TokenStream* Tokens;
 	TranslationUnitAST* TU;
+	FunctionStmtBuilder Body; // 解析中の関数本文(式・文のノードの追加先)
 	// 意味解析用各種識別子表
-	std::vector<std::string> VariableTable;
-	std::vector<std::string> ArrayTable;
-	std::map<std::string, int> PrototypeTable;
-	std::map<std::string, int> FunctionTable;
+	// 変数・配列の表は関数ごとにclearする
+	SymbolMap<bool> VariableTable;
+	SymbolMap<uint64_t> ArrayTable; // 配列の要素数
+	SymbolMap<int> PrototypeTable;
+	SymbolMap<int> FunctionTable;
+	Symbol IncSymbol; // 演算子として使う識別子"inc"
+	Symbol FillSymbol; // 配列の初期化に使う識別子"fill"
+	std::vector<Symbol> LoopVariables; // 解析中のfor文の変数(外側から順。本文では代入できない)
+	std::vector<const ModuleInterface*> Imports;
+	FunctionConsumer* Consumer;
+	Arena FunctionNodes; // Consumerに渡す関数本文の確保先(関数ごとに解放する)
+	bool HasError;
+	int Threads;
+
+	// 並列構文解析用
+	// 関数ごとに、最初に宣言・定義された外部宣言の位置と引数の数
+	typedef struct {
+		int Order;
+		int ParamNum;
+	} FunctionEntry;
+	SymbolMap<FunctionEntry> FunctionOrderTable;
+	std::vector<std::pair<int, int>> TopLevelBlocks; // トップレベルの'{'の位置と対応する'}'の次の位置
+	size_t BlockCursor;
+	const SymbolMap<FunctionEntry>* DeclaredFunctions; // 本文の解析で参照する表(逐次解析ではNULL)
+	int CurOrder; // 解析中の関数本文の位置(これより前に宣言された関数だけを呼べる)
+	bool DeferError; // エラーを表示せずErrorMessageに残す
+	std::string ErrorMessage;
+
+	// 差分コンパイル用
+	FunctionCache* Cache;
+	SymbolMap<uint64_t> DeclarationHashes; // 関数宣言のトークン列のハッシュ
+	std::vector<std::pair<Symbol, int>>* LookupLog; // 関数として引いた識別子の記録先(記録しないときはNULL)
+
+	// 一次式が変数名・配列名・配列の要素だったか(代入系演算子の左辺になれるか)
+	typedef enum {
+		NAME_NONE,
+		NAME_VARIABLE,
+		NAME_ARRAY,
+		NAME_ELEMENT
+	} NameKind;
 
 public:
 	Parser(std::string finlename);
+	Parser(TokenStream* tokens);
 	~Parser() { SAFE_DELETE(TU); SAFE_DELETE(Tokens); }
 	bool doParse();
+	bool setThreads(int threads) { Threads = threads; return true; }
+	bool setFunctionCache(FunctionCache* cache) { Cache = cache; return true; }
+	bool addImport(const ModuleInterface* iface) { Imports.push_back(iface); return true; }
+	bool setFunctionConsumer(FunctionConsumer* consumer) { Consumer = consumer; return true; }
 	TranslationUnitAST& getAST();
 
 private:
+	// 関数単位のASTノードと配列はTUのArenaから確保する
+	template <class T, class... Args>
+	T* newNode(Args&&... args) { return TU->getArena().create<T>(std::forward<Args>(args)...); }
+	template <class T>
+	llvm::ArrayRef<T> newArray(const std::vector<T>& v) {
+		return llvm::ArrayRef<T>(TU->getArena().copyArray(v.data(), v.size()), v.size());
+	}
+
+	// トークン操作
+	bool emitError(const std::string& msg);
+	bool reportError(const char* msg);
+	bool isCurSymbol(char c);
+	bool expectSymbol(char c);
+	const OperatorInfo* getCurOperator();
+
+	// 並列構文解析
+	bool visitTranslationUnitParallel(int threads);
+	bool scanExternalDeclaration(int order, std::vector<FunctionSpan>& spans);
+	bool parseFunctionSpans(std::vector<FunctionSpan>& spans, int threads);
+	bool lookupFunction(Symbol name, int& param_num);
+	bool checkRedefinition(PrototypeAST* proto);
+	uint64_t hashTokens(int begin, int end);
+	bool isReusable(const FunctionSpan& span);
+	bool updateFunctionCache(std::vector<FunctionSpan>& spans);
+
 	// 各種構文解析メソッド
+	bool addBuiltinPrototypes();
+	bool addImportedPrototypes();
 	bool visitTranslationUnit();
 	bool visitExternalDeclaration(TranslationUnitAST* tunit);
-	PrototypeAST* visitFunctionDeclaration();
-	FunctionAST* visitFunctionDefinition();
+	bool visitFunctionDeclaration(PrototypeAST* proto);
+	FunctionAST* visitFunctionDefinition(PrototypeAST* proto);
 	PrototypeAST* visitPrototype();
 	FunctionStmtAST* visitFunctionStatement(PrototypeAST* proto);
-	VariableDeclAST* visitVariableDeclaration();
-	ArrayDeclAST* visitArrayDeclaration(); // new
-	BaseAST* visitStatement();
-	BaseAST* visitExpressionStatement();
-	BaseAST* visitJumpStatement();
-	BaseAST* visitAssignmentExpression();
-	BaseAST* visitAdditiveExpression(BaseAST* lhs);
-	BaseAST* visitMultiplicativeExpression(BaseAST* lhs);
-	BaseAST* visitPostfixExpression();
-	BaseAST* visitPrimaryExpression();
+	bool visitVariableDeclaration();
+	bool visitArrayDeclaration(); // new
+	bool visitArrayInitializer(ArrayDeclAST& a_decl);
+	bool visitArrayInitValue(int64_t& val);
+	NodeIndex visitStatement();
+	NodeIndex visitExpressionStatement();
+	NodeIndex visitJumpStatement();
+	NodeIndex visitLoopStatement();
+	NodeIndex visitExpression(int min_prec);
+	NodeIndex visitPrimaryExpression(NameKind& kind);
+	NodeIndex visitCallExpression(Symbol callee, int param_num);
 } Parser;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef SIMPLIFY_HPP
+#define SIMPLIFY_HPP
+
+#include <cstdint>
+#include <vector>
+#include "APP.hpp"
+#include "AST.hpp"
+#include "symbol.hpp"
+
+/*
+ * 64bitで折り返す足し算・引き算・掛け算(コード生成されたadd・sub・mulと同じ結果)
+ */
+inline int64_t wrapAdd(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+inline int64_t wrapSub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }
+inline int64_t wrapMul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }
+
+/*
+ * 整数どうしの四則演算を一つ畳み込む(構文解析の`$`・incの右辺と、簡約とで共通)
+ * 演算はコード生成と同じく64bitで折り返す。0での割り算と、折り返す割り算(最小値 / -1)は畳み込まない
+ * @param 演算子、左辺、右辺、結果の書き込み先
+ * @return 畳み込めた：true、畳み込めない：false
+ */
+inline bool foldBinary(BinaryOp op, int64_t lhs, int64_t rhs, int64_t& value) {
+	switch (op) {
+	case OP_ADD:
+		value = wrapAdd(lhs, rhs);
+		return true;
+	case OP_SUB:
+		value = wrapSub(lhs, rhs);
+		return true;
+	case OP_MUL:
+		value = wrapMul(lhs, rhs);
+		return true;
+	case OP_DIV:
+		if (rhs == 0 or (lhs == INT64_MIN and rhs == -1)) {
+			return false;
+		}
+		value = lhs / rhs;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * AST簡約クラス
+ * 構文解析の後、コード生成の前に関数本文ごとに次を行う
+ *  - 各ノードの値の範囲を求める(変数の範囲は文の順に追い、`$`の上限は以降ずっと成り立つものとする)
+ *    for文の本文は一度だけ見る。本文で代入する変数は繰り返しで変わるので、本文の前で範囲を不明にする
+ *  - 値が一つに決まる副作用のない式を整数に置き換える(定数畳み込み)
+ *  - x+0, x-0, 0+x, x*1, 1*x, x/1をxに置き換える
+ *  - (x+c1)+c2、(x*c1)*c2のような定数をまとめる
+ * 演算はコード生成と同じく64bitで折り返すものとし、折り返しうる範囲は不明とする
+ */
+class Simplifier {
+private:
+	FunctionStmtAST* CurBody; // 現在簡約中の関数本文
+	std::vector<ValueRange> Ranges; // ノードごとの範囲(関数ごとに使い回す作業用)
+	SymbolMap<ValueRange> VariableRanges; // 変数の現在の範囲
+	SymbolMap<int64_t> VariableBounds; // `$`で注釈された変数の上限
+	SymbolMap<ValueRange> CalleeRanges; // 戻り値の範囲が分かっている関数
+	SymbolMap<std::vector<ValueRange>> CalleeParamRanges; // 引数の範囲が分かっている関数(呼び出した時点で渡した変数はその範囲にある)
+	int LoopDepth; // 見ているfor文の本文の深さ
+
+public:
+	Simplifier() : CurBody(NULL), LoopDepth(0) {}
+	bool doSimplify(TranslationUnitAST& tunit);
+	// 構文解析しながら使う場合は、関数宣言と関数本文を出てきた順に渡す
+	bool addPrototype(PrototypeAST* proto);
+	bool simplifyFunction(FunctionStmtAST* func_stmt, Arena& arena);
+
+private:
+	bool visitNode(NodeIndex i);
+	bool visitBinaryExpression(NodeIndex i);
+	bool visitLoopStatement(NodeIndex i);
+	bool narrowArguments(NodeIndex i);
+	bool foldArithmetic(NodeIndex i, bool pure);
+	bool assignVariable(Symbol var, ValueRange range);
+	ValueRange getVariableRange(Symbol var);
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "APP.hpp"
+
+/*
+ * 識別子を表す整数ID
+ * 同じ綴りの識別子は常に同じIDになる
+ */
+typedef uint32_t Symbol;
+
+/*
+ * 識別子の文字列を一度だけ保持し、IDを割り当てるクラス
+ * 文字列は大きめのブロックにまとめて確保し、解放はプログラム終了時に一括で行う
+ * 保持する文字列は'\0'終端なので、getNameの結果はそのままCの文字列としても使える
+ */
+class SymbolTable {
+private:
+	std::unordered_map<std::string_view, Symbol> Index;
+	std::vector<std::string_view> Names;
+	std::vector<char*> Blocks;
+	char* BlockCur;
+	size_t BlockRest;
+
+	const char* store(std::string_view str);
+public:
+	SymbolTable() : BlockCur(NULL), BlockRest(0) {}
+	~SymbolTable();
+	Symbol intern(std::string_view str);
+	std::string_view getName(Symbol sym) const { return Names[sym]; }
+	size_t size() const { return Names.size(); }
+};
+
+SymbolTable& getSymbolTable();
+
+inline Symbol internSymbol(std::string_view str) { return getSymbolTable().intern(str); }
+inline std::string_view getSymbolName(Symbol sym) { return getSymbolTable().getName(sym); }
+
+/*
+ * Symbolをキーとするハッシュ表(オープンアドレス法・線形探索)
+ * 要素には世代番号を持たせ、clearは世代を進めるだけにする
+ * 関数ごとに表を空にしても、確保済みの領域はそのまま使い回せる
+ * 検索(find, count)だけなら複数のスレッドから同時に呼んでよい
+ */
+template <class V>
+class SymbolMap {
+private:
+	struct Slot {
+		Symbol Key;
+		uint32_t Stamp; // Stampが表のStampと同じなら使用中
+		V Value;
+	};
+	std::vector<Slot> Slots;
+	uint32_t Stamp;
+	uint32_t Shift;
+	size_t Count;
+
+	/*
+	 * キーの入っている位置、またはキーを入れるべき空きの位置を探す
+	 * @param キー
+	 * @return Slotsの添字
+	 */
+	size_t probe(Symbol key) const {
+		size_t mask = Slots.size() - 1;
+		size_t i = static_cast<uint32_t>(key * 0x9e3779b9u) >> Shift;
+		while (Slots[i].Stamp == Stamp and Slots[i].Key != key) {
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+
+	/*
+	 * 表の大きさを倍にして、使用中の要素を入れ直す
+	 */
+	void grow() {
+		std::vector<Slot> old(Slots.size() * 2);
+		old.swap(Slots);
+		Shift--;
+		for (const Slot& slot : old) {
+			if (slot.Stamp == Stamp) {
+				Slots[probe(slot.Key)] = slot;
+			}
+		}
+	}
+public:
+	SymbolMap() : Slots(16), Stamp(1), Shift(28), Count(0) {}
+
+	/*
+	 * 値を引く
+	 * @param キー
+	 * @return 値、なければNULL
+	 */
+	const V* find(Symbol key) const {
+		const Slot& slot = Slots[probe(key)];
+		return slot.Stamp == Stamp ? &slot.Value : NULL;
+	}
+	V* find(Symbol key) {
+		Slot& slot = Slots[probe(key)];
+		return slot.Stamp == Stamp ? &slot.Value : NULL;
+	}
+	bool count(Symbol key) const { return find(key) != NULL; }
+
+	/*
+	 * 値を追加する(既にあるキーは上書きしない)
+	 * @param キー、値
+	 * @return 追加した：true、既にあった：false
+	 */
+	bool insert(Symbol key, const V& value) {
+		if ((Count + 1) * 2 > Slots.size()) {
+			grow();
+		}
+		Slot& slot = Slots[probe(key)];
+		if (slot.Stamp == Stamp) {
+			return false;
+		}
+		slot.Key = key;
+		slot.Stamp = Stamp;
+		slot.Value = value;
+		Count++;
+		return true;
+	}
+
+	/*
+	 * 値を設定する(既にあるキーは上書きする)
+	 * @param キー、値
+	 * @return true
+	 */
+	bool set(Symbol key, const V& value) {
+		if (not insert(key, value)) {
+			*find(key) = value;
+		}
+		return true;
+	}
+
+	/*
+	 * 全ての要素を消す
+	 * 世代を進めるだけなので、表の大きさによらず定数時間
+	 * @return true
+	 */
+	bool clear() {
+		if (Count == 0) {
+			return true;
+		}
+		Count = 0;
+		if (++Stamp == 0) { // 世代が一周したら全て空に戻す
+			for (Slot& slot : Slots) {
+				slot.Stamp = 0;
+			}
+			Stamp = 1;
+		}
+		return true;
+	}
+	size_t size() const { return Count; }
+};
+
+#endif
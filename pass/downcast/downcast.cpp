@@ -5,15 +5,28 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Constants.h"
-#include <unordered_map>
+#include "llvm/ADT/DenseMap.h"
 
 using namespace llvm;
 
 struct DowncastPass : public FunctionPass {
 	static char ID;
-	std::unordered_map<std::string, int64_t> upper_mp;
-	bool low_q(const std::string& s) {
-		return upper_mp.count(s) and upper_mp.at(s) <= INT32_MAX;
+	DenseMap<Value*, int64_t> upper_mp; // 値(変数・配列はalloca)ごとの上限
+	unsigned upper_kind;
+	bool low_q(Value* v) {
+		return upper_mp.count(v) and upper_mp.lookup(v) <= INT32_MAX;
+	}
+	// 命令を置き換え、名前と上限を引き継ぐ
+	void replace(Instruction* Old, Value* New) {
+		New->takeName(Old);
+		Old->replaceAllUsesWith(New);
+		auto it = upper_mp.find(Old);
+		if (it != upper_mp.end()) {
+			int64_t upper = it->second;
+			upper_mp.erase(it);
+			upper_mp[New] = upper;
+		}
+		Old->eraseFromParent();
 	}
 	// std::unordered_map<std::string, std::pair<std::string, std::string>> varpair_mp;
 
@@ -21,24 +34,21 @@ struct DowncastPass : public FunctionPass {
 
 	bool runOnFunction(Function& F) override {
 		upper_mp.clear();
+		upper_kind = F.getContext().getMDKindID("upper_data");
 
+		// upper_dataは上限の整数を一つ持つMDNode
 		for (auto& BB : F) for (auto& I : BB) {
 			if (auto* INST = dyn_cast<Instruction>(&I)) {
-				if (MDNode* N = INST->getMetadata("upper_data")) {
-					if (auto* S = dyn_cast<MDString>(N->getOperand(0))) {
-						std::string variableName = INST->getName().str();
-						if (variableName == "") {
-							INST->setMetadata("upper_data", nullptr);
+				if (MDNode* N = INST->getMetadata(upper_kind)) {
+					if (auto* C = mdconst::dyn_extract<ConstantInt>(N->getOperand(0))) {
+						if (isa<StoreInst>(INST)) {
+							INST->setMetadata(upper_kind, nullptr);
 							continue; // metadataそのもの
 						}
-						std::string metadataStr = S->getString().str();
-						// S = nullptr;
-						int64_t upperValue = 0;
-						upperValue = std::stoll(metadataStr);
-						upper_mp[variableName] = upperValue;
+						upper_mp[INST] = C->getSExtValue();
 					}
 				}
-				INST->setMetadata("upper_data", nullptr);
+				INST->setMetadata(upper_kind, nullptr);
 			}
 		}
 
@@ -46,9 +56,8 @@ struct DowncastPass : public FunctionPass {
 		std::vector<AllocaInst*> AllocasToReplace{};
 		for (auto& BB : F) for (auto& I : BB) {
 			if (auto* Alloca = dyn_cast<AllocaInst>(&I)) {
-				auto name = Alloca->getName().str();
-				// llvm::errs() << name << '\n';
-				if (low_q(name)) {
+				// llvm::errs() << Alloca->getName() << '\n';
+				if (low_q(Alloca)) {
 					AllocasToReplace.emplace_back(Alloca); // i32
 				}
 			}
@@ -61,9 +70,7 @@ struct DowncastPass : public FunctionPass {
 			} else {
 				NewAlloca = Builder.CreateAlloca(ArrayType::get(Type::getInt32Ty(F.getContext()), Alloca->getAllocatedType()->getArrayNumElements()), Alloca->getArraySize(), Alloca->getName() + ".i32");
 			}
-			NewAlloca->takeName(Alloca);
-			Alloca->replaceAllUsesWith(NewAlloca);
-			Alloca->eraseFromParent();
+			replace(Alloca, NewAlloca);
 		}
 
 		// Store / Load / BinaryOperator
@@ -73,32 +80,30 @@ struct DowncastPass : public FunctionPass {
 				Value* PointerOperand = Store->getPointerOperand();
 				if (auto* Alloca = dyn_cast<AllocaInst>(PointerOperand->stripPointerCasts())) {
 					// errs() << "Alloca->getName(): " <<  Alloca->getName() << '\n';
-					auto name1 = Alloca->getName().str();
-					if (upper_mp.count(name1)) {
-						const auto& upper_val = upper_mp.at(name1);
+					if (upper_mp.count(Alloca)) {
+						const auto& upper_val = upper_mp.lookup(Alloca);
 						if (upper_val <= INT32_MAX) {
 							InstructionsToReplace.emplace_back(Store); // こっちは主にinput()のときのtruncation
 						}
 					}
 					// errs() << "Store->getValueOperand()->getName(): " << Store->getValueOperand()->getName() << '\n';
-					auto name2 = Store->getValueOperand()->getName().str();
-					if (upper_mp.count(name2)) {
-						const auto& upper_val = upper_mp.at(name2);
+					if (upper_mp.count(Store->getValueOperand())) {
+						const auto& upper_val = upper_mp.lookup(Store->getValueOperand());
 						if (upper_val <= INT32_MAX) {
 							InstructionsToReplace.emplace_back(Store); // こっちは store i32 i64 の場合
 						}
 					}
+				} else {
+					InstructionsToReplace.emplace_back(Store); // 配列の要素a[i]への代入で、値だけi32になるもの
 				}
 			} else if (auto* Load = dyn_cast<LoadInst>(&I)) {
 				Value* PointerOperand = Load->getPointerOperand();
-				auto l_name = Load->getName();
-				// errs() << l_name << '\n';
+				// errs() << Load->getName() << '\n';
 				if (auto* Alloca = dyn_cast<AllocaInst>(PointerOperand->stripPointerCasts())) {
-					auto r_name = Alloca->getName().str();
 					// errs() << "fuga: " <<  Alloca->getName() << '\n';
-					if (upper_mp.count(r_name) or upper_mp.count(l_name)) {
-						auto l_upper_val = upper_mp.count(l_name) ? upper_mp.at(l_name) : (int64_t)INT32_MAX;
-						auto r_upper_val = upper_mp.count(r_name) ? upper_mp.at(r_name) : (int64_t)INT32_MAX;
+					if (upper_mp.count(Alloca) or upper_mp.count(Load)) {
+						auto l_upper_val = upper_mp.count(Load) ? upper_mp.lookup(Load) : (int64_t)INT32_MAX;
+						auto r_upper_val = upper_mp.count(Alloca) ? upper_mp.lookup(Alloca) : (int64_t)INT32_MAX;
 						// errs() << l_upper_val << " " << r_upper_val << "\n";
 						if (r_upper_val <= INT32_MAX or l_upper_val <= INT32_MAX) {
 							// どちらもi32に直す
@@ -106,11 +111,10 @@ struct DowncastPass : public FunctionPass {
 						}
 					}
 				} else if (auto* GEP = dyn_cast<GetElementPtrInst>(PointerOperand->stripPointerCasts())) {
-					auto r_name = GEP->getName().str();
 					// errs() << "fuga: " <<  GEP->getName().str() << '\n';
-					if (upper_mp.count(r_name) or upper_mp.count(l_name)) {
-						auto l_upper_val = upper_mp.count(l_name) ? upper_mp.at(l_name) : (int64_t)INT32_MAX;
-						auto r_upper_val = upper_mp.count(r_name) ? upper_mp.at(r_name) : (int64_t)INT32_MAX;
+					if (upper_mp.count(GEP) or upper_mp.count(Load)) {
+						auto l_upper_val = upper_mp.count(Load) ? upper_mp.lookup(Load) : (int64_t)INT32_MAX;
+						auto r_upper_val = upper_mp.count(GEP) ? upper_mp.lookup(GEP) : (int64_t)INT32_MAX;
 						// errs() << l_upper_val << " " << r_upper_val << "\n";
 						if (r_upper_val <= INT32_MAX or l_upper_val <= INT32_MAX) {
 							// どちらもi32に直す
@@ -120,28 +124,24 @@ struct DowncastPass : public FunctionPass {
 				} 
 			} else if (auto* BinOp = dyn_cast<BinaryOperator>(&I)) {
 				bool flag = false;
-				auto tmp_name = BinOp->getName().str();
-				// errs() << tmp_name << " " << BinOp->operands().end() - BinOp->operands().begin() << "\n";
+				// errs() << BinOp->getName() << " " << BinOp->operands().end() - BinOp->operands().begin() << "\n";
 				for (auto& op : BinOp->operands()) { // operands.size() should be 2
-					auto name = op->getName().str();
-					if (low_q(name)) {
+					if (low_q(op)) {
 						// i64でなかったら
 						flag = true;
 					}
 				}
-				for (auto& op : BinOp->operands()) {
-					auto name = op->getName().str();
-					// errs() << name << "\n";
-				}
 				// tmpがi32になるべきなときは絶対にebする
-				if (flag or low_q(tmp_name) or true) InstructionsToReplace.emplace_back(BinOp);
+				if (flag or low_q(BinOp) or true) InstructionsToReplace.emplace_back(BinOp);
 			} else if (auto* Call = dyn_cast<CallInst>(&I)) {
 				// errs() << Call->getCalledFunction()->getName() << "\n";
 				if (Call->getCalledFunction()->getName() == "printnum") {
 					InstructionsToReplace.emplace_back(Call);
 				}
 			} else if (auto* GEP = dyn_cast<GetElementPtrInst>(&I)) {
-				if (low_q(GEP->getPointerOperand()->getName().str())) InstructionsToReplace.emplace_back(GEP);
+				if (low_q(GEP->getPointerOperand())) InstructionsToReplace.emplace_back(GEP);
+			} else if (auto* Cmp = dyn_cast<ICmpInst>(&I)) {
+				InstructionsToReplace.emplace_back(Cmp); // for文の条件・添字の検査で、片方だけi32になるもの
 			}
 		}
 
@@ -151,38 +151,36 @@ struct DowncastPass : public FunctionPass {
 			if (auto* Store = dyn_cast<StoreInst>(Ins)) {
 				// errs() << "store: " << Store->getValueOperand()->getName() << '\n';
 				auto* Alloca = dyn_cast<AllocaInst>(Store->getPointerOperand()->stripPointerCasts());
-				auto name1 = Alloca->getName().str();
-				auto name2 = Store->getValueOperand()->getName().str();
-				if (low_q(name1) and low_q(name2)) {
+				Value* StoredValue = Store->getValueOperand();
+				if (not Alloca) {
+					// 要素の型は変えないので、値をsextして書く
+					if (StoredValue->getType()->isIntegerTy(32) and Store->getPointerOperand()->getType()->getPointerElementType()->isIntegerTy(64)) {
+						Builder.CreateStore(Builder.CreateSExt(StoredValue, Type::getInt64Ty(F.getContext())), Store->getPointerOperand());
+						Store->eraseFromParent();
+					}
+				} else if (low_q(Alloca) and low_q(StoredValue)) {
 					// どちらもi32なのでなにもしない
-				} else if (low_q(name1)) {
-					Value* StoredValue = Store->getValueOperand();
+				} else if (low_q(Alloca)) {
 					Value* PointerOperand = Store->getPointerOperand();
 					Value* TruncatedValue = Builder.CreateTrunc(StoredValue, Type::getInt32Ty(F.getContext()));
 					Builder.CreateStore(TruncatedValue, PointerOperand);
 					Store->eraseFromParent();
-				} else if (low_q(name2)) {
+				} else if (low_q(StoredValue)) {
 					IRBuilder<> Builder(Alloca);
 					AllocaInst* NewAlloca = Builder.CreateAlloca(Type::getInt32Ty(F.getContext()), Alloca->getArraySize(), Alloca->getName() + ".i32");
-					NewAlloca->takeName(Alloca);
-					Alloca->replaceAllUsesWith(NewAlloca);
-					Alloca->eraseFromParent();
+					replace(Alloca, NewAlloca);
 				} else {
 					// どちらもi64なのでなにもしない
 				}
 			} else if (auto* Load = dyn_cast<LoadInst>(Ins)) {
 				// errs() << Load->getName() << "\n";
-				auto load_name = Load->getName().str();
 				Value* PointerOperand = Load->getPointerOperand();
-				auto p_name = PointerOperand->getName().str();
 				// errs() << "fuga\n";
-				if (low_q(load_name) or low_q(p_name)) {
+				if (low_q(Load) or low_q(PointerOperand)) {
 					// errs() << "fuga\n";
-					// errs() << p_name << "\n";
-					Value* NewLoad = Builder.CreateLoad(Type::getInt32Ty(F.getContext()), PointerOperand, p_name + ".i32");
-					NewLoad->takeName(Load);
-					Load->replaceAllUsesWith(NewLoad);
-					Load->eraseFromParent();
+					// errs() << PointerOperand->getName() << "\n";
+					Value* NewLoad = Builder.CreateLoad(Type::getInt32Ty(F.getContext()), PointerOperand, PointerOperand->getName() + ".i32");
+					replace(Load, NewLoad);
 					// if (auto* Alloca = dyn_cast<AllocaInst>(PointerOperand)) {
 					// 	IRBuilder<> Builder(Alloca);
 					// 	AllocaInst* NewAlloca = Builder.CreateAlloca(Type::getInt32Ty(F.getContext()), Alloca->getArraySize(), Alloca->getName() + ".i32");
@@ -210,7 +208,7 @@ struct DowncastPass : public FunctionPass {
 				// for (auto& op : BinOp->operands()) errs() << "hoge: " << op->getName().str() << "\n";
 				Value* op1 = BinOp->getOperand(0);
 				Value* op2 = BinOp->getOperand(1);
-				if (upper_mp.count(tmp_name) and upper_mp.at(tmp_name) <= INT32_MAX) { // i32
+				if (low_q(BinOp)) { // i32
 					if (isa<ConstantInt>(op1)) {
 						op1 = llvm::ConstantInt::get(llvm::Type::getInt32Ty(F.getContext()), dyn_cast<ConstantInt>(op1)->getValue().sextOrTrunc(32));
 						// errs() << "hoge\n";
@@ -220,17 +218,15 @@ struct DowncastPass : public FunctionPass {
 						// errs() << "hoge\n";
 					}
 					// errs() << "fuga: " << op1->getName() << "\n";
-					if (const auto& name = op1->getName().str(); low_q(name) and op1->getType()->isIntegerTy(64)) {
+					if (low_q(op1) and op1->getType()->isIntegerTy(64)) {
 						op1 = Builder.CreateTrunc(op1, Type::getInt32Ty(F.getContext()));
 					}
 					// errs() << "fuga: " << op2->getName().str() << "\n";
-					if (const auto& name = op2->getName().str(); low_q(name) and op2->getType()->isIntegerTy(64)) {
+					if (low_q(op2) and op2->getType()->isIntegerTy(64)) {
 						op2 = Builder.CreateTrunc(op2, Type::getInt32Ty(F.getContext()));
 					}
 					Value* NewBinOp = Builder.CreateBinOp(BinOp->getOpcode(), op1, op2, tmp_name + ".i32");
-					NewBinOp->takeName(BinOp);
-					BinOp->replaceAllUsesWith(NewBinOp);
-					BinOp->eraseFromParent();
+					replace(BinOp, NewBinOp);
 				} else { // i64
 					if (isa<ConstantInt>(op1)) {
 						op1 = llvm::ConstantInt::get(llvm::Type::getInt32Ty(F.getContext()), dyn_cast<ConstantInt>(op1)->getValue().sextOrTrunc(64));
@@ -241,17 +237,15 @@ struct DowncastPass : public FunctionPass {
 						// errs() << "hoge\n";
 					}
 					// errs() << "piyo: " << op1->getName().str() << "\n";
-					if (const auto& name = op1->getName().str(); op1->getType()->isIntegerTy(32)) {
+					if (op1->getType()->isIntegerTy(32)) {
 						op1 = Builder.CreateSExt(op1, Type::getInt64Ty(F.getContext()));
 					}
 					// errs() << "piyo: " << op2->getName().str() << "\n";
-					if (const auto& name = op2->getName().str(); op2->getType()->isIntegerTy(32)) {
+					if (op2->getType()->isIntegerTy(32)) {
 						op2 = Builder.CreateSExt(op2, Type::getInt64Ty(F.getContext()));
 					}
 					Value* NewBinOp = Builder.CreateBinOp(BinOp->getOpcode(), op1, op2, tmp_name + ".i64");
-					NewBinOp->takeName(BinOp);
-					BinOp->replaceAllUsesWith(NewBinOp);
-					BinOp->eraseFromParent();
+					replace(BinOp, NewBinOp);
 				}
 			} else if (auto* Call = dyn_cast<CallInst>(Ins)) {
 				assert(Call->getCalledFunction()->getName() == "printnum");
@@ -259,9 +253,16 @@ struct DowncastPass : public FunctionPass {
 					Value* ArgValue = Call->getArgOperand(0);
 					Value* SExtValue = Builder.CreateSExt(ArgValue, Type::getInt64Ty(F.getContext()));
 					auto NewCall = Builder.CreateCall(Call->getCalledFunction(), llvm::ArrayRef<Value*>{SExtValue}, Call->getName());
-					NewCall->takeName(Call);
-					Call->replaceAllUsesWith(NewCall);
-					Call->eraseFromParent();
+					replace(Call, NewCall);
+				}
+			} else if (auto* Cmp = dyn_cast<ICmpInst>(Ins)) {
+				// 幅が違えばi32の方をsextしてi64で比べる
+				Value* op1 = Cmp->getOperand(0);
+				Value* op2 = Cmp->getOperand(1);
+				if (op1->getType()->isIntegerTy(32) and op2->getType()->isIntegerTy(64)) {
+					Cmp->setOperand(0, Builder.CreateSExt(op1, op2->getType()));
+				} else if (op1->getType()->isIntegerTy(64) and op2->getType()->isIntegerTy(32)) {
+					Cmp->setOperand(1, Builder.CreateSExt(op2, op1->getType()));
 				}
 			} else if (auto* GEP = dyn_cast<GetElementPtrInst>(Ins)) {
 				// errs() << "hoge\n";
@@ -272,9 +273,7 @@ struct DowncastPass : public FunctionPass {
 						GEP->getOperand(2)
 					};
 					auto NewGEP = Builder.CreateGEP(llvm::ArrayType::get(llvm::Type::getInt32Ty(F.getContext()), Ty->getArrayNumElements()), GEP->getPointerOperand(), idxList, GEP->getName() + ".i32");
-					NewGEP->takeName(GEP);
-					GEP->replaceAllUsesWith(NewGEP);
-					GEP->eraseFromParent();
+					replace(GEP, NewGEP);
 
 					// llvm::Value *idxList[2] = {
 					// 	Builder->getInt32(0),
@@ -1,19 +1,5 @@
 #include "AST.hpp"
 
-/*
- * デストラクタ
- */
-TranslationUnitAST::~TranslationUnitAST() {
-	for (int i = 0; i < Prototypes.size(); i++) {
-		SAFE_DELETE(Prototypes[i]);
-	}
-	Prototypes.clear();
-	for (int i = 0; i < Functions.size(); i++) {
-		SAFE_DELETE(Functions[i]);
-	}
-	Functions.clear();
-}
-
 /*
  * PrototypeAST(関数宣言追加)メソッド
  * @param VariableDeclAST
@@ -43,47 +29,59 @@ bool TranslationUnitAST::empty() {
 }
 
 /*
- * デストラクタ
+ * 関数呼び出しノード追加メソッド
+ * 引数の添字はArgListsに[引数の数, 引数...]の形で続けて格納する
+ * @param 呼び出す関数、引数の式
+ * @return 追加したノードの添字
  */
-FunctionAST::~FunctionAST() {
-	SAFE_DELETE(Proto);
-	SAFE_DELETE(Body);
+NodeIndex FunctionStmtBuilder::addCallExpr(Symbol callee, const std::vector<NodeIndex>& args) {
+	uint32_t list = ArgLists.size();
+	ArgLists.push_back(args.size());
+	ArgLists.insert(ArgLists.end(), args.begin(), args.end());
+	return addNode(ExprNode(CallExprID, OP_ASSIGN, callee, list));
 }
 
 /*
- * デストラクタ
+ * for文ノード追加メソッド
+ * 上限・増分・本文の文の添字はLoopListsに[最初のノード, 上限の式, 増分の整数, 本文の文の数, 本文の文...]の形で続けて格納する
+ * @param for文の最初のノード、初期化の代入、上限の式、増分の整数、本文の文
+ * @return 追加したノードの添字
  */
-FunctionStmtAST::~FunctionStmtAST() {
-	for (int i = 0; i < VariableDecls.size(); i++) {
-		SAFE_DELETE(VariableDecls[i]);
-	}
-	VariableDecls.clear();
-	for (int i = 0; i < StmtLists.size(); i++) {
-		SAFE_DELETE(StmtLists[i]);
-	}
-	StmtLists.clear();
+NodeIndex FunctionStmtBuilder::addLoopStmt(NodeIndex begin, NodeIndex init, NodeIndex limit, NodeIndex step, const std::vector<NodeIndex>& stmts) {
+	uint32_t list = LoopLists.size();
+	LoopLists.insert(LoopLists.end(), {begin, limit, step, (NodeIndex)stmts.size()});
+	LoopLists.insert(LoopLists.end(), stmts.begin(), stmts.end());
+	return addNode(ExprNode(LoopStmtID, OP_ASSIGN, init, list));
 }
 
 /*
- * VariableDeclAST(変数宣言追加)メソッド
- * @param VariableDeclAST
+ * 組み立て中の関数本文を捨てる
+ * 作業用の配列の容量はそのまま残す
  * @return true
  */
-bool FunctionStmtAST::addVariableDeclaration(VariableDeclAST* vdecl) {
-	VariableDecls.push_back(vdecl);
-	return true;
-}
-
-bool FunctionStmtAST::addArrayDeclaration(ArrayDeclAST* vdecl) {
-	ArrayDecls.push_back(vdecl);
+bool FunctionStmtBuilder::clear() {
+	VariableDecls.clear();
+	ArrayDecls.clear();
+	Nodes.clear();
+	ArgLists.clear();
+	StmtLists.clear();
+	ArrayInits.clear();
+	LoopLists.clear();
 	return true;
 }
 
 /*
- * デストラクタ
+ * 組み立てた関数本文をArenaに写してFunctionStmtASTを作る
+ * 作った後は次の関数のために空にする
+ * @param 写し先のArena
+ * @return FunctionStmtAST
  */
-CallExprAST::~CallExprAST() {
-	for (int i = 0; i < Args.size(); i++) {
-		SAFE_DELETE(Args[i]);
-	}
-}
\ No newline at end of file
+FunctionStmtAST* FunctionStmtBuilder::build(Arena& arena) {
+	auto copy = [&arena](const auto& v) {
+		return llvm::ArrayRef(arena.copyArray(v.data(), v.size()), v.size());
+	};
+	llvm::MutableArrayRef<ExprNode> nodes(arena.copyArray(Nodes.data(), Nodes.size()), Nodes.size());
+	FunctionStmtAST* func_stmt = arena.create<FunctionStmtAST>(copy(VariableDecls), copy(ArrayDecls), nodes, copy(ArgLists), copy(StmtLists), copy(ArrayInits), copy(LoopLists));
+	clear();
+	return func_stmt;
+}
@@ -0,0 +1,67 @@
+#include "arena.hpp"
+
+/*
+ * 現在のブロックに収まらない場合の確保
+ * 新しいブロックを追加して、そこから切り出す
+ * ブロックより大きい要求はそのサイズのブロックを単独で確保する
+ * @param サイズ、アラインメント
+ * @return 確保した領域の先頭
+ */
+void* Arena::allocateSlow(size_t size, size_t align) {
+	const size_t block_size = 1 << 16;
+	size_t need = size + align - 1;
+	if (need > block_size) {
+		char* block = new char[need];
+		Blocks.push_back(block);
+		AllocNum++;
+		AllocBytes += size;
+		size_t pad = -reinterpret_cast<uintptr_t>(block) & (align - 1);
+		return block + pad;
+	}
+	BlockCur = new char[block_size];
+	BlockRest = block_size;
+	Blocks.push_back(BlockCur);
+	return allocate(size, align);
+}
+
+/*
+ * 別のArenaが確保した領域を引き取る
+ * ブロックとデストラクタの登録を移すだけで、オブジェクトは動かさない
+ * otherは空になり、引き続き使える
+ * @param 引き取る元のArena
+ * @return true
+ */
+bool Arena::merge(Arena& other) {
+	Blocks.insert(Blocks.end(), other.Blocks.begin(), other.Blocks.end());
+	Cleanups.insert(Cleanups.end(), other.Cleanups.begin(), other.Cleanups.end());
+	AllocNum += other.AllocNum;
+	AllocBytes += other.AllocBytes;
+	other.Blocks.clear();
+	other.Cleanups.clear();
+	other.BlockCur = NULL;
+	other.BlockRest = 0;
+	other.AllocNum = 0;
+	other.AllocBytes = 0;
+	return true;
+}
+
+/*
+ * 確保した全ての領域を解放する
+ * 登録されたデストラクタを確保と逆順に呼んでから、ブロックを解放する
+ * @return true
+ */
+bool Arena::release() {
+	for (size_t i = Cleanups.size(); i > 0; i--) {
+		Cleanups[i - 1].Destroy(Cleanups[i - 1].Object);
+	}
+	Cleanups.clear();
+	for (size_t i = 0; i < Blocks.size(); i++) {
+		SAFE_DELETEA(Blocks[i]);
+	}
+	Blocks.clear();
+	BlockCur = NULL;
+	BlockRest = 0;
+	AllocNum = 0;
+	AllocBytes = 0;
+	return true;
+}
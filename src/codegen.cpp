@@ -1,13 +1,42 @@
 #include "codegen.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Metadata.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/Support/Error.h>
 
 
-#include <unordered_map>
+/*
+ * 64bitの範囲をConstantRangeにする
+ * @param 範囲
+ * @return ConstantRange(不明なら全体)
+ */
+static llvm::ConstantRange makeConstantRange(ValueRange range) {
+	if (range.isUnknown()) {
+		return llvm::ConstantRange(64, true);
+	}
+	// 上限がINT64_MAXなら上端は折り返してINT64_MINになるが、[Lower, INT64_MAX]を表す
+	return llvm::ConstantRange(llvm::APInt(64, range.Lower, true), llvm::APInt(64, range.Upper, true) + 1);
+}
 
-std::unordered_map<std::string, int64_t> mp{}, a_mp, a_siz;
-std::unordered_map<std::string, llvm::AllocaInst*> decl_mp{}, decl_a_mp;
+/*
+ * ConstantRangeの上限(upper_dataに書く値)
+ */
+static int64_t getUpper(const llvm::ConstantRange& range) {
+	return range.getSignedMax().getSExtValue();
+}
+
+/*
+ * 配列の確保・解放・初期化のためにコード生成が宣言する関数(calloc・free・memset等の組み込み関数)か
+ */
+static bool isRuntimeFunction(llvm::Function* func) {
+	return func->isIntrinsic() or func->getName() == "calloc" or func->getName() == "free";
+}
 
 /*
  * コンストラクタ
@@ -15,6 +44,20 @@ std::unordered_map<std::string, llvm::AllocaInst*> decl_mp{}, decl_a_mp;
 CodeGen::CodeGen() {
 	Builder = new llvm::IRBuilder<>(TheContext);
 	Mod = NULL;
+	CurFunc = NULL;
+	CurBody = NULL;
+	CurProto = NULL;
+	CurReturned = false;
+	StreamOut = NULL;
+	SlotTracker = NULL;
+	DirectSSA = false;
+	Narrow = false;
+	BoundsCheck = true;
+	BoundsFailBlock = NULL;
+	LoopDepth = 0;
+	ArrayStackLimit = 64 * 1024;
+	LargeArrays = ArrayOnHeap;
+	UpperDataKind = TheContext.getMDKindID("upper_data");
 }
 
 /*
@@ -22,6 +65,7 @@ CodeGen::CodeGen() {
  */
 CodeGen::~CodeGen() {
 	SAFE_DELETE(Builder);
+	SAFE_DELETE(SlotTracker);
 	SAFE_DELETE(Mod);
 }
 
@@ -45,6 +89,20 @@ bool CodeGen::doCodeGen(TranslationUnitAST& t_unit, std::string name, std::strin
 	return true;
 }
 
+/*
+ * 差分コード生成実行
+ * 初回はModuleを全て生成し、2回目以降は前回のModuleのうち本文のある関数定義だけを作り直す
+ * 失敗したらModuleを破棄するので、次回は全て生成し直すことになる
+ * @param TranslationUnitAST(前回と変わらない関数定義は本文がNULL) Module名(入力ファイル名)
+ * @return 成功：true、失敗：false
+ */
+bool CodeGen::doIncrementalCodeGen(TranslationUnitAST& t_unit, std::string name) {
+	if (not Mod) {
+		return generateTranslationUnit(t_unit, name);
+	}
+	return updateTranslationUnit(t_unit);
+}
+
 /*
  * Module取得
  */
@@ -56,13 +114,32 @@ llvm::Module& CodeGen::getModule() {
 	}
 }
 
+/*
+ * 空のModuleを作る
+ * 前のModuleとそれに結び付いた表は捨てるので、同じCodeGenで何度でもコード生成できる
+ * @param Module名(入力ファイル名)
+ * @return true
+ */
+bool CodeGen::createModule(std::string name) {
+	SAFE_DELETE(SlotTracker);
+	SAFE_DELETE(Mod);
+	StreamOut = NULL;
+	WrittenFunctions.clear();
+	WrittenNodes.clear();
+	Callees.clear();
+	CalleeRanges.clear();
+	CalleeParamRanges.clear();
+	Mod = new llvm::Module(name, TheContext);
+	return true;
+}
+
 /*
  * Module生成メソッド
  * @param TranslationUnitAST Module名(入力ファイル名)
  * @return 成功：true、失敗：false
  */
 bool CodeGen::generateTranslationUnit(TranslationUnitAST& t_unit, std::string name) {
-	Mod = new llvm::Module(name, TheContext);
+	createModule(name);
 	// function declaration
 	for (int i = 0; ; i++) {
 		PrototypeAST* proto = t_unit.getPrototype(i);
@@ -83,6 +160,267 @@ bool CodeGen::generateTranslationUnit(TranslationUnitAST& t_unit, std::string na
 			return false;
 		}
 	}
+	return orderFunctions(t_unit);
+}
+
+/*
+ * Module差分更新メソッド
+ * 1. 作り直す関数定義と、なくなった・引数の数が変わった関数の本文を消す
+ * 2. なくなった関数をModuleから消す(呼び出し元は1.で消えているはず)
+ *    作り直す関数は新しいFunctionに置き換える(値の名前の連番を全体を生成した場合と揃えるため)
+ *    使われなくなった配列の大域変数とcalloc・free・組み込み関数の宣言も消す
+ * 3. 関数宣言を追加し、本文のある関数定義を生成する
+ * 4. 関数の並びを、全体を生成した場合と同じ順に直す
+ * @param TranslationUnitAST
+ * @return 成功：true、失敗：false(Moduleは破棄する)
+ */
+bool CodeGen::updateTranslationUnit(TranslationUnitAST& t_unit) {
+	llvm::StringMap<int> param_nums;
+	llvm::StringMap<FunctionAST*> definitions;
+	llvm::StringSet<> declared;
+	for (int i = 0; PrototypeAST* proto = t_unit.getPrototype(i); i++) {
+		param_nums[proto->getName()] = proto->getParamNum();
+		declared.insert(proto->getName());
+	}
+	for (int i = 0; FunctionAST* func = t_unit.getFunction(i); i++) {
+		param_nums[func->getName()] = func->getPrototype()->getParamNum();
+		definitions[func->getName()] = func;
+	}
+
+	// 1. 2.
+	Callees.clear();
+	std::vector<llvm::Function*> stale, reset;
+	for (llvm::Function& func : *Mod) {
+		auto num = param_nums.find(func.getName());
+		auto def = definitions.find(func.getName());
+		if (num == param_nums.end() or num->second != (int)func.arg_size()) {
+			func.deleteBody();
+			stale.push_back(&func);
+		} else if (def == definitions.end() or def->second->getBody()) {
+			func.deleteBody();
+			reset.push_back(&func);
+		}
+	}
+	for (llvm::Function* func : stale) {
+		if (func->use_empty()) {
+			func->eraseFromParent();
+		} else if (not isRuntimeFunction(func)) {
+			SAFE_DELETE(Mod);
+			return false;
+		}
+	}
+	std::vector<llvm::GlobalVariable*> dead_globals;
+	for (llvm::GlobalVariable& global : Mod->globals()) {
+		global.removeDeadConstantUsers();
+		if (global.use_empty()) {
+			dead_globals.push_back(&global);
+		}
+	}
+	for (llvm::GlobalVariable* global : dead_globals) {
+		global->eraseFromParent();
+	}
+	for (llvm::Function* func : reset) {
+		llvm::Function* fresh = llvm::Function::Create(func->getFunctionType(), func->getLinkage(), "", Mod);
+		fresh->takeName(func);
+		func->replaceAllUsesWith(fresh);
+		func->eraseFromParent();
+	}
+
+	// 3. 引数名は全体を生成した場合と同じく、関数宣言があればその名前にする
+	for (int i = 0; PrototypeAST* proto = t_unit.getPrototype(i); i++) {
+		llvm::Function* func = Mod->getFunction(proto->getName());
+		if (not func) {
+			func = generatePrototype(proto, Mod);
+		} else if (func->empty()) {
+			setArgNames(func, proto);
+		}
+		if (not func) {
+			SAFE_DELETE(Mod);
+			return false;
+		}
+	}
+	for (int i = 0; FunctionAST* func_ast = t_unit.getFunction(i); i++) {
+		llvm::Function* func = Mod->getFunction(func_ast->getName());
+		if (not func_ast->getBody()) { // 前回のまま
+			if (not func or func->empty()) {
+				SAFE_DELETE(Mod);
+				return false;
+			}
+			continue;
+		}
+		if (func and not declared.count(func_ast->getName())) {
+			setArgNames(func, func_ast->getPrototype());
+		}
+		if (not generateFunctionDefinition(func_ast, Mod)) {
+			SAFE_DELETE(Mod);
+			return false;
+		}
+	}
+
+	// 4.
+	return orderFunctions(t_unit);
+}
+
+/*
+ * Moduleの関数の並びを、関数宣言、関数定義、calloc・free・組み込み関数の宣言(名前順)の順にする
+ * 配列の大域変数は、それを宣言した関数定義の順に並べる
+ * (全体を生成した場合と差分更新した場合で同じ並びになる)
+ * @param TranslationUnitAST
+ * @return true
+ */
+bool CodeGen::orderFunctions(TranslationUnitAST& t_unit) {
+	llvm::StringSet<> placed;
+	auto place = [&](llvm::StringRef name) {
+		if (placed.insert(name).second) {
+			llvm::Function* func = Mod->getFunction(name);
+			Mod->getFunctionList().splice(Mod->getFunctionList().end(), Mod->getFunctionList(), func->getIterator());
+		}
+	};
+	for (int i = 0; PrototypeAST* proto = t_unit.getPrototype(i); i++) {
+		place(proto->getName());
+	}
+	llvm::StringMap<int> func_index;
+	for (int i = 0; FunctionAST* func = t_unit.getFunction(i); i++) {
+		place(func->getName());
+		func_index.insert({func->getName(), i});
+	}
+	std::vector<llvm::StringRef> runtime;
+	for (llvm::Function& func : *Mod) {
+		if (not placed.count(func.getName())) {
+			runtime.push_back(func.getName());
+		}
+	}
+	std::sort(runtime.begin(), runtime.end());
+	for (llvm::StringRef name : runtime) {
+		place(name);
+	}
+
+	// 大域変数の名前は「関数名.配列名」
+	std::vector<std::pair<int, llvm::GlobalVariable*>> globals;
+	for (llvm::GlobalVariable& global : Mod->globals()) {
+		auto index = func_index.find(global.getName().split('.').first);
+		globals.push_back({index == func_index.end() ? INT_MAX : index->second, &global});
+	}
+	std::stable_sort(globals.begin(), globals.end(), [](const std::pair<int, llvm::GlobalVariable*>& a, const std::pair<int, llvm::GlobalVariable*>& b) {
+		return a.first < b.first;
+	});
+	for (auto& global : globals) {
+		Mod->getGlobalList().splice(Mod->getGlobalList().end(), Mod->getGlobalList(), global.second->getIterator());
+	}
+	return true;
+}
+
+/*
+ * 逐次コード生成の開始
+ * 以降、構文解析した順にaddPrototype・addFunctionで渡し、最後にfinishModuleを呼ぶ
+ * 出力先を渡すと、関数定義を生成するたびにその場で書き出して本文を捨てる
+ * (Moduleに残るのは関数宣言だけになり、使用メモリは最も大きい関数の分で済む)
+ * @param Module名(入力ファイル名)、出力先(NULLなら最後にModule全体を使う)
+ * @return true
+ */
+bool CodeGen::startModule(std::string name, llvm::raw_ostream* out) {
+	createModule(name);
+	StreamOut = out;
+	if (StreamOut) {
+		Mod->print(*StreamOut, NULL); // ModuleID、source_filename
+		SlotTracker = new llvm::ModuleSlotTracker(Mod, false);
+	}
+	return true;
+}
+
+/*
+ * 逐次コード生成で関数宣言を生成する
+ * @param PrototypeAST
+ * @return 成功：true、失敗：false
+ */
+bool CodeGen::addPrototype(PrototypeAST* proto) {
+	llvm::Function* func = Mod->getFunction(proto->getName());
+	if (func and func->arg_size() == (size_t)proto->getParamNum()) { // 先に定義した関数の宣言
+		return true;
+	}
+	return generatePrototype(proto, Mod) != NULL;
+}
+
+/*
+ * 逐次コード生成で関数定義を生成する
+ * 出力先があれば書き出して本文を捨てる
+ * メタデータの番号はModule全体で通しにし、定義はfinishModuleでまとめて書く
+ * @param FunctionAST
+ * @return 成功：true、失敗：false
+ */
+bool CodeGen::addFunction(FunctionAST* func_ast) {
+	llvm::Function* func = Mod->getFunction(func_ast->getName());
+	if (func and WrittenFunctions.count(func)) { // 書き出して本文を捨てた関数の再定義
+		fprintf(stderr, "error::function %s is redefined", func_ast->getName().data());
+		return false;
+	}
+	func = generateFunctionDefinition(func_ast, Mod);
+	if (not func) {
+		return false;
+	}
+	if (StreamOut) {
+		if (not NewGlobals.empty()) {
+			*StreamOut << "\n";
+		}
+		for (llvm::GlobalVariable* global : NewGlobals) {
+			static_cast<llvm::Value*>(global)->print(*StreamOut, *SlotTracker);
+			*StreamOut << "\n";
+		}
+		*StreamOut << "\n";
+		static_cast<llvm::Value*>(func)->print(*StreamOut, *SlotTracker);
+		llvm::SmallVector<std::pair<unsigned, llvm::MDNode*>, 1> attachments;
+		for (llvm::BasicBlock& bb : *func) {
+			for (llvm::Instruction& inst : bb) {
+				inst.getAllMetadata(attachments);
+				for (auto& attachment : attachments) {
+					WrittenNodes.insert(attachment.second);
+				}
+			}
+		}
+		func->deleteBody();
+		WrittenFunctions.insert(func);
+	}
+	return true;
+}
+
+/*
+ * 逐次コード生成の終了
+ * 書き出している場合は、定義しなかった関数の宣言と属性グループ、メタデータを書いて終える
+ * 書き出していない場合は、関数の並びを全体を生成した場合と同じにする
+ * @param 構文解析し終えたTranslationUnitAST
+ * @return true
+ */
+bool CodeGen::finishModule(TranslationUnitAST& t_unit) {
+	if (not StreamOut) {
+		return orderFunctions(t_unit);
+	}
+	// 属性グループ(組み込み関数の宣言に付く)は、途中で宣言した関数の分も含めてここで番号を付け直す
+	// 番号の順はModule全体を書き出す場合と同じ(関数の並び順に初めて出てきた順)
+	llvm::ModuleSlotTracker decl_tracker(Mod, false);
+	llvm::SetVector<llvm::AttributeSet> attr_groups;
+	for (llvm::Function& func : *Mod) {
+		if (func.getAttributes().getFnAttrs().hasAttributes()) {
+			attr_groups.insert(func.getAttributes().getFnAttrs());
+		}
+		if (not WrittenFunctions.count(&func)) {
+			*StreamOut << "\n";
+			static_cast<llvm::Value&>(func).print(*StreamOut, decl_tracker);
+		}
+	}
+	if (not attr_groups.empty()) {
+		*StreamOut << "\n";
+	}
+	for (size_t i = 0; i < attr_groups.size(); i++) {
+		*StreamOut << "attributes #" << i << " = { " << attr_groups[i].getAsString(true) << " }\n";
+	}
+	if (not WrittenNodes.empty()) {
+		*StreamOut << "\n";
+	}
+	for (llvm::MDNode* node : WrittenNodes) {
+		node->print(*StreamOut, *SlotTracker, Mod);
+		*StreamOut << "\n";
+	}
+	StreamOut->flush();
 	return true;
 }
 
@@ -97,9 +435,32 @@ llvm::Function* CodeGen::generateFunctionDefinition(FunctionAST* func_ast, llvm:
 		return NULL;
 	}
 	CurFunc = func;
+	CurBody = func_ast->getBody();
+	CurProto = func_ast->getPrototype();
+	CurReturned = false;
+	// 範囲の表は関数ごとに作り直す
+	ValueRanges.clear();
+	VariableRanges.clear();
+	LocalVariables.clear();
+	LocalArrays.clear();
+	CurrentDefs.clear();
+	IncompletePhis.clear();
+	SealedBlocks.clear();
+	AssignedRanges.clear();
+	ArrayBounds.clear();
+	HeapArrays.clear();
+	NewGlobals.clear();
+	BoundsFailBlock = NULL;
+	IndexedArrays.clear();
+	ElementRanges.clear();
 	llvm::BasicBlock* bblock = llvm::BasicBlock::Create(TheContext, "entry", func);
 	Builder->SetInsertPoint(bblock);
+	sealBlock(bblock); // 先行ブロックはない
 	generateFunctionStatement(func_ast->getBody());
+	if (BoundsFailBlock) {
+		BoundsFailBlock->moveAfter(&func->back());
+	}
+	CurProto->setResultRange(CurReturned ? CurResult : ValueRange::unknown());
 	return func;
 }
 
@@ -115,7 +476,7 @@ llvm::Function* CodeGen::generatePrototype(PrototypeAST* proto, llvm::Module* mo
 		if (func->arg_size() == proto->getParamNum() and func->empty()) {
 			return func;
 		} else {
-			fprintf(stderr, "error::function %s is redefined", proto->getName().c_str());
+			fprintf(stderr, "error::function %s is redefined", proto->getName().data());
 			return NULL;
 		}
 	}
@@ -125,13 +486,36 @@ llvm::Function* CodeGen::generatePrototype(PrototypeAST* proto, llvm::Module* mo
 	llvm::FunctionType* func_type = llvm::FunctionType::get(llvm::Type::getInt64Ty(TheContext), int_types, false);
 	// create function
 	func = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage, proto->getName(), mod);
-	// set names
+	setArgNames(func, proto);
+	if (proto->getResultRange().hasUpper()) {
+		CalleeRanges[proto->getSymbol()] = proto->getResultRange();
+	}
+	std::vector<ValueRange> param_ranges;
+	for (int i = 0; i < proto->getParamNum(); i++) {
+		param_ranges.push_back(proto->getParamRange(i));
+	}
+	if (std::any_of(param_ranges.begin(), param_ranges.end(), [](const ValueRange& range) { return range.hasUpper(); })) {
+		CalleeParamRanges[proto->getSymbol()] = param_ranges;
+	}
+	return func;
+}
+
+/*
+ * 引数名を設定する
+ * 付け替えるときに名前がぶつからないよう、一度全て消してから付ける
+ * @param Function PrototypeAST
+ * @return true
+ */
+bool CodeGen::setArgNames(llvm::Function* func, PrototypeAST* proto) {
+	for (llvm::Argument& arg : func->args()) {
+		arg.setName("");
+	}
 	llvm::Function::arg_iterator arg_iter = func->arg_begin();
 	for (int i = 0; i < proto->getParamNum(); i++) {
-		arg_iter->setName(proto->getParamName(i).append("_arg"));
+		arg_iter->setName(proto->getParamName(i) + "_arg");
 		arg_iter++;
 	}
-	return func;
+	return true;
 }
 
 /*
@@ -141,55 +525,190 @@ llvm::Function* CodeGen::generatePrototype(PrototypeAST* proto, llvm::Module* mo
  * @return 最後に生成したValueのポインタ
  */
 llvm::Value* CodeGen::generateFunctionStatement(FunctionStmtAST* func_stmt) {
+	// 添字で要素を読み書きする配列(簡約で消えたノードも含むが、upper_dataを付けなくなるだけ)
+	bool has_loop = false;
+	for (NodeIndex i = 0; i < func_stmt->getNodeNum(); i++) {
+		if (func_stmt->getNode(i).getValueID() == ElementID) {
+			IndexedArrays.set(func_stmt->getNode(i).getSymbol(), true);
+		} else if (func_stmt->getNode(i).getValueID() == LoopStmtID) {
+			has_loop = true;
+		}
+	}
+
+	collectParamRanges(func_stmt);
+
+	// 変数・配列の型を決めるため、代入される値の範囲と配列の上限を先に集める(引数は範囲不明から始まる)
+	// for文の変数のupper_dataにも使う
+	if (Narrow or has_loop) {
+		for (int i = 0; const VariableDeclAST* v_decl = func_stmt->getVariableDecl(i); i++) {
+			if (v_decl->getType() == VariableDeclAST::param) {
+				AssignedRanges.set(v_decl->getSymbol(), ValueRange::unknown());
+			}
+		}
+		for (int i = 0; func_stmt->getStatement(i) != InvalidNode; i++) {
+			collectAssignedRanges(func_stmt->getStatement(i));
+		}
+	}
+
 	// insert array decls
-	ArrayDeclAST* a_decl;
 	llvm::Value* v = NULL;
-	for (int i = 0; ; i++) {
-		if (not func_stmt->getArrayDecl(i)) {
-			break;
-		}
-		a_decl = llvm::dyn_cast<ArrayDeclAST>(func_stmt->getArrayDecl(i));
+	for (int i = 0; const ArrayDeclAST* a_decl = func_stmt->getArrayDecl(i); i++) {
 		v = generateArrayDeclaration(a_decl);
 	}
 
 	// insert variable decls
-	VariableDeclAST* v_decl;
-	for (int i = 0; ; i++) {
-		if (not func_stmt->getVariableDecl(i)) {
-			break;
-		}
+	for (int i = 0; const VariableDeclAST* v_decl = func_stmt->getVariableDecl(i); i++) {
 		// create alloca
-		v_decl = llvm::dyn_cast<VariableDeclAST>(func_stmt->getVariableDecl(i));
 		v = generateVariableDeclaration(v_decl);
 	}
 	// insert expr statement
-	BaseAST* stmt;
 	for (int i = 0; ; i++) {
-		stmt = func_stmt->getStatement(i);
-		if (not stmt) {
+		NodeIndex stmt = func_stmt->getStatement(i);
+		if (stmt == InvalidNode) {
 			break;
-		} else if (not llvm::isa<NullExprAST>(stmt)) {
+		} else if (func_stmt->getNode(stmt).getValueID() != NullExprID) {
 			v = generateStatement(stmt);
 		}
 	}
 	return v;
 }
 
+/*
+ * 引数の範囲(呼び出される側の前提)を集めて、インターフェースファイルに書き出すPrototypeASTに持たせる
+ * 関数の先頭の段(for文の外)で、その引数に代入する前に付けた`$`の注釈だけを使う
+ * (呼び出した時点の値の上限になる。注釈が複数あれば小さい方)
+ * @param FunctionStmtAST
+ * @return true
+ */
+bool CodeGen::collectParamRanges(FunctionStmtAST* func_stmt) {
+	std::vector<bool> assigned(CurProto->getParamNum(), false);
+	auto findParam = [this](Symbol name) {
+		for (int i = 0; i < CurProto->getParamNum(); i++) {
+			if (CurProto->getParamSymbol(i) == name) {
+				return i;
+			}
+		}
+		return -1;
+	};
+	// 文のノードは、その文の子(for文なら本文も含む)の後に並ぶ
+	NodeIndex scanned = 0;
+	for (int i = 0; func_stmt->getStatement(i) != InvalidNode; i++) {
+		NodeIndex stmt = func_stmt->getStatement(i);
+		const ExprNode& node = func_stmt->getNode(stmt);
+		if (node.getValueID() == BinaryExprID and node.getOp() == OP_ANNOTATE and
+			func_stmt->getNode(node.getLHS()).getValueID() == VariableID and func_stmt->getNode(node.getRHS()).getValueID() == NumberID) {
+			int param = findParam(func_stmt->getNode(node.getLHS()).getSymbol());
+			if (param >= 0 and not assigned[param]) {
+				int64_t upper = func_stmt->getNode(node.getRHS()).getNumberValue();
+				ValueRange prev = CurProto->getParamRange(param);
+				CurProto->setParamRange(param, {INT64_MIN, prev.hasUpper() ? std::min(prev.Upper, upper) : upper});
+			}
+		}
+		for (; scanned <= stmt; scanned++) {
+			const ExprNode& child = func_stmt->getNode(scanned);
+			if (child.getValueID() == BinaryExprID and child.getOp() == OP_ASSIGN and
+				func_stmt->getNode(child.getLHS()).getValueID() == VariableID) {
+				if (int param = findParam(func_stmt->getNode(child.getLHS()).getSymbol()); param >= 0) {
+					assigned[param] = true;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * 変数・配列の要素に代入される値の範囲と、配列の`$`の上限を集める(Narrow)
+ * 代入式のノードの範囲は代入後の変数の範囲(`$`の上限を含む)なので、それを合わせていく
+ * @param 式のノード
+ * @return true
+ */
+bool CodeGen::collectAssignedRanges(NodeIndex expr) {
+	const ExprNode& node = CurBody->getNode(expr);
+	switch (node.getValueID()) {
+	case BinaryExprID: {
+		const ExprNode& lhs = CurBody->getNode(node.getLHS());
+		if (node.getOp() == OP_ASSIGN and lhs.getValueID() == ElementID) {
+			ValueRange range = CurBody->getRange(expr);
+			if (const ValueRange* assigned = ElementRanges.find(lhs.getSymbol())) {
+				range.Lower = std::min(range.Lower, assigned->Lower);
+				range.Upper = std::max(range.Upper, assigned->Upper);
+			}
+			ElementRanges.set(lhs.getSymbol(), range);
+			collectAssignedRanges(lhs.getIndex());
+			return collectAssignedRanges(node.getRHS());
+		} else if (node.getOp() == OP_ASSIGN) {
+			ValueRange range = CurBody->getRange(expr);
+			if (const ValueRange* assigned = AssignedRanges.find(lhs.getSymbol())) {
+				range.Lower = std::min(range.Lower, assigned->Lower);
+				range.Upper = std::max(range.Upper, assigned->Upper);
+			}
+			AssignedRanges.set(lhs.getSymbol(), range);
+			return collectAssignedRanges(node.getRHS());
+		} else if (node.getOp() == OP_ANNOTATE) {
+			if (lhs.getValueID() == ArrayID) {
+				int64_t bound = CurBody->getNode(node.getRHS()).getNumberValue();
+				const int64_t* prev = ArrayBounds.find(lhs.getSymbol());
+				ArrayBounds.set(lhs.getSymbol(), prev ? std::max(*prev, bound) : bound);
+			}
+			return true;
+		} else if (node.getOp() == OP_INC) {
+			return true;
+		}
+		collectAssignedRanges(node.getLHS());
+		return collectAssignedRanges(node.getRHS());
+	}
+	case CallExprID:
+		for (int i = 0; i < CurBody->getArgNum(expr); i++) {
+			collectAssignedRanges(CurBody->getArg(expr, i));
+		}
+		return true;
+	case JumpStmtID:
+		return collectAssignedRanges(node.getExpr());
+	case ElementID:
+		return collectAssignedRanges(node.getIndex());
+	case LoopStmtID: {
+		// for文の変数は抜けた後の範囲(初期値から上限 + 増分 - 1まで)をとる。増分の整数も変数の型で足せるようにする
+		collectAssignedRanges(node.getExpr());
+		Symbol var = CurBody->getNode(CurBody->getNode(node.getExpr()).getLHS()).getSymbol();
+		int64_t step = CurBody->getNode(CurBody->getLoopStep(expr)).getNumberValue();
+		ValueRange range = CurBody->getRange(expr);
+		range = {std::min(range.Lower, step), std::max(range.Upper, step)};
+		if (const ValueRange* assigned = AssignedRanges.find(var)) {
+			range.Lower = std::min(range.Lower, assigned->Lower);
+			range.Upper = std::max(range.Upper, assigned->Upper);
+		}
+		AssignedRanges.set(var, range);
+		collectAssignedRanges(CurBody->getLoopLimit(expr));
+		for (int i = 0; i < CurBody->getLoopStmtNum(expr); i++) {
+			collectAssignedRanges(CurBody->getLoopStmt(expr, i));
+		}
+		return true;
+	}
+	default:
+		return true;
+	}
+}
+
 /*
  * 変数宣言(alloca)生成メソッド
+ * DirectSSAならallocaは作らず、引数の値を変数の最初の値にする(局所変数は代入するまで未定義)
  * @param VariableDeclAST
  * @return 生成したValueのポインタ
  */
-llvm::Value* CodeGen::generateVariableDeclaration(VariableDeclAST* v_decl) {
+llvm::Value* CodeGen::generateVariableDeclaration(const VariableDeclAST* v_decl) {
 	// create alloca
-	llvm::AllocaInst* alloca = Builder->CreateAlloca(llvm::Type::getInt64Ty(TheContext), 0, v_decl->getName());
-	decl_mp[v_decl->getName()] = alloca;
+	llvm::AllocaInst* alloca = NULL;
+	if (not DirectSSA) {
+		alloca = createEntryAlloca(getVariableType(v_decl->getSymbol()), v_decl->getName());
+		LocalVariables.set(v_decl->getSymbol(), alloca);
+	}
 	//        llvm::errs() << "gVD: " << v_decl->getName() << '\n';
 
 	// if args alloca
 	if (v_decl->getType() == VariableDeclAST::param) {
 		// Find the argument in the function's argument list
-		std::string argName = v_decl->getName().append("_arg");
+		std::string argName = (v_decl->getName() + "_arg").str();
 		//        llvm::errs() << v_decl->getName() << '\n';
 		//        llvm::errs() << argName << '\n';
 		llvm::Argument* arg = NULL;
@@ -201,7 +720,10 @@ llvm::Value* CodeGen::generateVariableDeclaration(VariableDeclAST* v_decl) {
 			}
 		}
 		//        llvm::errs() << arg->getName() << '\n';
-		if (arg) {
+		if (arg and DirectSSA) {
+			writeVariable(v_decl->getSymbol(), Builder->GetInsertBlock(), arg);
+			return arg;
+		} else if (arg) {
 			// store args
 			Builder->CreateStore(arg, alloca);
 		} else {
@@ -213,348 +735,928 @@ llvm::Value* CodeGen::generateVariableDeclaration(VariableDeclAST* v_decl) {
 	return alloca;
 }
 
+/*
+ * 入口のブロックにallocaを作る
+ * 大きい配列の確保・初期化の分岐で入口のブロックが分かれていても、allocaは入口のブロックの先頭のallocaの並びの後に置く
+ * (mem2reg・SROAが昇格させるのは入口のブロックのallocaだけなので)
+ * @param 型、名前
+ * @return 作ったalloca
+ */
+llvm::AllocaInst* CodeGen::createEntryAlloca(llvm::Type* type, llvm::StringRef name) {
+	llvm::BasicBlock& entry = CurFunc->getEntryBlock();
+	llvm::BasicBlock::iterator it = entry.begin();
+	while (it != entry.end() and llvm::isa<llvm::AllocaInst>(*it)) {
+		++it;
+	}
+	llvm::IRBuilder<> entry_builder(&entry, it);
+	return entry_builder.CreateAlloca(type, 0, name);
+}
+
 /*
  * 配列宣言生成メソッド
+ * ArrayStackLimitバイト以下の配列はスタック(alloca)に、それより大きい配列はLargeArraysに置く
+ * ヒープの領域はcallocでゼロ初期化され、ページは最初に触れたときに割り当てられる(確保できなければ止める)
+ * 大域変数の領域は最初の呼び出しではBSSのゼロのまま使い(ページは最初に触れたときに割り当てられる)、
+ * 二回目以降は前の呼び出しの値が残っているので、初期化子がなければ宣言の位置でmemsetして0に戻す
+ * (呼び出し済みかは配列ごとの大域変数の旗で判定する。要素の範囲を[0, 上限]とみなすため。初期化子があれば初期化子が全体を書く)
+ * 初期化子があれば、宣言のたびに(再入しても)初期化する
  * @param ArrayDeclAST
  * @return 生成したValueのポインタ
  */
-llvm::Value* CodeGen::generateArrayDeclaration(ArrayDeclAST* a_decl) {
+llvm::Value* CodeGen::generateArrayDeclaration(const ArrayDeclAST* a_decl) {
 	// // TODO
 	// printf("generate decl_array\n");
 	// return NULL;
 
-	// create alloca
-	auto I = llvm::Type::getInt64Ty(TheContext);
+	// 要素は初期値(初期化子がなければundefかゼロ初期化で、0とみなす)か代入した値からincで増えるだけなので、
+	// `$`の上限があれば範囲は[初期値・代入した値の最小, 上限と初期値・代入した値の最大の大きい方]とみなせる
+	llvm::ArrayRef<int64_t> init_list = CurBody->getArrayInit(a_decl);
+	ValueRange elems = {0, 0};
+	if (a_decl->getInit() == ArrayDeclAST::fill_init) {
+		elems = {a_decl->getFillValue(), a_decl->getFillValue()};
+	} else if (not init_list.empty() and init_list.size() == a_decl->getSize()) {
+		elems = {init_list[0], init_list[0]};
+	}
+	for (int64_t val : init_list) {
+		elems = {std::min(elems.Lower, val), std::max(elems.Upper, val)};
+	}
+	if (const ValueRange* assigned = ElementRanges.find(a_decl->getSymbol())) {
+		elems = {std::min(elems.Lower, assigned->Lower), std::max(elems.Upper, assigned->Upper)};
+	}
+	const int64_t* bound = ArrayBounds.find(a_decl->getSymbol());
+	auto I = bound ? getIntType({elems.Lower, std::max(elems.Upper, *bound)}) : llvm::Type::getInt64Ty(TheContext);
 	auto A = llvm::ArrayType::get(I, a_decl->getSize());
-	llvm::AllocaInst* alloca = Builder->CreateAlloca(A, 0, a_decl->getName());
-	decl_a_mp[a_decl->getName()] = alloca;
-	a_siz[a_decl->getName()] = a_decl->getSize();
-	return alloca;
+	uint64_t elem_bytes = I->getBitWidth() / 8;
+	llvm::Value* ptr;
+	bool zeroed = false;
+	if (a_decl->getSize() * elem_bytes <= ArrayStackLimit) {
+		// create alloca
+		ptr = createEntryAlloca(A, a_decl->getName());
+	} else if (LargeArrays == ArrayInGlobal) {
+		llvm::GlobalVariable* global = new llvm::GlobalVariable(*Mod, A, false, llvm::GlobalValue::InternalLinkage,
+			llvm::ConstantAggregateZero::get(A), CurFunc->getName() + "." + a_decl->getName());
+		NewGlobals.push_back(global);
+		ptr = global;
+		if (a_decl->getInit() == ArrayDeclAST::no_init) {
+			// 最初の呼び出しではBSSのゼロのまま使い、二回目以降だけ0に戻す(ページに触れるのを最初の読み書きまで遅らせる)
+			llvm::GlobalVariable* entered = new llvm::GlobalVariable(*Mod, Builder->getInt1Ty(), false, llvm::GlobalValue::InternalLinkage,
+				Builder->getFalse(), global->getName() + ".entered");
+			NewGlobals.push_back(entered);
+			llvm::BasicBlock* clear_block = llvm::BasicBlock::Create(TheContext, "array_clear", CurFunc);
+			llvm::BasicBlock* ready_block = llvm::BasicBlock::Create(TheContext, "array_ready", CurFunc);
+			Builder->CreateCondBr(Builder->CreateLoad(Builder->getInt1Ty(), entered, "entered_tmp"), clear_block, ready_block);
+			Builder->SetInsertPoint(clear_block);
+			sealBlock(clear_block);
+			Builder->CreateMemSet(ptr, Builder->getInt8(0), a_decl->getSize() * elem_bytes, llvm::MaybeAlign(elem_bytes));
+			Builder->CreateBr(ready_block);
+			Builder->SetInsertPoint(ready_block);
+			sealBlock(ready_block);
+			Builder->CreateStore(Builder->getTrue(), entered);
+		}
+	} else {
+		llvm::FunctionCallee calloc_func = Mod->getOrInsertFunction("calloc", Builder->getInt8PtrTy(), Builder->getInt64Ty(), Builder->getInt64Ty());
+		llvm::Value* mem = Builder->CreateCall(calloc_func, {Builder->getInt64(a_decl->getSize()), Builder->getInt64(elem_bytes)}, "calloc_tmp");
+		// 確保できなければ止める(0番地からの添字のアクセスで他の領域を壊さないように)
+		generateTrapUnless(Builder->CreateIsNotNull(mem, "calloc_ok_tmp"), "calloc_ok");
+		HeapArrays.push_back(mem);
+		zeroed = true;
+		ptr = Builder->CreateBitCast(mem, A->getPointerTo(), a_decl->getName());
+	}
+	// DowncastPassが要素の型を変えられるのは、定数の添字のgetelementptrでしか使わないallocaの配列だけ
+	LocalArray array = {ptr, A, llvm::isa<llvm::AllocaInst>(ptr) and a_decl->getInit() == ArrayDeclAST::no_init and
+		not IndexedArrays.count(a_decl->getSymbol())};
+	LocalArrays.set(a_decl->getSymbol(), array);
+	if (a_decl->getInit() != ArrayDeclAST::no_init) {
+		generateArrayInitializer(a_decl, array, zeroed);
+	}
+	return ptr;
+}
+
+/*
+ * 配列初期化生成メソッド
+ * 要素を一つずつstoreせず、まとめてメモリに書く
+ * - 全要素が同じで、どのバイトも同じ値(0や-1)なら一つのmemset
+ * - 全要素が同じでそれ以外なら、先頭にstoreし、初期化した部分を倍々にmemcpyする(memcpyは要素数の対数回)
+ * - {...}なら、値を定数の大域変数に置いてmemcpyし、末尾の0の並びはmemsetする
+ * @param ArrayDeclAST、配列、領域がゼロ初期化済みか(callocした領域)
+ * @return true
+ */
+bool CodeGen::generateArrayInitializer(const ArrayDeclAST* a_decl, const LocalArray& array, bool zeroed) {
+	llvm::IntegerType* I = llvm::cast<llvm::IntegerType>(array.Type->getElementType());
+	uint64_t elem_bytes = I->getBitWidth() / 8;
+	uint64_t size = a_decl->getSize();
+	llvm::MaybeAlign align(elem_bytes);
+	auto elemPtr = [&](uint64_t i) {
+		return Builder->CreateConstInBoundsGEP2_64(array.Type, array.Ptr, 0, i, "init_gep");
+	};
+	// 先頭から[begin, size)の要素を0にする
+	auto zeroTail = [&](uint64_t begin) {
+		if (begin < size and not zeroed) {
+			Builder->CreateMemSet(elemPtr(begin), Builder->getInt8(0), (size - begin) * elem_bytes, align);
+		}
+	};
+
+	if (a_decl->getInit() == ArrayDeclAST::fill_init) {
+		llvm::APInt val(I->getBitWidth(), a_decl->getFillValue(), true);
+		if (val.isNullValue()) {
+			zeroTail(0);
+		} else if (val.isSplat(8)) {
+			Builder->CreateMemSet(array.Ptr, Builder->getInt8(val.getLoBits(8).getZExtValue()), size * elem_bytes, align);
+		} else if (size > 0) {
+			Builder->CreateStore(llvm::ConstantInt::get(I, val), elemPtr(0));
+			for (uint64_t done = 1; done < size; done *= 2) {
+				uint64_t n = std::min(done, size - done);
+				Builder->CreateMemCpy(elemPtr(done), align, array.Ptr, align, n * elem_bytes);
+			}
+		}
+		return true;
+	}
+
+	llvm::ArrayRef<int64_t> values = CurBody->getArrayInit(a_decl);
+	while (not values.empty() and values.back() == 0) {
+		values = values.drop_back();
+	}
+	if (not values.empty()) {
+		std::vector<llvm::Constant*> elems;
+		for (int64_t val : values) {
+			elems.push_back(llvm::ConstantInt::get(I, val, true));
+		}
+		llvm::ArrayType* init_type = llvm::ArrayType::get(I, values.size());
+		llvm::GlobalVariable* init = new llvm::GlobalVariable(*Mod, init_type, true, llvm::GlobalValue::PrivateLinkage,
+			llvm::ConstantArray::get(init_type, elems), CurFunc->getName() + "." + a_decl->getName() + ".init");
+		init->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+		init->setAlignment(align);
+		NewGlobals.push_back(init);
+		Builder->CreateMemCpy(array.Ptr, align, init, align, values.size() * elem_bytes);
+	}
+	zeroTail(values.size());
+	return true;
 }
 
 /*
  * ステートメント生成メソッド
  * 実際にはASTの種類を確認して各種生成メソッドを呼び出し
- * @param JumpStmtAST
+ * @param 文のノード
  * @return 生成したValueのポインタ
  */
-llvm::Value* CodeGen::generateStatement(BaseAST* stmt) {
-	if (llvm::isa<BinaryExprAST>(stmt)) {
-		return generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(stmt));
-	} else if (llvm::isa<CallExprAST>(stmt)) {
-		return generateCallExpression(llvm::dyn_cast<CallExprAST>(stmt));
-	} else if (llvm::isa<JumpStmtAST>(stmt)) {
-		return generateJumpStatement(llvm::dyn_cast<JumpStmtAST>(stmt));
-	} else {
+llvm::Value* CodeGen::generateStatement(NodeIndex stmt) {
+	switch (CurBody->getNode(stmt).getValueID()) {
+	case BinaryExprID:
+		return generateBinaryExpression(stmt);
+	case CallExprID:
+		return generateCallExpression(stmt);
+	case JumpStmtID:
+		return generateJumpStatement(stmt);
+	case ElementID: // 添字の検査のために読む
+		return generateExpression(stmt);
+	case LoopStmtID:
+		return generateLoopStatement(stmt);
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * 値として使う式の生成メソッド
+ * 代入式の値は代入後の変数をLoadして返す(DirectSSAと、配列の要素への代入なら代入した値)
+ * @param 式のノード
+ * @return 生成したValueのポインタ
+ */
+llvm::Value* CodeGen::generateExpression(NodeIndex expr) {
+	const ExprNode& node = CurBody->getNode(expr);
+	switch (node.getValueID()) {
+	case BinaryExprID: {
+		llvm::Value* v = generateBinaryExpression(expr);
+		// 代入のときはLoad命令を追加
+		if (node.getOp() == OP_ASSIGN and not DirectSSA and CurBody->getNode(node.getLHS()).getValueID() == VariableID) {
+			llvm::AllocaInst* const* local_var = LocalVariables.find(CurBody->getNode(node.getLHS()).getSymbol());
+			assert(local_var);
+			llvm::LoadInst* load = Builder->CreateLoad((*local_var)->getAllocatedType(), *local_var, "arg_val");
+			setLoadRange(load, CurBody->getRange(expr));
+			v = load;
+		}
+		return v;
+	}
+	case CallExprID:
+		return generateCallExpression(expr);
+	case VariableID:
+		return generateVariable(node.getSymbol(), CurBody->getRange(expr));
+	case NumberID:
+		return generateNumber(node.getNumberValue());
+	case ElementID: {
+		llvm::Value* elem_ptr = generateElementPointer(expr);
+		return Builder->CreateLoad(LocalArrays.find(node.getSymbol())->Type->getElementType(), elem_ptr, "elem_tmp");
+	}
+	default:
 		return NULL;
 	}
 }
 
 /*
  * 二項演算生成メソッド
- * @param JumpStmtAST
+ * 演算子の種類でswitchし、+-*\/は上限値の注釈(upper_data)も付ける
+ * @param 二項演算のノード
  * @return 生成したValueのポインタ
  */
-llvm::Value* CodeGen::generateBinaryExpression(BinaryExprAST* bin_expr) {
-	BaseAST* lhs = bin_expr->getLHS();
-	BaseAST* rhs = bin_expr->getRHS();
-	llvm::Value* lhs_v;
-	llvm::Value* rhs_v;
-	// assignment
-	if (bin_expr->getOp() == "=") {
-		// lhs is variable
-		VariableAST* lhs_var = llvm::dyn_cast<VariableAST>(lhs);
-		std::string varName = lhs_var->getName();
-		llvm::Value* local_var = NULL;
-		// llvm::Argument* arg = NULL;
-		for (llvm::BasicBlock& bb : *CurFunc) {
-			for (llvm::Instruction& i : bb) {
-				if (i.getName() == varName) {
-					local_var = &i;
-					break;
-				}
+llvm::Value* CodeGen::generateBinaryExpression(NodeIndex bin_expr) {
+	const ExprNode& node = CurBody->getNode(bin_expr);
+	BinaryOp op = node.getOp();
+	const ExprNode& lhs = CurBody->getNode(node.getLHS());
+	const ExprNode& rhs = CurBody->getNode(node.getRHS());
+	llvm::Value* lhs_v = NULL;
+	llvm::Value* rhs_v = NULL;
+
+	switch (op) {
+	case OP_ANNOTATE: { // 注釈
+		assert(lhs.getValueID() == VariableID or lhs.getValueID() == ArrayID);
+		assert(rhs.getValueID() == NumberID);
+		if (Symbol name = lhs.getSymbol(); lhs.getValueID() == VariableID) {
+			setVariableRange(name, makeConstantRange({INT64_MIN, rhs.getNumberValue()}));
+			if (llvm::AllocaInst** local_var = LocalVariables.find(name)) {
+				setUpperData(*local_var, rhs.getNumberValue());
 			}
-			if (local_var) {
-				break;
+		} else if (LocalArray* local_array = LocalArrays.find(name)) {
+			setRange(local_array->Ptr, makeConstantRange({INT64_MIN, rhs.getNumberValue()}));
+			if (local_array->UpperData) {
+				setUpperData(llvm::cast<llvm::AllocaInst>(local_array->Ptr), rhs.getNumberValue());
 			}
 		}
-		if (local_var) {
-			lhs_v = local_var;
-		} else {
-			llvm::errs() << "Variable not found: " << varName << "\n";
-		}
-	} else if (bin_expr->getOp() == "$") {
-		/* pass */
-	} else if (bin_expr->getOp() == "inc") {
-		/* pass */
-	} else { // other operand
-		// lhs = ?
-		// Binary?
-		if (llvm::isa<BinaryExprAST>(lhs)) {
-			lhs_v = generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(lhs));
-		} else if (llvm::isa<VariableAST>(lhs)) { // Variable?
-			lhs_v = generateVariable(llvm::dyn_cast<VariableAST>(lhs));
-		} else if (llvm::isa<NumberAST>(lhs)) { // Number?
-			NumberAST* num = llvm::dyn_cast<NumberAST>(lhs);
-			lhs_v = generateNumber(num->getNumberValue());
-		}
-		// } else if (llvm::isa<ArrayAST>(lhs)) {
-		// 	lhs_v = generateArray(llvm::dyn_cast<ArrayAST>(lhs));
-		// }
-	}
-	// create rhs value
-	if (llvm::isa<BinaryExprAST>(rhs)) {
-		rhs_v = generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(rhs));
-	} else if (llvm::isa<CallExprAST>(rhs)) { // CallExpr?
-		rhs_v = generateCallExpression(llvm::dyn_cast<CallExprAST>(rhs));
-	} else if (llvm::isa<VariableAST>(rhs)) { // Variable?
-		rhs_v = generateVariable(llvm::dyn_cast<VariableAST>(rhs));
-	} else if (llvm::isa<NumberAST>(rhs)) { // Number?
-		NumberAST* num = llvm::dyn_cast<NumberAST>(rhs);
-		rhs_v = generateNumber(num->getNumberValue());
-	}
-
-	if (bin_expr->getOp() == "=") {
-		// store
-		// llvm::errs() << rhs_v->getName() << '\n';
-		if (mp.count(rhs_v->getName())) {
-			mp[lhs_v->getName()] = mp[rhs_v->getName()];
-			// llvm::errs() << "=, mp[lhs_v->getName()] : " << mp[lhs_v->getName()] << '\n';
-		} else if (llvm::isa<NumberAST>(rhs)) {
-			mp[lhs_v->getName()] = llvm::dyn_cast<NumberAST>(rhs)->getNumberValue();
-		}
-		auto tmp = Builder->CreateStore(rhs_v, lhs_v);
-		llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(mp[lhs_v->getName()])));
-		llvm::cast<llvm::Instruction>(tmp)->setMetadata("upper_data", Node);
-		return tmp;
-		// assert(lhs->getUpper() == Infty);
-		// lhs->UpdateUpper(rhs->getUpper());
-		//       llvm::errs() << lhs->getUpper() << '\n';
-	} else if (bin_expr->getOp() == "+") { // add
-		auto tmp = Builder->CreateAdd(lhs_v, rhs_v, "add_tmp");
-		// llvm::errs() << lhs_v->getName() << '\n';
-		// llvm::errs() << rhs_v->getName() << '\n';
-		int64_t lval = INT32_MAX, rval = INT32_MAX;
-		if (mp.count(lhs_v->getName())) {
-			lval = mp[lhs_v->getName()];
-		} else if (llvm::isa<NumberAST>(lhs)) {
-			lval = llvm::dyn_cast<NumberAST>(lhs)->getNumberValue();
-		}
-		if (mp.count(rhs_v->getName())) {
-			rval = mp[rhs_v->getName()];
-		} else if (llvm::isa<NumberAST>(rhs)) {
-			rval = llvm::dyn_cast<NumberAST>(rhs)->getNumberValue();
-		}
-		mp[tmp->getName()] = lval + rval;
-		// llvm::errs() << "+, mp[tmp->getName()] : " << mp[tmp->getName()] << '\n';
-		llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(mp[tmp->getName()])));
-		llvm::cast<llvm::Instruction>(tmp)->setMetadata("upper_data", Node);
-		return tmp;
-	} else if (bin_expr->getOp() == "-") { // sub
-		auto tmp = Builder->CreateSub(lhs_v, rhs_v, "sub_tmp");
-		int64_t lval = INT32_MAX, rval = INT32_MAX;
-		if (mp.count(lhs_v->getName())) {
-			lval = mp[lhs_v->getName()];
-		} else if (llvm::isa<NumberAST>(lhs)) {
-			lval = llvm::dyn_cast<NumberAST>(lhs)->getNumberValue();
-		}
-		if (mp.count(rhs_v->getName())) {
-			rval = mp[rhs_v->getName()];
-		} else if (llvm::isa<NumberAST>(rhs)) {
-			rval = llvm::dyn_cast<NumberAST>(rhs)->getNumberValue();
-		}
-		mp[tmp->getName()] = lval - rval;
-		llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(mp[tmp->getName()])));
-		llvm::cast<llvm::Instruction>(tmp)->setMetadata("upper_data", Node);
-		// llvm::errs() << "mp[tmp->getName()] : " << mp[tmp->getName()] << '\n';
-		return tmp;
-	} else if (bin_expr->getOp() == "*") { // mul
-		auto tmp = Builder->CreateMul(lhs_v, rhs_v, "mul_tmp");
-		int64_t lval = INT32_MAX, rval = INT32_MAX;
-		if (mp.count(lhs_v->getName())) {
-			lval = mp[lhs_v->getName()];
-		} else if (llvm::isa<NumberAST>(lhs)) {
-			lval = llvm::dyn_cast<NumberAST>(lhs)->getNumberValue();
-		}
-		if (mp.count(rhs_v->getName())) {
-			rval = mp[rhs_v->getName()];
-		} else if (llvm::isa<NumberAST>(rhs)) {
-			rval = llvm::dyn_cast<NumberAST>(rhs)->getNumberValue();
-		}
-		mp[tmp->getName()] = lval * rval;
-		llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(mp[tmp->getName()])));
-		llvm::cast<llvm::Instruction>(tmp)->setMetadata("upper_data", Node);
-		// llvm::errs() << "mp[tmp->getName()] : " << mp[tmp->getName()] << '\n';
-		return tmp;
-	} else if (bin_expr->getOp() == "/") { // div
-		auto tmp = Builder->CreateSDiv(lhs_v, rhs_v, "div_tmp");
-		int64_t lval = INT32_MAX, rval = INT32_MAX;
-		if (mp.count(lhs_v->getName())) {
-			lval = mp[lhs_v->getName()];
-		} else if (llvm::isa<NumberAST>(lhs)) {
-			lval = llvm::dyn_cast<NumberAST>(lhs)->getNumberValue();
-		}
-		if (mp.count(rhs_v->getName())) {
-			rval = mp[rhs_v->getName()];
-		} else if (llvm::isa<NumberAST>(rhs)) {
-			rval = llvm::dyn_cast<NumberAST>(rhs)->getNumberValue();
-		}
-		mp[tmp->getName()] = lval;
-		llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(mp[tmp->getName()])));
-		llvm::cast<llvm::Instruction>(tmp)->setMetadata("upper_data", Node);
-		// llvm::errs() << "mp[tmp->getName()] : " << mp[tmp->getName()] << '\n';
-		return tmp;
-	} else if (bin_expr->getOp() == "$") { // 注釈
-		assert(llvm::isa<VariableAST>(lhs) or llvm::isa<ArrayAST>(lhs) );
-		assert(llvm::isa<NumberAST>(rhs));
-		if (auto name = llvm::dyn_cast<VariableAST>(lhs)->getName(); decl_mp.count(name)) {
-			mp[llvm::dyn_cast<VariableAST>(lhs)->getName()] = llvm::dyn_cast<NumberAST>(rhs)->getNumberValue();
-			llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(mp[llvm::dyn_cast<VariableAST>(lhs)->getName()])));
-			llvm::cast<llvm::Instruction>(decl_mp[llvm::dyn_cast<VariableAST>(lhs)->getName()])->setMetadata("upper_data", Node);
-		} else if (decl_a_mp.count(name)) {
-			a_mp[llvm::dyn_cast<ArrayAST>(lhs)->getName()] = llvm::dyn_cast<NumberAST>(rhs)->getNumberValue();
-			llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(a_mp[llvm::dyn_cast<ArrayAST>(lhs)->getName()])));
-			llvm::cast<llvm::Instruction>(decl_a_mp[llvm::dyn_cast<ArrayAST>(lhs)->getName()])->setMetadata("upper_data", Node);
-		}
-		// lhs->UpdateUpper(rhs->getUpper());
-		// llvm::errs() << "$, mp[lhs_v->getName()] : " << mp[llvm::dyn_cast<VariableAST>(lhs)->getName()] << '\n';
 		return NULL;
-	} else if (bin_expr->getOp() == "inc") {
-		assert(llvm::isa<ArrayAST>(lhs));
-		assert(llvm::isa<NumberAST>(rhs));
-		auto name = llvm::dyn_cast<ArrayAST>(lhs)->getName();
+	}
+	case OP_INC: {
+		assert(lhs.getValueID() == ArrayID);
+		assert(rhs.getValueID() == NumberID);
+		LocalArray array = *LocalArrays.find(lhs.getSymbol());
+		// 注釈のない配列の上限は0とする
+		const llvm::ConstantRange* range = findRange(array.Ptr);
+		int64_t upper = range ? getUpper(*range) : 0;
+		// 添字は構文解析で[0, 要素数)に収まることを確かめてある
 		llvm::Value* idxList[2] = {
-			Builder->getInt32(0),
-			Builder->getInt32(llvm::dyn_cast<NumberAST>(rhs)->getNumberValue()),
+			Builder->getInt64(0),
+			Builder->getInt64(rhs.getNumberValue()),
 		};
-		llvm::Value* elemPtr = Builder->CreateGEP(llvm::ArrayType::get(llvm::Type::getInt64Ty(TheContext), a_siz[name]), decl_a_mp[name], idxList, "gep");
-		llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(a_mp[llvm::dyn_cast<ArrayAST>(lhs)->getName()])));
-		llvm::cast<llvm::Instruction>(elemPtr)->setMetadata("upper_data", Node);
-		auto t0 = Builder->CreateLoad(elemPtr, "t0");
-		auto add_tmp = Builder->CreateAdd(t0, llvm::ConstantInt::get(llvm::Type::getInt64Ty(TheContext), 1), "inc_add_tmp");
-		auto tmp = Builder->CreateStore(add_tmp, elemPtr, "inc_tmp");
-		llvm::MDNode* Node2 = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(1 + a_mp[llvm::dyn_cast<ArrayAST>(lhs)->getName()])));
-		llvm::cast<llvm::Instruction>(t0)->setMetadata("upper_data", Node);
-		llvm::cast<llvm::Instruction>(add_tmp)->setMetadata("upper_data", Node2);
-		llvm::cast<llvm::Instruction>(tmp)->setMetadata("upper_data", Node2);
+		llvm::Value* elemPtr = Builder->CreateGEP(array.Type, array.Ptr, idxList, "gep");
+		auto t0 = Builder->CreateLoad(array.Type->getElementType(), elemPtr, "t0");
+		auto add_tmp = Builder->CreateAdd(t0, llvm::ConstantInt::get(t0->getType(), 1), "inc_add_tmp");
+		auto tmp = Builder->CreateStore(add_tmp, elemPtr);
+		if (array.UpperData) {
+			setUpperData(llvm::cast<llvm::Instruction>(elemPtr), upper);
+			setUpperData(t0, upper);
+			setUpperData(llvm::cast<llvm::Instruction>(add_tmp), 1 + upper);
+			setUpperData(tmp, 1 + upper);
+		}
 		return tmp;
-	} else {
+	}
+	case OP_ASSIGN: {
+		// lhs is element
+		if (lhs.getValueID() == ElementID) {
+			llvm::Value* elem_ptr = generateElementPointer(node.getLHS());
+			rhs_v = castInt(generateExpression(node.getRHS()), LocalArrays.find(lhs.getSymbol())->Type->getElementType());
+			Builder->CreateStore(rhs_v, elem_ptr);
+			return rhs_v;
+		}
+		// lhs is variable
+		Symbol name = lhs.getSymbol();
+		if (llvm::AllocaInst** local_var = LocalVariables.find(name)) {
+			lhs_v = *local_var;
+		} else if (not DirectSSA) {
+			llvm::errs() << "Variable not found: " << lhs.getName() << "\n";
+		}
+		rhs_v = generateExpression(node.getRHS());
+		// 右辺の範囲が分からなければ変数の範囲はそのまま(一度も分かっていなければ上限0とする)
+		if (const llvm::ConstantRange* range = findOperandRange(node.getRHS(), rhs_v)) {
+			setVariableRange(name, *range);
+		} else if (rhs.getValueID() == NumberID) {
+			setVariableRange(name, makeConstantRange({rhs.getNumberValue(), rhs.getNumberValue()}));
+		} else if (not findVariableRange(name)) {
+			setVariableRange(name, makeConstantRange({INT64_MIN, 0}));
+		}
+		if (DirectSSA) {
+			rhs_v = castInt(rhs_v, getIntType(CurBody->getRange(bin_expr)));
+			writeVariable(name, Builder->GetInsertBlock(), rhs_v);
+			return rhs_v;
+		}
+		// store
+		auto tmp = Builder->CreateStore(castInt(rhs_v, llvm::cast<llvm::AllocaInst>(lhs_v)->getAllocatedType()), lhs_v);
+		setUpperData(tmp, getUpper(*findVariableRange(name)));
+		return tmp;
+	}
+	default:
+		break;
+	}
+
+	// 算術演算
+	// 上限値は、範囲が分かっていればその上限、分からなければ両辺の上限値から見積もる
+	// 両辺の範囲は、右辺で変数に代入しても変わらないよう、それぞれを生成した直後に見る
+	int64_t lval = INT32_MAX, rval = INT32_MAX;
+	lhs_v = generateExpression(node.getLHS());
+	if (const llvm::ConstantRange* lhs_range = findOperandRange(node.getLHS(), lhs_v)) {
+		lval = getUpper(*lhs_range);
+	} else if (lhs.getValueID() == NumberID) {
+		lval = lhs.getNumberValue();
+	}
+	rhs_v = generateExpression(node.getRHS());
+	ValueRange range = CurBody->getRange(bin_expr);
+	if (const llvm::ConstantRange* rhs_range = findOperandRange(node.getRHS(), rhs_v)) {
+		rval = getUpper(*rhs_range);
+	} else if (rhs.getValueID() == NumberID) {
+		rval = rhs.getNumberValue();
+	}
+	// 結果の範囲が収まる型で計算する
+	// 足し算・引き算・掛け算は、両辺を切り詰めても結果の下位ビットは同じなので、結果が収まれば正しい
+	// 割り算はそうならないので、両辺と結果の全てが収まる型で計算する
+	llvm::Type* type = getIntType(range);
+	if (op == OP_DIV) {
+		lhs_v = castInt(lhs_v, getIntType(CurBody->getRange(node.getLHS())));
+		rhs_v = castInt(rhs_v, getIntType(CurBody->getRange(node.getRHS())));
+		for (llvm::Value* v : {lhs_v, rhs_v}) {
+			if (v->getType()->getIntegerBitWidth() > type->getIntegerBitWidth()) {
+				type = v->getType();
+			}
+		}
+	}
+	lhs_v = castInt(lhs_v, type);
+	rhs_v = castInt(rhs_v, type);
+	llvm::Value* tmp;
+	int64_t upper;
+	switch (op) {
+	case OP_ADD: // add
+		tmp = Builder->CreateAdd(lhs_v, rhs_v, "add_tmp");
+		upper = lval + rval;
+		break;
+	case OP_SUB: // sub
+		tmp = Builder->CreateSub(lhs_v, rhs_v, "sub_tmp");
+		upper = lval - rval;
+		break;
+	case OP_MUL: // mul
+		tmp = Builder->CreateMul(lhs_v, rhs_v, "mul_tmp");
+		upper = lval * rval;
+		break;
+	case OP_DIV: // div
+		tmp = Builder->CreateSDiv(lhs_v, rhs_v, "div_tmp");
+		upper = lval;
+		break;
+	default:
 		return NULL;
 	}
+	// 両辺が定数だとIRBuilderが畳み込んで命令にならない(0での割り算など、簡約で残したもの)
+	if (llvm::Instruction* inst = llvm::dyn_cast<llvm::Instruction>(tmp)) {
+		if (not range.hasUpper()) {
+			range = {INT64_MIN, upper};
+		}
+		setRange(inst, makeConstantRange(range));
+		setUpperData(inst, range.Upper);
+	}
+	return tmp;
 }
 
 /*
  * 関数呼び出し(Call命令)生成メソッド
- * @param CallExprAST
+ * @param 関数呼び出しのノード
  * @return 生成したValueのポインタ
  */
-llvm::Value* CodeGen::generateCallExpression(CallExprAST* call_expr) {
+llvm::Value* CodeGen::generateCallExpression(NodeIndex call_expr) {
 	std::vector<llvm::Value*> arg_vec;
-	BaseAST* arg;
-	llvm::Value* arg_v;
-	for (int i = 0; ; i++) {
-		if (not (arg = call_expr->getArgs(i))) {
-			break;
+	for (int i = 0; i < CurBody->getArgNum(call_expr); i++) {
+		// 関数の引数・戻り値は常にi64
+		arg_vec.push_back(castInt(generateExpression(CurBody->getArg(call_expr, i)), Builder->getInt64Ty()));
+	}
+	const ExprNode& node = CurBody->getNode(call_expr);
+	llvm::Value* call = Builder->CreateCall(getCallee(node.getSymbol()), arg_vec, "call_tmp");
+	// 戻り値の範囲が分かっている関数なら、代入先に伝わるように範囲を記録する
+	// (Call命令にはupper_dataを付けない。DowncastPassは呼び出しの結果をi64のまま残すので、代入先のstoreとallocaの型が合わなくなる)
+	auto range = CalleeRanges.find(node.getSymbol());
+	if (range != CalleeRanges.end()) {
+		setRange(call, makeConstantRange(range->second));
+	}
+	narrowArguments(call_expr);
+	return call;
+}
+
+/*
+ * 引数の範囲が分かっている関数(インターフェースファイルから読んだもの)に渡した変数を、その範囲に狭める
+ * 簡約と同じく、for文の本文の中と、必ず範囲外の値を渡している場合は狭めない
+ * @param 関数呼び出しのノード
+ * @return 狭めた：true、狭めていない：false
+ */
+bool CodeGen::narrowArguments(NodeIndex call_expr) {
+	auto params = CalleeParamRanges.find(CurBody->getNode(call_expr).getSymbol());
+	if (params == CalleeParamRanges.end() or LoopDepth > 0) {
+		return false;
+	}
+	bool narrowed = false;
+	for (int i = 0; i < CurBody->getArgNum(call_expr) and i < (int)params->second.size(); i++) {
+		const ExprNode& arg = CurBody->getNode(CurBody->getArg(call_expr, i));
+		if (arg.getValueID() != VariableID or not params->second[i].hasUpper()) {
+			continue;
 		}
-		// isCall
-		if (llvm::isa<CallExprAST>(arg)) {
-			arg_v = generateCallExpression(llvm::dyn_cast<CallExprAST>(arg));
-		} else if (llvm::isa<BinaryExprAST>(arg)) { // isBinaryExpr
-			BinaryExprAST* bin_expr = llvm::dyn_cast<BinaryExprAST>(arg);
-			// 二項演算命令を生成
-			arg_v = generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(arg));
-			// 代入のときはLoad命令を追加
-			if (bin_expr->getOp() == "=") {
-				VariableAST* var = llvm::dyn_cast<VariableAST>(bin_expr->getLHS());
-
-				std::string varName = var->getName();
-				llvm::Value* local_var = NULL;
-				// llvm::Argument* arg = NULL;
-				for (llvm::BasicBlock& bb : *CurFunc) {
-					for (llvm::Instruction& i : bb) {
-						if (i.getName() == varName) {
-							local_var = &i;
-							break;
-						}
-					}
-					if (local_var) {
-						break;
-					}
-				}
-				arg_v = Builder->CreateLoad(local_var, "arg_val");
-			}
-		} else if (llvm::isa<VariableAST>(arg)) { // isVar
-			arg_v = generateVariable(llvm::dyn_cast<VariableAST>(arg));
-		} else if (llvm::isa<NumberAST>(arg)) { // isNumber
-			NumberAST* num = llvm::dyn_cast<NumberAST>(arg);
-			arg_v = generateNumber(num->getNumberValue());
+		llvm::ConstantRange range = makeConstantRange(params->second[i]);
+		if (const llvm::ConstantRange* var_range = findVariableRange(arg.getSymbol())) {
+			range = var_range->intersectWith(range, llvm::ConstantRange::Signed);
+		}
+		if (not range.isEmptySet()) {
+			setVariableRange(arg.getSymbol(), range);
+			narrowed = true;
 		}
-		arg_vec.push_back(arg_v);
 	}
-	return Builder->CreateCall(Mod->getFunction(call_expr->getCallee()), arg_vec, "call_tmp");
+	return narrowed;
 }
 
 /*
  * ジャンプ(今回はreturn命令のみ)生成メソッド
- * @param JumpStmtAST
+ * @param return文のノード
  * @return 生成したValueのポインタ
  */
-llvm::Value* CodeGen::generateJumpStatement(JumpStmtAST* jump_stmt) {
-	BaseAST* expr = jump_stmt->getExpr();
-	llvm::Value* ret_v;
-	if (llvm::isa<BinaryExprAST>(expr)) {
-		ret_v = generateBinaryExpression(llvm::dyn_cast<BinaryExprAST>(expr));
-	} else if (llvm::isa<VariableAST>(expr)) {
-		VariableAST* var = llvm::dyn_cast<VariableAST>(expr);
-		ret_v = generateVariable(var);
-	} else if (llvm::isa<NumberAST>(expr)) {
-		NumberAST* num = llvm::dyn_cast<NumberAST>(expr);
-		ret_v = generateNumber(num->getNumberValue());
+llvm::Value* CodeGen::generateJumpStatement(NodeIndex jump_stmt) {
+	NodeIndex expr = CurBody->getNode(jump_stmt).getExpr();
+	llvm::Value* ret_v = castInt(generateExpression(expr), Builder->getInt64Ty());
+	if (not HeapArrays.empty()) {
+		llvm::FunctionCallee free_func = Mod->getOrInsertFunction("free", Builder->getVoidTy(), Builder->getInt8PtrTy());
+		for (llvm::Value* mem : HeapArrays) {
+			Builder->CreateCall(free_func, {mem});
+		}
 	}
 	Builder->CreateRet(ret_v);
+	// 戻り値の範囲(return文が複数あれば合わせる)
+	// 呼び出し側で!rangeに使われるので、見積もりの上限ではなく簡約で求めた範囲だけを使う
+	ValueRange range = CurBody->getRange(expr);
+	if (CurReturned) {
+		range.Lower = std::min(range.Lower, CurResult.Lower);
+		range.Upper = std::max(range.Upper, CurResult.Upper);
+	}
+	CurResult = range;
+	CurReturned = true;
 	return ret_v; // 確かめる
 }
 
 /*
- * 変数参照(load命令)生成メソッド
- * @param VariableAST
- * @return 生成したValueのポインタ
+ * for文生成メソッド
+ * 入る前のブロックで初期値を代入して上限を一度だけ求め、条件(for_cond)・本文(for_body)・増分(for_inc)・出口(for_end)の
+ * ブロックを作る。増分のブロックは一つで、足し算はnswにする(標準形のループなので、LLVMのベクトル化・展開がそのままかかる)
+ * 変数に代入される値の上限が全て分かっていれば、`$`と同じく変数のallocaにupper_dataを付ける(DowncastPassが狭められる)
+ * DirectSSAでは、条件のブロックは増分のブロックからの分岐を生成してから封鎖する
+ * @param for文のノード
+ * @return 条件の比較
  */
-llvm::Value* CodeGen::generateVariable(VariableAST* var) {
-	std::string varName = var->getName();
-	llvm::Value* local_var = NULL;
-	// llvm::Argument* arg = NULL;
-	for (llvm::BasicBlock& bb : *CurFunc) {
-		for (llvm::Instruction& i : bb) {
-			if (i.getName() == varName) {
-				local_var = &i;
-				break;
-			}
+llvm::Value* CodeGen::generateLoopStatement(NodeIndex loop) {
+	const ExprNode& node = CurBody->getNode(loop);
+	Symbol var = CurBody->getNode(CurBody->getNode(node.getExpr()).getLHS()).getSymbol();
+	ValueRange range = CurBody->getRange(loop);
+	int64_t step = CurBody->getNode(CurBody->getLoopStep(loop)).getNumberValue();
+	generateBinaryExpression(node.getExpr());
+	llvm::Value* limit = generateExpression(CurBody->getLoopLimit(loop));
+	llvm::Type* type = getVariableType(var);
+	if (limit->getType()->getIntegerBitWidth() > type->getIntegerBitWidth()) {
+		type = limit->getType();
+	}
+	limit = castInt(limit, type);
+	llvm::AllocaInst** local_var = LocalVariables.find(var);
+	const ValueRange* assigned = AssignedRanges.find(var);
+	if (local_var and assigned and assigned->hasUpper() and not (*local_var)->getMetadata(UpperDataKind)) {
+		setUpperData(*local_var, assigned->Upper);
+	}
+
+	// 本文で代入する変数は繰り返しで範囲が変わるので、入る前の範囲を忘れ、抜けた後に本文の最後の範囲と合わせる
+	llvm::DenseMap<Symbol, llvm::Optional<llvm::ConstantRange>> outer;
+	std::vector<Symbol> vars = {var};
+	for (NodeIndex i = CurBody->getLoopBegin(loop); i < loop; i++) {
+		const ExprNode& assign = CurBody->getNode(i);
+		if (assign.getValueID() == BinaryExprID and assign.getOp() == OP_ASSIGN and CurBody->getNode(assign.getLHS()).getValueID() == VariableID) {
+			vars.push_back(CurBody->getNode(assign.getLHS()).getSymbol());
 		}
-		if (local_var) {
-			break;
+	}
+	for (Symbol v : vars) {
+		if (not outer.count(v)) {
+			const llvm::ConstantRange* before = findVariableRange(v);
+			outer.try_emplace(v, before ? llvm::Optional<llvm::ConstantRange>(*before) : llvm::None);
+			VariableRanges.erase(v);
+		}
+	}
+	if (not range.isUnknown()) {
+		setVariableRange(var, makeConstantRange(range));
+	}
+
+	// 条件
+	llvm::BasicBlock* cond_block = llvm::BasicBlock::Create(TheContext, "for_cond", CurFunc);
+	llvm::BasicBlock* body_block = llvm::BasicBlock::Create(TheContext, "for_body", CurFunc);
+	llvm::BasicBlock* end_block = llvm::BasicBlock::Create(TheContext, "for_end");
+	Builder->CreateBr(cond_block);
+	Builder->SetInsertPoint(cond_block);
+	llvm::Value* cond = Builder->CreateICmpSLT(castInt(generateVariable(var, range), type), limit, "for_cond_tmp");
+	Builder->CreateCondBr(cond, body_block, end_block);
+
+	// 本文
+	Builder->SetInsertPoint(body_block);
+	sealBlock(body_block);
+	LoopDepth++;
+	for (int i = 0; i < CurBody->getLoopStmtNum(loop); i++) {
+		NodeIndex stmt = CurBody->getLoopStmt(loop, i);
+		if (CurBody->getNode(stmt).getValueID() != NullExprID) {
+			generateStatement(stmt);
+		}
+	}
+	LoopDepth--;
+
+	// 増分
+	llvm::BasicBlock* inc_block = llvm::BasicBlock::Create(TheContext, "for_inc", CurFunc);
+	Builder->CreateBr(inc_block);
+	Builder->SetInsertPoint(inc_block);
+	sealBlock(inc_block);
+	llvm::Value* var_v = generateVariable(var, range);
+	llvm::Value* next = Builder->CreateNSWAdd(var_v, llvm::ConstantInt::get(var_v->getType(), step, true), "for_next");
+	if (range.hasUpper()) {
+		setRange(next, makeConstantRange(range));
+		setUpperData(llvm::cast<llvm::Instruction>(next), range.Upper);
+	}
+	if (DirectSSA) {
+		writeVariable(var, inc_block, next);
+	} else {
+		auto tmp = Builder->CreateStore(next, *local_var);
+		if (const llvm::ConstantRange* var_range = findVariableRange(var)) {
+			setUpperData(tmp, getUpper(*var_range));
 		}
 	}
-	if (local_var) {
-		auto tmp = Builder->CreateLoad(local_var, "var_tmp");
+	Builder->CreateBr(cond_block);
+	sealBlock(cond_block);
+
+	// 出口
+	end_block->insertInto(CurFunc);
+	Builder->SetInsertPoint(end_block);
+	sealBlock(end_block);
+	for (auto& [v, before] : outer) {
+		const llvm::ConstantRange* last = findVariableRange(v);
+		if (before and last) {
+			setVariableRange(v, before->unionWith(*last));
+		} else {
+			VariableRanges.erase(v);
+		}
+	}
+	return cond;
+}
+
+/*
+ * 変数参照(load命令)生成メソッド
+ * DirectSSAなら変数の現在の値を返す(Loadがないので!rangeは付かない)
+ * @param 変数のSymbol、簡約で求めた値の範囲
+ * @return 生成したValueのポインタ
+ */
+llvm::Value* CodeGen::generateVariable(Symbol var, ValueRange range) {
+	if (DirectSSA) {
+		return readVariable(var, Builder->GetInsertBlock());
+	}
+	if (llvm::AllocaInst** found = LocalVariables.find(var)) {
+		llvm::AllocaInst* local_var = *found;
+		auto tmp = Builder->CreateLoad(local_var->getAllocatedType(), local_var, "var_tmp");
 		// llvm::errs() << local_var->getName() << '\n';
 		// llvm::errs() << tmp->getName() << '\n';
-		if (mp.count(local_var->getName())) {
-			// llvm::errs() << "hoge" << '\n';
-			// llvm::errs() << mp[local_var->getName()] << '\n';
-			mp[tmp->getName()] = mp[local_var->getName()];
-			llvm::MDNode* Node = llvm::MDNode::get(TheContext, llvm::MDString::get(TheContext, std::to_string(mp[tmp->getName()])));
-			llvm::cast<llvm::Instruction>(tmp)->setMetadata("upper_data", Node);
+		if (const llvm::ConstantRange* var_range = findVariableRange(var)) {
+			int64_t upper = getUpper(*var_range);
+			setRange(tmp, *var_range);
+			setUpperData(tmp, upper);
 		}
+		setLoadRange(tmp, range);
 		return tmp;
 	} else {
 		assert(0);
 	}
 }
 
+/*
+ * 配列の要素のアドレス(inbounds getelementptr)生成メソッド
+ * 添字の範囲(`$`の上限と定数畳み込みから簡約で求めたもの)が配列の大きさに収まると分からなければ、
+ * 範囲外なら止める検査(符号なし比較一つと分岐)を前に置き、以降は範囲内のブロックで生成する
+ * @param 配列の要素のノード
+ * @return 要素のアドレス
+ */
+llvm::Value* CodeGen::generateElementPointer(NodeIndex element) {
+	const ExprNode& node = CurBody->getNode(element);
+	LocalArray array = *LocalArrays.find(node.getSymbol());
+	uint64_t size = array.Type->getNumElements();
+	llvm::Value* index = castInt(generateExpression(node.getIndex()), Builder->getInt64Ty());
+	ValueRange range = CurBody->getRange(node.getIndex());
+	if (BoundsCheck and not (range.Lower >= 0 and (uint64_t)range.Upper < size)) {
+		llvm::Value* in_bounds = Builder->CreateICmpULT(index, Builder->getInt64(size), "bounds_tmp");
+		generateTrapUnless(in_bounds, "bounds_ok");
+	}
+	llvm::Value* idxList[2] = {
+		Builder->getInt64(0),
+		index,
+	};
+	return Builder->CreateInBoundsGEP(array.Type, array.Ptr, idxList, "elem_ptr");
+}
+
+/*
+ * 条件が成り立たなければ止める分岐を生成するメソッド
+ * 止めるブロック(llvm.trap)は関数ごとに一つで、分岐には条件が成り立ちやすいという重みを付ける
+ * 以降は条件が成り立つブロックで生成する
+ * @param 条件、成り立つ場合のブロックの名前
+ * @return true
+ */
+bool CodeGen::generateTrapUnless(llvm::Value* cond, const char* ok_name) {
+	if (not BoundsFailBlock) {
+		BoundsFailBlock = llvm::BasicBlock::Create(TheContext, "bounds_fail", CurFunc);
+		llvm::IRBuilder<> fail_builder(BoundsFailBlock);
+		fail_builder.CreateCall(llvm::Intrinsic::getDeclaration(Mod, llvm::Intrinsic::trap));
+		fail_builder.CreateUnreachable();
+	}
+	llvm::BasicBlock* ok_block = llvm::BasicBlock::Create(TheContext, ok_name, CurFunc);
+	Builder->CreateCondBr(cond, ok_block, BoundsFailBlock, llvm::MDBuilder(TheContext).createBranchWeights(1 << 20, 1));
+	Builder->SetInsertPoint(ok_block);
+	sealBlock(ok_block); // 先行ブロックは検査したブロックだけ
+	return true;
+}
+
+/*
+ * 上限値の注釈(upper_data)を付ける
+ * 注釈は上限の整数を一つ持つMDNodeで、同じ上限のものは使い回す
+ * @param 命令、上限
+ * @return true
+ */
+bool CodeGen::setUpperData(llvm::Instruction* inst, int64_t upper) {
+	llvm::MDNode*& node = UpperNodes[upper];
+	if (not node) {
+		node = llvm::MDNode::get(TheContext, llvm::ConstantAsMetadata::get(Builder->getInt64(upper)));
+	}
+	inst->setMetadata(UpperDataKind, node);
+	return true;
+}
+
+/*
+ * Load命令に値の範囲(!range)を付ける
+ * 範囲は簡約で求めたもの(`$`の上限と、インターフェースファイルの戻り値の範囲は成り立つものとする)
+ * Narrowでは範囲がLoadの型より広いことがある(型は代入した値の範囲で決まる)ので、型の符号付きの範囲と重なる部分だけを書く
+ * 型と同じ幅のAPIntで書く。同じ範囲のMDNodeは使い回す
+ * @param Load命令、範囲
+ * @return 付けた：true、範囲が分からない(型の全体)か型と重ならない：false
+ */
+bool CodeGen::setLoadRange(llvm::LoadInst* load, ValueRange range) {
+	unsigned width = load->getType()->getIntegerBitWidth();
+	range.Lower = std::max(range.Lower, llvm::APInt::getSignedMinValue(width).getSExtValue());
+	range.Upper = std::min(range.Upper, llvm::APInt::getSignedMaxValue(width).getSExtValue());
+	if (range.Lower > range.Upper) {
+		return false;
+	}
+	llvm::APInt lower(width, range.Lower, true), upper(width, range.Upper, true);
+	if (lower == upper + 1) {
+		return false;
+	}
+	llvm::MDNode*& node = RangeNodes[{width, range.Lower, range.Upper}];
+	if (not node) {
+		node = llvm::MDBuilder(TheContext).createRange(lower, upper + 1);
+	}
+	load->setMetadata(llvm::LLVMContext::MD_range, node);
+	return true;
+}
+
+/*
+ * 値の範囲を記録する
+ * 表の中の範囲を渡してもよいよう、値で受け取ってから挿入する
+ * @param 値(配列はalloca) 範囲
+ * @return true
+ */
+bool CodeGen::setRange(llvm::Value* v, llvm::ConstantRange range) {
+	auto result = ValueRanges.try_emplace(v, range);
+	if (not result.second) {
+		result.first->second = range;
+	}
+	return true;
+}
+
+/*
+ * 値の範囲を取得する
+ * @param 値(配列はalloca)
+ * @return 範囲、記録がなければNULL(表に挿入すると無効になる)
+ */
+const llvm::ConstantRange* CodeGen::findRange(llvm::Value* v) {
+	auto iter = ValueRanges.find(v);
+	return iter == ValueRanges.end() ? NULL : &iter->second;
+}
+
+/*
+ * 変数の範囲を記録する
+ * @param 変数 範囲
+ * @return true
+ */
+bool CodeGen::setVariableRange(Symbol var, llvm::ConstantRange range) {
+	auto result = VariableRanges.try_emplace(var, range);
+	if (not result.second) {
+		result.first->second = range;
+	}
+	return true;
+}
+
+/*
+ * 変数の範囲を取得する
+ * @param 変数
+ * @return 範囲、記録がなければNULL(表に挿入すると無効になる)
+ */
+const llvm::ConstantRange* CodeGen::findVariableRange(Symbol var) {
+	auto iter = VariableRanges.find(var);
+	return iter == VariableRanges.end() ? NULL : &iter->second;
+}
+
+/*
+ * 式の値の範囲を取得する
+ * 変数を読んだ値は、その時点の変数の範囲とする
+ * (DirectSSAでは別の変数と同じValueを共有しうるので、Valueの範囲ではなく変数の範囲を見る)
+ * @param 式のノード、生成したValue
+ * @return 範囲、記録がなければNULL(表に挿入すると無効になる)
+ */
+const llvm::ConstantRange* CodeGen::findOperandRange(NodeIndex expr, llvm::Value* v) {
+	const ExprNode& node = CurBody->getNode(expr);
+	if (node.getValueID() == VariableID) {
+		return findVariableRange(node.getSymbol());
+	}
+	return findRange(v);
+}
+
+/*
+ * 変数に値を定義する(DirectSSA)
+ * @param 変数、定義する基本ブロック、値
+ * @return true
+ */
+bool CodeGen::writeVariable(Symbol var, llvm::BasicBlock* block, llvm::Value* value) {
+	CurrentDefs[block].set(var, value);
+	return true;
+}
+
+/*
+ * 変数の現在の値を取得する(DirectSSA)
+ * ブロック内に定義があればそれを、なければ先行ブロックから探す
+ * @param 変数、読む基本ブロック
+ * @return 値
+ */
+llvm::Value* CodeGen::readVariable(Symbol var, llvm::BasicBlock* block) {
+	if (llvm::WeakTrackingVH* def = CurrentDefs[block].find(var); def and *def) {
+		return *def;
+	}
+	return readVariableRecursive(var, block);
+}
+
+/*
+ * ブロック内に定義のない変数の値を先行ブロックから求める(Braun et al.のreadVariableRecursive)
+ * 1. 未封鎖のブロックなら、先行ブロックが揃うまで空のphiを置いておく
+ * 2. 先行ブロックが一つならその値
+ * 3. 先行ブロックがなければ(入口で代入していない局所変数)undef
+ * 4. 複数ならphiを置く(循環しても止まるよう、先にphiを定義にしてから先行ブロックを読む)
+ * @param 変数、読む基本ブロック
+ * @return 値
+ */
+llvm::Value* CodeGen::readVariableRecursive(Symbol var, llvm::BasicBlock* block) {
+	llvm::Value* value;
+	if (not SealedBlocks.count(block)) {
+		llvm::PHINode* phi = llvm::PHINode::Create(getVariableType(var), 0, getSymbolRef(var));
+		block->getInstList().push_front(phi);
+		IncompletePhis[block].push_back({var, phi});
+		value = phi;
+	} else if (llvm::BasicBlock* pred = block->getSinglePredecessor()) {
+		value = readVariable(var, pred);
+	} else if (llvm::pred_empty(block)) {
+		value = llvm::UndefValue::get(getVariableType(var));
+	} else {
+		llvm::PHINode* phi = llvm::PHINode::Create(getVariableType(var), 0, getSymbolRef(var));
+		block->getInstList().push_front(phi);
+		writeVariable(var, block, phi);
+		value = addPhiOperands(var, phi);
+	}
+	writeVariable(var, block, value);
+	return value;
+}
+
+/*
+ * phiに先行ブロックごとの変数の値を入れる
+ * @param 変数、phi
+ * @return phi(不要なphiだった場合は置き換えた値)
+ */
+llvm::Value* CodeGen::addPhiOperands(Symbol var, llvm::PHINode* phi) {
+	for (llvm::BasicBlock* pred : llvm::predecessors(phi->getParent())) {
+		llvm::Value* value = readVariable(var, pred);
+		if (value->getType() != phi->getType()) { // 変数の型より狭い値は、先行ブロックの末尾で広げる
+			value = llvm::IRBuilder<>(pred->getTerminator()).CreateSExt(value, phi->getType(), "sext_tmp");
+		}
+		phi->addIncoming(value, pred);
+	}
+	return tryRemoveTrivialPhi(phi);
+}
+
+/*
+ * 自分以外に一つの値しか取らないphiを消して、その値に置き換える
+ * 消したphiを使っていたphiも不要になりうるので、続けて調べる
+ * @param phi
+ * @return 置き換えた値、必要なphiならphi
+ */
+llvm::Value* CodeGen::tryRemoveTrivialPhi(llvm::PHINode* phi) {
+	llvm::Value* same = NULL;
+	for (llvm::Value* op : phi->incoming_values()) {
+		if (op == same or op == phi) {
+			continue;
+		} else if (same) {
+			return phi;
+		}
+		same = op;
+	}
+	if (not same) { // 到達しないか、入口で代入していない
+		same = llvm::UndefValue::get(phi->getType());
+	}
+	// 続けて消すphiに置き換え先が含まれていても追従できるよう、ハンドルで持つ
+	llvm::SmallVector<llvm::WeakVH, 4> users;
+	for (llvm::User* user : phi->users()) {
+		if (user != phi and llvm::isa<llvm::PHINode>(user)) {
+			users.push_back(user);
+		}
+	}
+	llvm::WeakTrackingVH result = same;
+	phi->replaceAllUsesWith(same);
+	ValueRanges.erase(phi);
+	phi->eraseFromParent();
+	for (llvm::WeakVH& user : users) {
+		if (llvm::PHINode* user_phi = llvm::dyn_cast_or_null<llvm::PHINode>(user)) {
+			tryRemoveTrivialPhi(user_phi);
+		}
+	}
+	return result;
+}
+
+/*
+ * 先行ブロックが全て決まったブロックを封鎖し、置いておいたphiを埋める
+ * (ブロックへの分岐を全て生成してから呼ぶ)
+ * @param 基本ブロック
+ * @return true
+ */
+bool CodeGen::sealBlock(llvm::BasicBlock* block) {
+	std::vector<std::pair<Symbol, llvm::PHINode*>> phis;
+	auto iter = IncompletePhis.find(block);
+	if (iter != IncompletePhis.end()) {
+		phis.swap(iter->second);
+		IncompletePhis.erase(iter);
+	}
+	for (auto& [var, phi] : phis) {
+		addPhiOperands(var, phi);
+	}
+	SealedBlocks.insert(block);
+	return true;
+}
+
+/*
+ * 呼び出し先のFunctionを取得する
+ * Moduleの名前表を毎回引かないよう、一度引いたものは覚えておく
+ * @param 関数名のSymbol
+ * @return Function、なければNULL
+ */
+llvm::Function* CodeGen::getCallee(Symbol name) {
+	if (llvm::Function** func = Callees.find(name)) {
+		return *func;
+	}
+	llvm::Function* func = Mod->getFunction(getSymbolRef(name));
+	if (func) {
+		Callees.set(name, func);
+	}
+	return func;
+}
+
 llvm::Value* CodeGen::generateNumber(int64_t value) {
 	return llvm::ConstantInt::get(llvm::Type::getInt64Ty(TheContext), value);
 }
+
+/*
+ * 範囲が収まる最も狭い整数型を取得する(Narrowでなければ常にi64)
+ * @param 範囲
+ * @return i16, i32, i64のいずれか
+ */
+llvm::IntegerType* CodeGen::getIntType(ValueRange range) {
+	if (Narrow and INT16_MIN <= range.Lower and range.Upper <= INT16_MAX) {
+		return Builder->getInt16Ty();
+	} else if (Narrow and INT32_MIN <= range.Lower and range.Upper <= INT32_MAX) {
+		return Builder->getInt32Ty();
+	}
+	return Builder->getInt64Ty();
+}
+
+/*
+ * 変数の型を取得する
+ * 代入される値を合わせた範囲が収まる型(引数と、一度も代入しない変数はi64)
+ * @param 変数
+ * @return 型
+ */
+llvm::IntegerType* CodeGen::getVariableType(Symbol var) {
+	const ValueRange* range = AssignedRanges.find(var);
+	return range ? getIntType(*range) : Builder->getInt64Ty();
+}
+
+/*
+ * 整数を別の幅の整数型にする
+ * 狭める場合は、値がその型に収まっている(か、下位ビットだけを使う)ものとする
+ * @param 値、型
+ * @return 変換した値(同じ型ならそのまま)
+ */
+llvm::Value* CodeGen::castInt(llvm::Value* v, llvm::Type* type) {
+	if (v->getType() == type) {
+		return v;
+	} else if (v->getType()->getIntegerBitWidth() > type->getIntegerBitWidth()) {
+		return Builder->CreateTrunc(v, type, "trunc_tmp");
+	}
+	return Builder->CreateSExt(v, type, "sext_tmp");
+}
 bool CodeGen::linkModule(llvm::Module* dest, std::string file_name) {
 	// TODO
 	return false;
@@ -12,10 +12,17 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 
+#include <chrono>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "lexer.hpp"
 #include "AST.hpp"
 #include "parser.hpp"
+#include "simplify.hpp"
 #include "codegen.hpp"
+#include "interface.hpp"
 
 /*
  * オプション切り出し用クラス
@@ -25,16 +32,44 @@ private:
 	std::string InputFileName;
 	std::string OutputFileName;
 	std::string LinkFileName;
+	std::string InterfaceFileName;
+	std::vector<std::string> ImportFileNames;
 	bool WithJit;
+	int StreamWindow;
+	int LexThreads;
+	int ParseThreads;
+	bool Watch;
+	bool Simplify;
+	bool StreamCodeGen;
+	bool StreamOutput;
+	bool DirectSSA;
+	bool Narrow;
+	long ArrayStackLimit;
+	ArrayPlacement LargeArrays;
+	bool BoundsCheck;
 	int Argc;
 	char** Argv;
 public:
-	OptionParser(int argc, char** argv) : Argc(argc), Argv(argv), WithJit(false) {}
+	OptionParser(int argc, char** argv) : Argc(argc), Argv(argv), WithJit(false), StreamWindow(0), LexThreads(1), ParseThreads(1), Watch(false), Simplify(true), StreamCodeGen(false), StreamOutput(false), DirectSSA(false), Narrow(false), ArrayStackLimit(64 * 1024), LargeArrays(ArrayOnHeap), BoundsCheck(true) {}
 	void printHelp();
 	std::string getInputFileName() { return InputFileName; }
 	std::string getOutputFileName() { return OutputFileName; }
 	std::string getLinkFilieName() { return LinkFileName; }
+	std::string getInterfaceFileName() { return InterfaceFileName; }
+	const std::vector<std::string>& getImportFileNames() { return ImportFileNames; }
 	bool getWithJit() { return WithJit; }
+	int getStreamWindow() { return StreamWindow; }
+	int getLexThreads() { return LexThreads; }
+	int getParseThreads() { return ParseThreads; }
+	bool getWatch() { return Watch; }
+	bool getSimplify() { return Simplify; }
+	bool getStreamCodeGen() { return StreamCodeGen; }
+	bool getStreamOutput() { return StreamOutput; }
+	bool getDirectSSA() { return DirectSSA; }
+	bool getNarrow() { return Narrow; }
+	long getArrayStackLimit() { return ArrayStackLimit; }
+	ArrayPlacement getLargeArrays() { return LargeArrays; }
+	bool getBoundsCheck() { return BoundsCheck; }
 	bool parseOption();
 };
 
@@ -43,6 +78,24 @@ public:
  */
 void OptionParser::printHelp() {
 	fprintf(stdout, "Compiler for DummyC...\n");
+	fprintf(stdout, "usage: dcc [options] <file.dc | ->\n");
+	fprintf(stdout, "  -o <file>            output file\n");
+	fprintf(stdout, "  -stream              lex on demand (default window: 4096 tokens)\n");
+	fprintf(stdout, "  -stream-window <n>   lex on demand, keeping the last n tokens\n");
+	fprintf(stdout, "  -lex-kernel <name>   character classification kernel: auto, scalar, sse42, avx2\n");
+	fprintf(stdout, "  -lex-threads <n>     lex large inputs on n threads (0: number of CPUs)\n");
+	fprintf(stdout, "  -parse-threads <n>   parse function bodies of large inputs on n threads (0: number of CPUs)\n");
+	fprintf(stdout, "  -watch               recompile whenever the input changes, regenerating only changed functions\n");
+	fprintf(stdout, "  -emit-interface <file> write the defined functions and their ranges to an interface file\n");
+	fprintf(stdout, "  -import <file>       declare the functions of an interface file (can be repeated)\n");
+	fprintf(stdout, "  -no-simplify         skip constant folding and range propagation on the AST\n");
+	fprintf(stdout, "  -stream-codegen      generate each function as soon as it is parsed and free its AST (parses serially)\n");
+	fprintf(stdout, "  -stream-output       like -stream-codegen, and also write each function out and drop its body\n");
+	fprintf(stdout, "  -direct-ssa          keep variables in SSA registers instead of alloca/load/store\n");
+	fprintf(stdout, "  -narrow              emit i16/i32 variables, arrays and temporaries when their ranges fit\n");
+	fprintf(stdout, "  -array-stack-limit <bytes> put larger arrays in -large-arrays storage instead of the stack (default 65536)\n");
+	fprintf(stdout, "  -large-arrays <where> storage for large arrays: heap (calloc/free, default), global (zeroed static, not reentrant)\n");
+	fprintf(stdout, "  -no-bounds-check     do not check a[i] indices that are not known to be in range\n");
 }
 
 /*
@@ -68,6 +121,68 @@ bool OptionParser::parseOption() {
 			Argv[i][3] == 't' and
 			Argv[i][4] == '\0') {
 			WithJit = true;
+		} else if (strcmp(Argv[i], "-stream") == 0) {
+			StreamWindow = 4096;
+		} else if (strcmp(Argv[i], "-stream-window") == 0 and i + 1 < Argc) {
+			StreamWindow = atoi(Argv[++i]);
+			if (StreamWindow < 2) {
+				fprintf(stderr, "-stream-window には2以上を指定してください\n");
+				return false;
+			}
+		} else if (strcmp(Argv[i], "-lex-kernel") == 0 and i + 1 < Argc) {
+			if (not setLexKernel(Argv[++i])) {
+				fprintf(stderr, "-lex-kernel %s はこのCPUでは使えません\n", Argv[i]);
+				return false;
+			}
+		} else if (strcmp(Argv[i], "-lex-threads") == 0 and i + 1 < Argc) {
+			LexThreads = atoi(Argv[++i]);
+			if (LexThreads < 0) {
+				fprintf(stderr, "-lex-threads には0以上を指定してください\n");
+				return false;
+			}
+		} else if (strcmp(Argv[i], "-parse-threads") == 0 and i + 1 < Argc) {
+			ParseThreads = atoi(Argv[++i]);
+			if (ParseThreads < 0) {
+				fprintf(stderr, "-parse-threads には0以上を指定してください\n");
+				return false;
+			}
+		} else if (strcmp(Argv[i], "-watch") == 0 or strcmp(Argv[i], "--watch") == 0) {
+			Watch = true;
+		} else if (strcmp(Argv[i], "-emit-interface") == 0 and i + 1 < Argc) {
+			InterfaceFileName.assign(Argv[++i]);
+		} else if (strcmp(Argv[i], "-import") == 0 and i + 1 < Argc) {
+			ImportFileNames.push_back(Argv[++i]);
+		} else if (strcmp(Argv[i], "-no-simplify") == 0) {
+			Simplify = false;
+		} else if (strcmp(Argv[i], "-stream-codegen") == 0) {
+			StreamCodeGen = true;
+		} else if (strcmp(Argv[i], "-stream-output") == 0) {
+			StreamCodeGen = true;
+			StreamOutput = true;
+		} else if (strcmp(Argv[i], "-direct-ssa") == 0) {
+			DirectSSA = true;
+		} else if (strcmp(Argv[i], "-narrow") == 0) {
+			Narrow = true;
+		} else if (strcmp(Argv[i], "-array-stack-limit") == 0 and i + 1 < Argc) {
+			ArrayStackLimit = atol(Argv[++i]);
+			if (ArrayStackLimit < 0) {
+				fprintf(stderr, "-array-stack-limit には0以上を指定してください\n");
+				return false;
+			}
+		} else if (strcmp(Argv[i], "-large-arrays") == 0 and i + 1 < Argc) {
+			i++;
+			if (strcmp(Argv[i], "heap") == 0) {
+				LargeArrays = ArrayOnHeap;
+			} else if (strcmp(Argv[i], "global") == 0) {
+				LargeArrays = ArrayInGlobal;
+			} else {
+				fprintf(stderr, "-large-arrays には heap か global を指定してください\n");
+				return false;
+			}
+		} else if (strcmp(Argv[i], "-no-bounds-check") == 0) {
+			BoundsCheck = false;
+		} else if (Argv[i][0] == '-' and Argv[i][1] == '\0') { // 標準入力
+			InputFileName.assign(Argv[i]);
 		} else if (Argv[i][0] == '-') { 
 			fprintf(stderr, "%s は不明なオプションです\n", Argv[i]);
 			return false;
@@ -78,7 +193,9 @@ bool OptionParser::parseOption() {
 	// OutputFileName
 	std::string ifn = InputFileName;
 	int len = ifn.length();
-	if (OutputFileName.empty() and (len > 2) and
+	if (OutputFileName.empty() and ifn == "-") { // 標準入力なら標準出力へ
+		OutputFileName = "-";
+	} else if (OutputFileName.empty() and (len > 2) and
 		ifn[len - 3] == '.' and
 		ifn[len - 2] == 'd' and
 		ifn[len - 1] == 'c') {
@@ -88,9 +205,206 @@ bool OptionParser::parseOption() {
 		OutputFileName = ifn;
 		OutputFileName += ".s";
 	}
+	if (Watch and (ifn == "-" or StreamWindow)) {
+		fprintf(stderr, "-watch は通常のファイルの入力でのみ使えます\n");
+		return false;
+	}
+	if (Watch and StreamCodeGen) {
+		fprintf(stderr, "-watch と -stream-codegen は同時に使えません\n");
+		return false;
+	}
+	if (Watch and not InterfaceFileName.empty()) {
+		fprintf(stderr, "-watch と -emit-interface は同時に使えません\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * オプションに合わせたCodeGenを作る
+ * @param オプション
+ * @return CodeGen
+ */
+static CodeGen* createCodeGen(OptionParser& opt) {
+	CodeGen* codegen = new CodeGen();
+	codegen->setDirectSSA(opt.getDirectSSA());
+	codegen->setNarrow(opt.getNarrow());
+	codegen->setArrayPlacement(opt.getArrayStackLimit(), opt.getLargeArrays());
+	codegen->setBoundsCheck(opt.getBoundsCheck());
+	return codegen;
+}
+
+/*
+ * Moduleをファイルに出力する
+ * @param Module 出力ファイル名
+ * @return 成功：true、失敗：false
+ */
+static bool writeModule(llvm::Module& mod, const std::string& file_name) {
+	llvm::legacy::PassManager pm;
+
+	// mem2regを適用
+	// pm.add(llvm::createPromoteMemoryToRegisterPass());
+
+	// 出力
+	std::error_code error;
+	llvm::raw_fd_ostream raw_stream(llvm::StringRef(file_name.c_str()), error);
+	if (error) {
+		fprintf(stderr, "%s に書き込めません\n", file_name.c_str());
+		return false;
+	}
+	pm.add(llvm::createPrintModulePass(raw_stream));
+	pm.run(mod);
+	raw_stream.close();
+	return true;
+}
+
+/*
+ * 構文解析した関数をその場で簡約・コード生成する受け手
+ */
+class StreamingCodeGen : public FunctionConsumer {
+private:
+	CodeGen* Gen;
+	Simplifier* Simp; // NULLなら簡約しない
+	bool Failed;
+public:
+	StreamingCodeGen(CodeGen* gen, Simplifier* simp) : Gen(gen), Simp(simp), Failed(false) {}
+	bool hasFailed() { return Failed; }
+	bool consumePrototype(PrototypeAST* proto) override {
+		if (Simp) {
+			Simp->addPrototype(proto);
+		}
+		Failed = not Gen->addPrototype(proto);
+		return not Failed;
+	}
+	bool consumeFunction(FunctionAST* func, Arena& arena) override {
+		if (Simp) {
+			Simp->simplifyFunction(func->getBody(), arena);
+		}
+		Failed = not Gen->addFunction(func);
+		return not Failed;
+	}
+};
+
+/*
+ * 構文解析しながら関数ごとにコード生成して出力する(-stream-codegen、-stream-output)
+ * 関数本文のASTはコード生成した直後に解放する
+ * -stream-outputでは生成した関数もその場で書き出して捨てる(失敗したら書きかけの出力ファイルを消す)
+ * @param オプション、インターフェースを追加したParser
+ * @return 成功：true、失敗：false
+ */
+static bool compileStreaming(OptionParser& opt, Parser* parser) {
+	llvm::raw_fd_ostream* out = NULL;
+	if (opt.getStreamOutput()) {
+		std::error_code error;
+		out = new llvm::raw_fd_ostream(opt.getOutputFileName(), error);
+		if (error) {
+			fprintf(stderr, "%s に書き込めません\n", opt.getOutputFileName().c_str());
+			SAFE_DELETE(out);
+			return false;
+		}
+	}
+	CodeGen* codegen = createCodeGen(opt);
+	Simplifier simplifier;
+	StreamingCodeGen consumer(codegen, opt.getSimplify() ? &simplifier : NULL);
+	codegen->startModule(opt.getInputFileName(), out);
+	parser->setFunctionConsumer(&consumer);
+	bool ok = parser->doParse();
+	if (not ok) {
+		fprintf(stderr, consumer.hasFailed() ? "err at codegen\n" : "err at parser or lexer\n");
+	}
+	ok = ok and codegen->finishModule(parser->getAST()) and
+		(out or writeModule(codegen->getModule(), opt.getOutputFileName())) and
+		(opt.getInterfaceFileName().empty() or ModuleInterface::write(opt.getInterfaceFileName(), parser->getAST()));
+	SAFE_DELETE(out);
+	if (not ok and opt.getStreamOutput() and opt.getOutputFileName() != "-") {
+		remove(opt.getOutputFileName().c_str());
+	}
+	SAFE_DELETE(codegen);
+	return ok;
+}
+
+/*
+ * 入力ファイルを差分コンパイルして出力する
+ * cacheとcodegenは前回の結果を持ち越し、変わった関数定義だけを解析・生成し直す
+ * コード生成に失敗したら、前回の結果を捨てて全体をコンパイルし直す
+ * @param オプション、読み込んだインターフェース、前回の解析結果、前回のコード生成結果
+ * @return 成功：true、失敗：false
+ */
+static bool compileIncremental(OptionParser& opt, const std::vector<ModuleInterface*>& imports, FunctionCache& cache, CodeGen*& codegen) {
+	auto start = std::chrono::steady_clock::now();
+	TokenStream* tokens;
+	if (opt.getLexThreads() != 1) {
+		tokens = ParallelLexicalAnalysis(opt.getInputFileName(), opt.getLexThreads());
+	} else {
+		tokens = LexicalAnalysis(opt.getInputFileName());
+	}
+	Parser* parser = new Parser(tokens);
+	parser->setThreads(opt.getParseThreads());
+	parser->setFunctionCache(&cache);
+	for (ModuleInterface* iface : imports) {
+		parser->addImport(iface);
+	}
+	if (not parser->doParse()) {
+		fprintf(stderr, "err at parser or lexer\n");
+		SAFE_DELETE(parser);
+		return false;
+	}
+	TranslationUnitAST& t_unit = parser->getAST();
+	if (opt.getSimplify()) {
+		Simplifier().doSimplify(t_unit);
+	}
+	int func_num = 0, regenerated = 0;
+	for (int i = 0; FunctionAST* func = t_unit.getFunction(i); i++) {
+		func_num++;
+		regenerated += func->getBody() ? 1 : 0;
+	}
+	if (not codegen->doIncrementalCodeGen(t_unit, opt.getInputFileName())) {
+		SAFE_DELETE(parser);
+		SAFE_DELETE(codegen);
+		codegen = createCodeGen(opt);
+		if (cache.size()) { // 前回の結果が使えなかったので全体をやり直す
+			cache.clear();
+			return compileIncremental(opt, imports, cache, codegen);
+		}
+		cache.clear();
+		fprintf(stderr, "err at codegen\n");
+		return false;
+	}
+	SAFE_DELETE(parser);
+	if (not writeModule(codegen->getModule(), opt.getOutputFileName())) {
+		return false;
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%s: %d/%d functions regenerated (%.1f ms)\n", opt.getInputFileName().c_str(), regenerated, func_num, ms);
 	return true;
 }
 
+/*
+ * 入力ファイルの更新を待ってはコンパイルし直す(終了はCtrl-Cで)
+ * 更新はファイルの更新時刻と大きさを一定間隔で調べて検出する
+ * @param オプション、読み込んだインターフェース
+ * @return 終了コード
+ */
+static int watchFile(OptionParser& opt, const std::vector<ModuleInterface*>& imports) {
+	FunctionCache cache;
+	CodeGen* codegen = createCodeGen(opt);
+	struct stat last = {};
+	bool first = true;
+	while (true) {
+		struct stat st;
+		if (stat(opt.getInputFileName().c_str(), &st) == 0 and (first or
+			st.st_mtim.tv_sec != last.st_mtim.tv_sec or st.st_mtim.tv_nsec != last.st_mtim.tv_nsec or
+			st.st_size != last.st_size or st.st_ino != last.st_ino)) {
+			first = false;
+			last = st;
+			compileIncremental(opt, imports, cache, codegen);
+		}
+		usleep(100 * 1000);
+	}
+	SAFE_DELETE(codegen);
+	return 0;
+}
+
 /*
  * main関数
  */
@@ -112,9 +426,40 @@ int main(int argc, char** argv)
 		fprintf(stderr, "入力ファイル名が指定されていません\n");
 		exit(1);
 	}
+	std::vector<ModuleInterface*> imports;
+	for (const std::string& file_name : opt.getImportFileNames()) {
+		ModuleInterface* iface = ModuleInterface::load(file_name);
+		if (not iface) {
+			exit(1);
+		}
+		imports.push_back(iface);
+	}
+	if (opt.getWatch()) {
+		return watchFile(opt, imports);
+	}
 
 	// lex and parse
-	Parser* parser = new Parser(opt.getInputFileName());
+	TokenStream* tokens;
+	if (opt.getStreamWindow()) {
+		tokens = StreamingLexicalAnalysis(opt.getInputFileName(), opt.getStreamWindow());
+	} else if (opt.getLexThreads() != 1) {
+		tokens = ParallelLexicalAnalysis(opt.getInputFileName(), opt.getLexThreads());
+	} else {
+		tokens = LexicalAnalysis(opt.getInputFileName());
+	}
+	Parser* parser = new Parser(tokens);
+	parser->setThreads(opt.getParseThreads());
+	for (ModuleInterface* iface : imports) {
+		parser->addImport(iface);
+	}
+	if (opt.getStreamCodeGen()) {
+		bool ok = compileStreaming(opt, parser);
+		SAFE_DELETE(parser);
+		for (ModuleInterface* iface : imports) {
+			SAFE_DELETE(iface);
+		}
+		return ok ? 0 : 1;
+	}
 	if (not parser->doParse()) {
 		fprintf(stderr, "err at parser or lexer\n");
 		SAFE_DELETE(parser);
@@ -129,7 +474,12 @@ int main(int argc, char** argv)
 		exit(1);
 	}
 
-	CodeGen* codegen = new CodeGen();
+	// 定数畳み込み・範囲の伝播
+	if (opt.getSimplify()) {
+		Simplifier().doSimplify(t_unit);
+	}
+
+	CodeGen* codegen = createCodeGen(opt);
 	if (not codegen->doCodeGen(t_unit, opt.getInputFileName(),
 		opt.getLinkFilieName(), opt.getWithJit())) {
 		fprintf(stderr, "err at codegen\n");
@@ -147,21 +497,20 @@ int main(int argc, char** argv)
 		exit(1);
 	}
 
-	llvm::legacy::PassManager pm;
-
-	// mem2regを適用
-	// pm.add(llvm::createPromoteMemoryToRegisterPass());
-
 	// 出力
-	std::error_code error;
-	llvm::raw_fd_ostream raw_stream(llvm::StringRef(opt.getOutputFileName().c_str()), error);
-	pm.add(llvm::createPrintModulePass(raw_stream));
-	pm.run(mod);
-	raw_stream.close();
+	if (not writeModule(mod, opt.getOutputFileName()) or
+		(not opt.getInterfaceFileName().empty() and not ModuleInterface::write(opt.getInterfaceFileName(), t_unit))) {
+		SAFE_DELETE(parser);
+		SAFE_DELETE(codegen);
+		exit(1);
+	}
 
 	// delete
 	SAFE_DELETE(parser);
 	SAFE_DELETE(codegen);
+	for (ModuleInterface* iface : imports) {
+		SAFE_DELETE(iface);
+	}
 
 	return 0;
 }
\ No newline at end of file
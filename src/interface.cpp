@@ -0,0 +1,122 @@
+#include "interface.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const char InterfaceMagic[4] = {'D', 'C', 'I', 'F'};
+static const uint32_t InterfaceVersion = 1;
+
+/*
+ * インターフェースファイルを読み込む
+ * @param ファイル名
+ * @return 成功：ModuleInterface、失敗：NULL(エラー表示)
+ */
+ModuleInterface* ModuleInterface::load(std::string file_name) {
+	ModuleInterface* iface = new ModuleInterface();
+	iface->Buffer = SourceBuffer::open(file_name);
+	if (not iface->Buffer) {
+		fprintf(stderr, "%s を開けません\n", file_name.c_str());
+		SAFE_DELETE(iface);
+		return NULL;
+	}
+	if (not iface->validate(file_name)) {
+		SAFE_DELETE(iface);
+		return NULL;
+	}
+	return iface;
+}
+
+/*
+ * 読み込んだ内容を検査して、各表の位置を決める
+ * 大きさ、添字、名前の終端が全てファイルに収まっていることを確かめる
+ * @param ファイル名(エラー表示用)
+ * @return 正しい形式：true、壊れている：false(エラー表示)
+ */
+bool ModuleInterface::validate(const std::string& file_name) {
+	const char* data = Buffer->getData();
+	size_t size = Buffer->getSize();
+	if (size < sizeof(InterfaceHeader) or memcmp(data, InterfaceMagic, sizeof(InterfaceMagic)) != 0) {
+		fprintf(stderr, "%s はインターフェースファイルではありません\n", file_name.c_str());
+		return false;
+	}
+	Header = reinterpret_cast<const InterfaceHeader*>(data);
+	if (Header->Version != InterfaceVersion) {
+		fprintf(stderr, "%s の形式(version %u)には対応していません\n", file_name.c_str(), Header->Version);
+		return false;
+	}
+	size_t func_bytes = (size_t)Header->FunctionNum * sizeof(InterfaceFunction);
+	size_t param_bytes = (size_t)Header->ParamNum * sizeof(InterfaceParam);
+	if (sizeof(InterfaceHeader) + func_bytes + param_bytes + Header->StringBytes != size or
+		(Header->StringBytes > 0 and data[size - 1] != '\0')) {
+		fprintf(stderr, "%s が壊れています\n", file_name.c_str());
+		return false;
+	}
+	Functions = reinterpret_cast<const InterfaceFunction*>(data + sizeof(InterfaceHeader));
+	Params = reinterpret_cast<const InterfaceParam*>(data + sizeof(InterfaceHeader) + func_bytes);
+	Strings = data + sizeof(InterfaceHeader) + func_bytes + param_bytes;
+	for (uint32_t i = 0; i < Header->FunctionNum; i++) {
+		const InterfaceFunction& func = Functions[i];
+		bool broken = func.Name >= Header->StringBytes or
+			func.ParamBegin > Header->ParamNum or func.ParamNum > Header->ParamNum - func.ParamBegin;
+		for (uint32_t j = 0; not broken and j < func.ParamNum; j++) {
+			broken = Params[func.ParamBegin + j].Name >= Header->StringBytes;
+		}
+		if (broken) {
+			fprintf(stderr, "%s が壊れています\n", file_name.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * 翻訳単位が定義した関数をインターフェースファイルに書き出す
+ * mainは他の翻訳単位から呼ぶものではないので含めない
+ * 範囲はコード生成後のPrototypeASTのものを使う
+ * @param ファイル名、コード生成済みのTranslationUnitAST
+ * @return 成功：true、失敗：false(エラー表示)
+ */
+bool ModuleInterface::write(std::string file_name, TranslationUnitAST& tunit) {
+	std::vector<InterfaceFunction> funcs;
+	std::vector<InterfaceParam> params;
+	std::string strings;
+	auto addString = [&strings](llvm::StringRef str) {
+		uint32_t offset = strings.size();
+		strings.append(str.data(), str.size());
+		strings.push_back('\0');
+		return offset;
+	};
+	for (int i = 0; FunctionAST* func_ast = tunit.getFunction(i); i++) {
+		PrototypeAST* proto = func_ast->getPrototype();
+		if (proto->getName() == "main") {
+			continue;
+		}
+		InterfaceFunction func = {addString(proto->getName()), (uint32_t)params.size(), (uint32_t)proto->getParamNum(), 0, proto->getResultRange()};
+		for (int j = 0; j < proto->getParamNum(); j++) {
+			params.push_back({addString(proto->getParamName(j)), 0, proto->getParamRange(j)});
+		}
+		funcs.push_back(func);
+	}
+
+	InterfaceHeader header = {};
+	memcpy(header.Magic, InterfaceMagic, sizeof(InterfaceMagic));
+	header.Version = InterfaceVersion;
+	header.FunctionNum = funcs.size();
+	header.ParamNum = params.size();
+	header.StringBytes = strings.size();
+	FILE* fp = fopen(file_name.c_str(), "wb");
+	if (not fp) {
+		fprintf(stderr, "%s に書き込めません\n", file_name.c_str());
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 and
+		fwrite(funcs.data(), sizeof(InterfaceFunction), funcs.size(), fp) == funcs.size() and
+		fwrite(params.data(), sizeof(InterfaceParam), params.size(), fp) == params.size() and
+		fwrite(strings.data(), 1, strings.size(), fp) == strings.size();
+	if (fclose(fp) != 0 or not ok) {
+		fprintf(stderr, "%s に書き込めません\n", file_name.c_str());
+		return false;
+	}
+	return true;
+}
@@ -1,145 +1,939 @@
 #include "lexer.hpp"
 
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+#if defined(__x86_64__) or defined(__i386__)
+#include <immintrin.h>
+#endif
+
 /*
- * トークン切り出し関数
- * @param 字句解析対象ファイル名
- * @return 切り出したトークンを格納したTokenStream 
+ * 入力ファイルを開く
+ * 通常ファイルならmmap、それ以外(パイプ、標準入力など)はread()で全体を読む
+ * @param 字句解析対象ファイル名("-"なら標準入力)
+ * @return 成功：SourceBuffer、失敗：NULL
  */
-TokenStream* LexicalAnalysis(std::string input_filename) {
-	TokenStream* tokens = new TokenStream();
-	std::ifstream ifs;
-	std::string cur_line;
-	std::string token_str;
-	int line_num = 0;
-	bool iscomment = false;
-
-	ifs.open(input_filename.c_str(), std::ios::in);
-	if (not ifs) {
+SourceBuffer* SourceBuffer::open(std::string input_filename) {
+	int fd;
+	if (input_filename == "-") {
+		fd = STDIN_FILENO;
+	} else if ((fd = ::open(input_filename.c_str(), O_RDONLY)) < 0) {
 		return NULL;
 	}
-	while (ifs and getline(ifs, cur_line)) {
-		char next_char;
-		std::string line;
-		Token* next_token;
-		int index = 0;
-		int len = cur_line.length();
-		while (index < len) {
-			next_char = cur_line.at(index++);
-			// コメントアウト読み飛ばし
-			if (iscomment) {
-				if ((len - index) < 2 or cur_line.at(index) != '*' or cur_line.at(index++) != '/') {
-					continue;
-				} else {
-					iscomment = false;
-				}
+	SourceBuffer* buf = new SourceBuffer();
+	struct stat st;
+	if (fstat(fd, &st) == 0 and S_ISREG(st.st_mode) and st.st_size > 0) {
+		void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			buf->Data = static_cast<const char*>(p);
+			buf->Size = st.st_size;
+			buf->Mapped = true;
+		}
+	}
+	if (not buf->Mapped) {
+		char chunk[1 << 16];
+		ssize_t n;
+		while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+			buf->Storage.append(chunk, n);
+		}
+		if (n < 0) {
+			SAFE_DELETE(buf);
+		} else {
+			buf->Data = buf->Storage.data();
+			buf->Size = buf->Storage.size();
+		}
+	}
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+	// TokenのOffsetは32bit
+	if (buf and buf->Size > UINT32_MAX) {
+		fprintf(stderr, "input file is too large\n");
+		SAFE_DELETE(buf);
+	}
+	return buf;
+}
+
+/*
+ * デストラクタ
+ */
+SourceBuffer::~SourceBuffer() {
+	if (Mapped) {
+		munmap(const_cast<char*>(Data), Size);
+	}
+}
+
+//
+// 文字クラス表とキーワード表
+// どちらもコンパイル時に下の一覧から生成する
+//
+
+/*
+ * 一文字で切り出す記号とキーワードの一覧
+ * キーワードを増やすときはここに足すだけでよい
+ */
+static constexpr char SymbolChars[] = "*+-=$;,()[]{}<";
+
+struct KeywordDef {
+	const char* Str;
+	TokenType Type;
+};
+
+static constexpr KeywordDef KeywordList[] = {
+	{"int", TOK_INT},
+	{"return", TOK_RETURN},
+	{"array", TOK_ARRAY},
+	{"for", TOK_FOR},
+};
+
+/*
+ * 文字クラス(ビットの組み合わせ)
+ */
+enum CharClass : uint8_t {
+	CC_SPACE = 1 << 0,
+	CC_ALPHA = 1 << 1,
+	CC_DIGIT = 1 << 2,
+	CC_SYMBOL = 1 << 3,
+	CC_SLASH = 1 << 4
+};
+
+struct CharClassTable {
+	uint8_t Class[256];
+};
+
+static constexpr CharClassTable makeCharClassTable() {
+	CharClassTable t = {};
+	for (int c = '\t'; c <= '\r'; c++) {
+		t.Class[c] = CC_SPACE;
+	}
+	t.Class[' '] = CC_SPACE;
+	for (int c = 'a'; c <= 'z'; c++) {
+		t.Class[c] = CC_ALPHA;
+		t.Class[c - 'a' + 'A'] = CC_ALPHA;
+	}
+	for (int c = '0'; c <= '9'; c++) {
+		t.Class[c] = CC_DIGIT;
+	}
+	for (const char* p = SymbolChars; *p; p++) {
+		t.Class[static_cast<unsigned char>(*p)] = CC_SYMBOL;
+	}
+	t.Class['/'] = CC_SLASH;
+	return t;
+}
+
+static constexpr CharClassTable CharClasses = makeCharClassTable();
+
+static inline uint8_t getCharClass(char c) { return CharClasses.Class[static_cast<unsigned char>(c)]; }
+
+/*
+ * キーワードの完全ハッシュ表
+ * 先頭文字、末尾文字、長さをまとめた値に乗数Seedを掛けた上位ビットを添字にする
+ * 衝突しないSeedをコンパイル時に探すので、引くときはキーワードの数によらず
+ * ハッシュ一回と文字列比較一回で済む
+ */
+static constexpr int KeywordNum = sizeof(KeywordList) / sizeof(KeywordList[0]);
+static constexpr int KeywordBits = [] {
+	int bits = 1;
+	while ((1 << bits) < KeywordNum * 2) {
+		bits++;
+	}
+	return bits;
+}();
+
+static constexpr size_t constStrlen(const char* s) {
+	size_t n = 0;
+	while (s[n]) {
+		n++;
+	}
+	return n;
+}
+
+static constexpr uint32_t keywordHash(const char* s, size_t len, uint32_t seed) {
+	uint32_t key = static_cast<unsigned char>(s[0]) | (static_cast<unsigned char>(s[len - 1]) << 8) | (static_cast<uint32_t>(len) << 16);
+	return (key * seed) >> (32 - KeywordBits);
+}
+
+struct KeywordTable {
+	uint32_t Seed;
+	struct {
+		const char* Str;
+		size_t Len;
+		TokenType Type;
+	} Slot[1 << KeywordBits];
+};
+
+static constexpr KeywordTable makeKeywordTable() {
+	for (uint32_t seed = 0x9e3779b1; seed != 0; seed += 2) {
+		KeywordTable t = {};
+		t.Seed = seed;
+		bool ok = true;
+		for (int i = 0; ok and i < KeywordNum; i++) {
+			size_t len = constStrlen(KeywordList[i].Str);
+			uint32_t h = keywordHash(KeywordList[i].Str, len, seed);
+			if (t.Slot[h].Str) {
+				ok = false;
+			} else {
+				t.Slot[h].Str = KeywordList[i].Str;
+				t.Slot[h].Len = len;
+				t.Slot[h].Type = KeywordList[i].Type;
 			}
-			// EOF
-			if (next_char == EOF) {
-				token_str = EOF;
-				next_token = new Token(token_str, TOK_EOF, line_num);
-			} else if (isspace(next_char)) {
-				continue;
-			} else if (isalpha(next_char)) { // IDENTIFIER
-				token_str += next_char;
-				next_char = cur_line.at(index++);
-				while (isalnum(next_char)) {
-					token_str += next_char;
-					next_char = cur_line.at(index++);
-					if (index == len) {
-						break;
-					}
-				}
-				index--;
-				if (token_str == "int") {
-					next_token = new Token(token_str, TOK_INT, line_num);
-				} else if (token_str == "return") {
-					next_token = new Token(token_str, TOK_RETURN, line_num);
-				} else if (token_str == "array") {
-					next_token = new Token(token_str, TOK_ARRAY, line_num);
-				} else {
-					next_token = new Token(token_str, TOK_IDENTIFIER, line_num);
-				}
-			} else if (isdigit(next_char)) { // 数字
-				if (next_char == '0') {
-					token_str += next_char;
-					next_token = new Token(token_str, TOK_DIGIT, line_num);
-				} else {
-					token_str += next_char;
-					next_char = cur_line.at(index++);
-					while (isdigit(next_char)) {
-						token_str += next_char;
-						next_char = cur_line.at(index++);
-					}
-					next_token = new Token(token_str, TOK_DIGIT, line_num);
-					index--;
-				}
-			} else if (next_char == '/') { // コメント or '/'
-				token_str += next_char;
-				next_char = cur_line.at(index++);
-
-				if (next_char == '/') { // 1行コメントの場合
-					break;
-				} else if (next_char == '*') { // 2行コメントの場合
-					iscomment = true;
-					continue;
-				} else { // div
-					index--;
-					next_token = new Token(token_str, TOK_SYMBOL, line_num);
+		}
+		if (ok) {
+			return t;
+		}
+	}
+	return KeywordTable{};
+}
+
+static constexpr KeywordTable Keywords = makeKeywordTable();
+static_assert(Keywords.Seed != 0, "no perfect hash for KeywordList");
+
+/*
+ * 識別子がキーワードか調べる
+ * @param 識別子の文字列(1文字以上)
+ * @return キーワードならそのTokenType、そうでなければTOK_IDENTIFIER
+ */
+static inline TokenType lookupKeyword(std::string_view str) {
+	const auto& slot = Keywords.Slot[keywordHash(str.data(), str.size(), Keywords.Seed)];
+	if (slot.Len == str.size() and memcmp(slot.Str, str.data(), str.size()) == 0) {
+		return slot.Type;
+	}
+	return TOK_IDENTIFIER;
+}
+
+//
+// 文字種判定カーネル
+//
+
+static bool isSpaceChar(char c) { return getCharClass(c) & CC_SPACE; }
+static bool isAlnumChar(char c) { return getCharClass(c) & (CC_ALPHA | CC_DIGIT); }
+static bool isDigitChar(char c) { return getCharClass(c) & CC_DIGIT; }
+
+static const char* skipSpaceScalar(const char* cur, const char* end, int& line) {
+	while (cur < end and isSpaceChar(*cur)) {
+		if (*cur++ == '\n') {
+			line++;
+		}
+	}
+	return cur;
+}
+
+static const char* skipAlnumScalar(const char* cur, const char* end) {
+	while (cur < end and isAlnumChar(*cur)) {
+		cur++;
+	}
+	return cur;
+}
+
+static const char* skipDigitScalar(const char* cur, const char* end) {
+	while (cur < end and isDigitChar(*cur)) {
+		cur++;
+	}
+	return cur;
+}
+
+static const char* findCommentEndScalar(const char* cur, const char* end, int& line) {
+	while (end - cur >= 2) {
+		if (cur[0] == '*' and cur[1] == '/') {
+			return cur;
+		}
+		if (*cur++ == '\n') {
+			line++;
+		}
+	}
+	if (cur < end and *cur == '\n') {
+		line++;
+	}
+	return end;
+}
+
+static const LexKernel ScalarKernel = {
+	"scalar", skipSpaceScalar, skipAlnumScalar, skipDigitScalar, findCommentEndScalar
+};
+
+#if defined(__x86_64__) or defined(__i386__)
+/*
+ * SSE4.2版
+ * 文字クラスの判定はpcmpestriの範囲比較で16byteずつ行う
+ * 範囲に入らない文字が見つからなければ16が返る
+ */
+#define SSE42 __attribute__((target("sse4.2,popcnt")))
+
+SSE42 static const char* skipSpaceSSE42(const char* cur, const char* end, int& line) {
+	const __m128i ranges = _mm_setr_epi8('\t', '\r', ' ', ' ', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i nl = _mm_set1_epi8('\n');
+	while (end - cur >= 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+		int i = _mm_cmpestri(ranges, 4, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY);
+		unsigned nl_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) & ((1u << i) - 1);
+		line += _mm_popcnt_u32(nl_mask);
+		if (i < 16) {
+			return cur + i;
+		}
+		cur += 16;
+	}
+	return skipSpaceScalar(cur, end, line);
+}
+
+SSE42 static const char* skipAlnumSSE42(const char* cur, const char* end) {
+	const __m128i ranges = _mm_setr_epi8('0', '9', 'A', 'Z', 'a', 'z', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	while (end - cur >= 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+		int i = _mm_cmpestri(ranges, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY);
+		if (i < 16) {
+			return cur + i;
+		}
+		cur += 16;
+	}
+	return skipAlnumScalar(cur, end);
+}
+
+SSE42 static const char* skipDigitSSE42(const char* cur, const char* end) {
+	const __m128i ranges = _mm_setr_epi8('0', '9', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	while (end - cur >= 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+		int i = _mm_cmpestri(ranges, 2, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY);
+		if (i < 16) {
+			return cur + i;
+		}
+		cur += 16;
+	}
+	return skipDigitScalar(cur, end);
+}
+
+/*
+ * コメントの終わりは'*'の位置と1byte後ろの'/'の位置の論理積で探す
+ * 後ろの1byteも読むので17byte以上残っている間だけ回す
+ */
+SSE42 static const char* findCommentEndSSE42(const char* cur, const char* end, int& line) {
+	const __m128i star = _mm_set1_epi8('*');
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i nl = _mm_set1_epi8('\n');
+	while (end - cur >= 17) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+		__m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + 1));
+		unsigned hit = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v, star), _mm_cmpeq_epi8(w, slash)));
+		unsigned nl_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+		if (hit) {
+			int i = __builtin_ctz(hit);
+			line += _mm_popcnt_u32(nl_mask & ((1u << i) - 1));
+			return cur + i;
+		}
+		line += _mm_popcnt_u32(nl_mask);
+		cur += 16;
+	}
+	return findCommentEndScalar(cur, end, line);
+}
+
+static const LexKernel SSE42Kernel = {
+	"sse42", skipSpaceSSE42, skipAlnumSSE42, skipDigitSSE42, findCommentEndSSE42
+};
+
+/*
+ * AVX2版
+ * 文字クラスはlo <= c <= hi を max/min の一致で判定して32byteずつ行う
+ */
+#define AVX2 __attribute__((target("avx2,bmi,popcnt")))
+
+AVX2 static inline __m256i inRange(__m256i v, char lo, char hi) {
+	__m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(lo)), v);
+	__m256i le = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(hi)), v);
+	return _mm256_and_si256(ge, le);
+}
+
+AVX2 static const char* skipSpaceAVX2(const char* cur, const char* end, int& line) {
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i nl = _mm256_set1_epi8('\n');
+	while (end - cur >= 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur));
+		uint32_t space = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), inRange(v, '\t', '\r')));
+		uint32_t nl_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+		if (~space) {
+			int i = _tzcnt_u32(~space);
+			line += _mm_popcnt_u32(nl_mask & ((1u << i) - 1));
+			return cur + i;
+		}
+		line += _mm_popcnt_u32(nl_mask);
+		cur += 32;
+	}
+	return skipSpaceScalar(cur, end, line);
+}
+
+AVX2 static const char* skipAlnumAVX2(const char* cur, const char* end) {
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	while (end - cur >= 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur));
+		__m256i alpha = inRange(_mm256_or_si256(v, lower), 'a', 'z');
+		uint32_t alnum = _mm256_movemask_epi8(_mm256_or_si256(alpha, inRange(v, '0', '9')));
+		if (~alnum) {
+			return cur + _tzcnt_u32(~alnum);
+		}
+		cur += 32;
+	}
+	return skipAlnumScalar(cur, end);
+}
+
+AVX2 static const char* skipDigitAVX2(const char* cur, const char* end) {
+	while (end - cur >= 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur));
+		uint32_t digit = _mm256_movemask_epi8(inRange(v, '0', '9'));
+		if (~digit) {
+			return cur + _tzcnt_u32(~digit);
+		}
+		cur += 32;
+	}
+	return skipDigitScalar(cur, end);
+}
+
+AVX2 static const char* findCommentEndAVX2(const char* cur, const char* end, int& line) {
+	const __m256i star = _mm256_set1_epi8('*');
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i nl = _mm256_set1_epi8('\n');
+	while (end - cur >= 33) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur));
+		__m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur + 1));
+		uint32_t hit = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v, star), _mm256_cmpeq_epi8(w, slash)));
+		uint32_t nl_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+		if (hit) {
+			int i = _tzcnt_u32(hit);
+			line += _mm_popcnt_u32(nl_mask & ((1u << i) - 1));
+			return cur + i;
+		}
+		line += _mm_popcnt_u32(nl_mask);
+		cur += 32;
+	}
+	return findCommentEndSSE42(cur, end, line);
+}
+
+static const LexKernel AVX2Kernel = {
+	"avx2", skipSpaceAVX2, skipAlnumAVX2, skipDigitAVX2, findCommentEndAVX2
+};
+#endif
+
+/*
+ * CPUの対応状況から使えるうちで一番速いカーネルを選ぶ
+ */
+static const LexKernel* detectLexKernel() {
+#if defined(__x86_64__) or defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("bmi")) {
+		return &AVX2Kernel;
+	} else if (__builtin_cpu_supports("sse4.2") and __builtin_cpu_supports("popcnt")) {
+		return &SSE42Kernel;
+	}
+#endif
+	return &ScalarKernel;
+}
+
+static const LexKernel* CurKernel = NULL;
+
+/*
+ * 使用するカーネルを名前で指定する
+ * 以降に作られたLexerから有効になる
+ * @param "auto", "scalar", "sse42", "avx2"
+ * @return 成功：true、未対応のCPUまたは不明な名前：false
+ */
+bool setLexKernel(std::string name) {
+	const LexKernel* best = detectLexKernel();
+	if (name == "auto") {
+		CurKernel = best;
+		return true;
+	} else if (name == ScalarKernel.Name) {
+		CurKernel = &ScalarKernel;
+		return true;
+	}
+#if defined(__x86_64__) or defined(__i386__)
+	if (name == SSE42Kernel.Name and best != &ScalarKernel) {
+		CurKernel = &SSE42Kernel;
+		return true;
+	} else if (name == AVX2Kernel.Name and best == &AVX2Kernel) {
+		CurKernel = &AVX2Kernel;
+		return true;
+	}
+#endif
+	return false;
+}
+
+/*
+ * 使用中のカーネルを取得する(未指定なら自動選択)
+ */
+const LexKernel* getLexKernel() {
+	if (not CurKernel) {
+		CurKernel = detectLexKernel();
+	}
+	return CurKernel;
+}
+
+/*
+ * コメントを読み飛ばす
+ * @return コメントを抜けた：true、入力終端に達した：false
+ */
+bool Lexer::skipComment() {
+	if (Comment == LINE_COMMENT) {
+		const char* eol = static_cast<const char*>(memchr(Cur, '\n', End - Cur));
+		if (not eol) {
+			Cur = End;
+			return false;
+		}
+		Cur = eol;
+		Comment = NO_COMMENT;
+		return true;
+	}
+	const char* p = Kernel->findCommentEnd(Cur, End, Line);
+	if (p != End) {
+		Cur = p + 2;
+		Comment = NO_COMMENT;
+		return true;
+	}
+	// 最後の一文字が'*'なら"*/"の途中かもしれないので残す
+	Cur = (not Final and Cur < End and End[-1] == '*') ? End - 1 : End;
+	return false;
+}
+
+/*
+ * トークンを一つ切り出す
+ * @param 切り出したトークンの格納先
+ * @return LEX_TOKEN：切り出し成功、LEX_END：入力終端、LEX_MORE：続きの入力が必要、LEX_ERROR：不明なトークン
+ */
+Lexer::Result Lexer::lexToken(Token& token) {
+	while (Cur < End) {
+		// コメントアウト読み飛ばし
+		if (Comment != NO_COMMENT) {
+			if (not skipComment()) {
+				break;
+			}
+			continue;
+		}
+
+		const char* start = Cur;
+		char next_char = *Cur++;
+		uint8_t char_class = getCharClass(next_char);
+		if (char_class == CC_SPACE) {
+			if (next_char == '\n') {
+				Line++;
+			}
+			Cur = Kernel->skipSpace(Cur, End, Line);
+			continue;
+		} else if (char_class == CC_ALPHA) { // IDENTIFIER
+			Cur = Kernel->skipAlnum(Cur, End);
+			if (Cur == End and not Final) {
+				Cur = start;
+				return LEX_MORE;
+			}
+			std::string_view str(start, Cur - start);
+			TokenType type = lookupKeyword(str);
+			if (type == TOK_IDENTIFIER) {
+				token = Token(TOK_IDENTIFIER, start - Base, Cur - start, Line, Symbols->intern(str));
+			} else {
+				token = Token(type, start - Base, Cur - start, Line, 0x7fffffff);
+			}
+			return LEX_TOKEN;
+		} else if (char_class == CC_DIGIT) { // 数字
+			int64_t num = next_char - '0';
+			if (next_char != '0') {
+				Cur = Kernel->skipDigit(Cur, End);
+				for (const char* p = start + 1; p < Cur; p++) {
+					num = num * 10 + (*p - '0');
 				}
-			} else { // それ以外
-				if (next_char == '*' or
-					next_char == '+' or
-					next_char == '-' or
-					next_char == '=' or
-					next_char == '$' or // 注釈
-					next_char == ';' or
-					next_char == ',' or
-					next_char == '(' or
-					next_char == ')' or
-					next_char == '[' or // NEW
-					next_char == ']' or // NEW
-					next_char == '{' or
-					next_char == '}') {
-					token_str += next_char;
-					next_token = new Token(token_str, TOK_SYMBOL, line_num);
-				} else {
-					fprintf(stderr, "unclear token : %c", next_char);
-					SAFE_DELETE(tokens);
-					return NULL;
+				if (Cur == End and not Final) {
+					Cur = start;
+					return LEX_MORE;
 				}
 			}
+			token = Token(TOK_DIGIT, start - Base, Cur - start, Line, num);
+			return LEX_TOKEN;
+		} else if (char_class == CC_SLASH) { // コメント or '/'
+			if (Cur == End and not Final) {
+				Cur = start;
+				return LEX_MORE;
+			} else if (Cur < End and *Cur == '/') { // 1行コメントの場合
+				Comment = LINE_COMMENT;
+				continue;
+			} else if (Cur < End and *Cur == '*') { // 2行コメントの場合
+				Cur++;
+				Comment = BLOCK_COMMENT;
+				continue;
+			}
+			// div
+			token = Token(TOK_SYMBOL, start - Base, 1, Line, '/');
+			return LEX_TOKEN;
+		} else if (char_class == CC_SYMBOL) { // SymbolCharsの記号
+			token = Token(TOK_SYMBOL, start - Base, 1, Line, next_char);
+			return LEX_TOKEN;
+		} else {
+			if (not Quiet) {
+				fprintf(stderr, "unclear token : %c", next_char);
+			}
+			return LEX_ERROR;
+		}
+	}
+	return Final ? LEX_END : LEX_MORE;
+}
+
+/*
+ * コンストラクタ
+ */
+TokenReader::TokenReader(int fd)
+	: FD(fd), Buffer(1 << 16), Filled(0), Eof(false),
+	  Lex(Buffer.data(), Buffer.data(), Buffer.data(), false) {}
+
+/*
+ * デストラクタ
+ */
+TokenReader::~TokenReader() {
+	if (FD != STDIN_FILENO) {
+		close(FD);
+	}
+}
+
+/*
+ * 入力を開く
+ * @param 字句解析対象ファイル名("-"なら標準入力)
+ * @return 成功：TokenReader、失敗：NULL
+ */
+TokenReader* TokenReader::open(std::string input_filename) {
+	int fd;
+	if (input_filename == "-") {
+		fd = STDIN_FILENO;
+	} else if ((fd = ::open(input_filename.c_str(), O_RDONLY)) < 0) {
+		return NULL;
+	}
+	return new TokenReader(fd);
+}
+
+/*
+ * 未処理の部分をバッファの先頭に寄せて続きを読み込む
+ * 一つのトークンがバッファに収まらない場合だけバッファを広げる
+ * @return 成功/失敗→T/F
+ */
+bool TokenReader::fill() {
+	size_t rest = Buffer.data() + Filled - Lex.getCur();
+	memmove(Buffer.data(), Lex.getCur(), rest);
+	if (rest == Buffer.size()) {
+		Buffer.resize(Buffer.size() * 2);
+	}
+	ssize_t n;
+	do {
+		n = read(FD, Buffer.data() + rest, Buffer.size() - rest);
+	} while (n < 0 and errno == EINTR);
+	if (n < 0) {
+		return false;
+	}
+	Eof = (n == 0);
+	Filled = rest + n;
+	Lex.setInput(Buffer.data(), Buffer.data(), Buffer.data() + Filled, Eof);
+	return true;
+}
 
-			// Tokensに追加
-			tokens->pushToken(next_token);
-			token_str.clear();
+/*
+ * トークンを一つ切り出す
+ * @param 切り出したトークンとその文字列の格納先
+ * @return LEX_TOKEN：切り出し成功、LEX_END：入力終端、LEX_ERROR：失敗
+ */
+Lexer::Result TokenReader::next(Token& token, std::string& text) {
+	while (true) {
+		Lexer::Result result = Lex.lexToken(token);
+		if (result == Lexer::LEX_TOKEN) {
+			text.assign(Buffer.data() + token.getOffset(), token.getLength());
+			return result;
+		} else if (result != Lexer::LEX_MORE) {
+			return result;
+		} else if (not fill()) {
+			fprintf(stderr, "failed to read input\n");
+			return Lexer::LEX_ERROR;
 		}
-		token_str.clear();
-		line_num++;
 	}
+}
 
-	if (ifs.eof()) {
-		tokens->pushToken(new Token(token_str, TOK_EOF, line_num));
+/*
+ * 読み込み済みの入力全体を逐次字句解析する
+ * @param 入力(TokenStreamが所有する)
+ * @return 切り出したトークンを格納したTokenStream
+ */
+static TokenStream* lexSource(SourceBuffer* source) {
+	TokenStream* tokens = new TokenStream(source);
+	// 実際に触れたページだけが確保されるので多めに予約しておく
+	tokens->reserveTokens(source->getSize() / 2 + 1);
+	const char* data = source->getData();
+	Lexer lexer(data, data, data + source->getSize());
+	Token next_token;
+	Lexer::Result result;
+	while ((result = lexer.lexToken(next_token)) == Lexer::LEX_TOKEN) {
+		tokens->pushToken(next_token);
 	}
-	ifs.close();
+	if (result == Lexer::LEX_ERROR) {
+		SAFE_DELETE(tokens);
+		return NULL;
+	}
+	tokens->pushToken(Token(TOK_EOF, source->getSize(), 0, lexer.getLine(), 0x7fffffff));
 	return tokens;
 }
 
+/*
+ * トークン切り出し関数
+ * 入力全体をmmapし、トークンはバッファ上の位置として連続領域に格納する
+ * @param 字句解析対象ファイル名
+ * @return 切り出したトークンを格納したTokenStream
+ */
+TokenStream* LexicalAnalysis(std::string input_filename) {
+	SourceBuffer* source = SourceBuffer::open(input_filename);
+	if (not source) {
+		return NULL;
+	}
+	return lexSource(source);
+}
+
+/*
+ * 並列字句解析で一つのスレッドが受け持つ範囲とその結果
+ * Symbolはチャンク内の識別子表のIDで、結合時にプログラム全体のIDへ付け替える
+ */
+struct LexChunk {
+	const char* Begin;
+	const char* End;
+	Lexer::CommentState StartComment;
+	Lexer::CommentState EndComment;
+	Lexer::Result Result;
+	int Lines; // チャンク内の改行の数
+	std::vector<Token> Tokens;
+	SymbolTable* Symbols;
+
+	LexChunk() : Symbols(NULL) {}
+	~LexChunk() { SAFE_DELETE(Symbols); }
+};
+
+/*
+ * チャンクを指定したコメント状態から字句解析する
+ * エラーメッセージは本当にエラーだと確定するまで出さない
+ * @param 入力全体の先頭、対象チャンク、開始時点のコメント状態
+ * @return 成功/失敗→T/F
+ */
+static bool lexChunk(const char* base, LexChunk* chunk, Lexer::CommentState comment) {
+	chunk->StartComment = comment;
+	chunk->Tokens.clear();
+	chunk->Tokens.reserve((chunk->End - chunk->Begin) / 2 + 1);
+	SAFE_DELETE(chunk->Symbols);
+	chunk->Symbols = new SymbolTable();
+	Lexer lexer(base, chunk->Begin, chunk->End);
+	lexer.setCommentState(comment);
+	lexer.setSymbolTable(chunk->Symbols);
+	lexer.setQuiet(true);
+	Token next_token;
+	while ((chunk->Result = lexer.lexToken(next_token)) == Lexer::LEX_TOKEN) {
+		chunk->Tokens.push_back(next_token);
+	}
+	chunk->EndComment = lexer.getCommentState();
+	chunk->Lines = lexer.getLine();
+	return chunk->Result != Lexer::LEX_ERROR;
+}
+
+/*
+ * トークン切り出し関数(並列版)
+ * 入力を改行の直後で分割し、チャンクごとに別スレッドで字句解析してから結合する
+ * 改行をまたぐトークンは無いので、チャンク間で引き継ぐ状態はブロックコメントの中かどうかだけ
+ * 各チャンクはまずコメント外から始まるものとして解析し、前のチャンクがコメントの途中で終わっていた場合だけ
+ * そのチャンクを逐次解析し直す
+ * 結果(トークン、行番号、Symbol)はLexicalAnalysisと完全に一致する
+ * @param 字句解析対象ファイル名、スレッド数(0ならCPU数)
+ * @return 切り出したトークンを格納したTokenStream
+ */
+TokenStream* ParallelLexicalAnalysis(std::string input_filename, int threads) {
+	// 1スレッドあたりこれより小さい入力は分割しても速くならない
+	const size_t min_chunk_size = 1 << 20;
+	if (threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	SourceBuffer* source = SourceBuffer::open(input_filename);
+	if (not source) {
+		return NULL;
+	}
+	const char* data = source->getData();
+	size_t size = source->getSize();
+	size_t chunk_num = std::min<size_t>(threads, size / min_chunk_size);
+	if (chunk_num <= 1) { // 標準入力・パイプは開き直せないので、読んだ入力をそのまま使う
+		return lexSource(source);
+	}
+
+	// 改行の直後で分割
+	std::vector<LexChunk> chunks(chunk_num);
+	const char* begin = data;
+	size_t used = 0;
+	for (size_t i = 0; i < chunk_num and begin < data + size; i++) {
+		const char* end = data + size;
+		if (i + 1 < chunk_num) {
+			const char* mid = std::max(begin, data + size * (i + 1) / chunk_num);
+			const char* nl = static_cast<const char*>(memchr(mid, '\n', end - mid));
+			end = nl ? nl + 1 : end;
+		}
+		chunks[used].Begin = begin;
+		chunks[used].End = end;
+		used++;
+		begin = end;
+	}
+	chunks.resize(used);
+
+	// 各チャンクをコメント外から始まるものとして並列に解析
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < chunks.size(); i++) {
+		workers.emplace_back(lexChunk, data, &chunks[i], Lexer::NO_COMMENT);
+	}
+	lexChunk(data, &chunks[0], Lexer::NO_COMMENT);
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+
+	// 前のチャンクの終了状態と開始状態が食い違うチャンクを解析し直し、
+	// 識別子を出現順にプログラム全体の識別子表へ登録する
+	std::vector<std::vector<Symbol>> symbol_maps(chunks.size());
+	std::vector<size_t> token_base(chunks.size() + 1, 0);
+	std::vector<int> line_base(chunks.size() + 1, 0);
+	Lexer::CommentState comment = Lexer::NO_COMMENT;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		LexChunk& chunk = chunks[i];
+		if (chunk.StartComment != comment) {
+			lexChunk(data, &chunk, comment);
+		}
+		if (chunk.Result == Lexer::LEX_ERROR) {
+			// メッセージを出すためにもう一度解析する
+			Lexer lexer(data, chunk.Begin, chunk.End);
+			lexer.setCommentState(comment);
+			lexer.setSymbolTable(chunk.Symbols);
+			Token next_token;
+			while (lexer.lexToken(next_token) == Lexer::LEX_TOKEN) {}
+			SAFE_DELETE(source);
+			return NULL;
+		}
+		comment = chunk.EndComment;
+		symbol_maps[i].resize(chunk.Symbols->size());
+		for (Symbol sym = 0; sym < chunk.Symbols->size(); sym++) {
+			symbol_maps[i][sym] = internSymbol(chunk.Symbols->getName(sym));
+		}
+		token_base[i + 1] = token_base[i] + chunk.Tokens.size();
+		line_base[i + 1] = line_base[i] + chunk.Lines;
+	}
+
+	// 行番号とSymbolを付け替えながら並列に結合
+	TokenStream* tokens = new TokenStream(source);
+	Token* out = tokens->appendTokens(token_base[chunks.size()]);
+	auto stitch = [&](size_t i) {
+		const std::vector<Token>& in = chunks[i].Tokens;
+		Token* dst = out + token_base[i];
+		for (size_t j = 0; j < in.size(); j++) {
+			const Token& t = in[j];
+			int64_t number = t.getTokenType() == TOK_IDENTIFIER ? symbol_maps[i][t.getSymbol()] : t.getNumberValue();
+			dst[j] = Token(t.getTokenType(), t.getOffset(), t.getLength(), t.getLine() + line_base[i], number);
+		}
+		std::vector<Token>().swap(chunks[i].Tokens);
+	};
+	for (size_t i = 1; i < chunks.size(); i++) {
+		workers.emplace_back(stitch, i);
+	}
+	stitch(0);
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	tokens->pushToken(Token(TOK_EOF, size, 0, line_base[chunks.size()], 0x7fffffff));
+	return tokens;
+}
+
+/*
+ * トークン切り出し関数(ストリーミング版)
+ * トークンはパーサが必要とした時点で切り出し、直近window個だけを保持する
+ * @param 字句解析対象ファイル名、保持するトークン数
+ * @return TokenStream
+ */
+TokenStream* StreamingLexicalAnalysis(std::string input_filename, int window) {
+	TokenReader* reader = TokenReader::open(input_filename);
+	if (not reader) {
+		return NULL;
+	}
+	TokenStream* tokens = new TokenStream(reader, window);
+	if (tokens->hasError()) {
+		SAFE_DELETE(tokens);
+	}
+	return tokens;
+}
+
+/*
+ * コンストラクタ(ストリーミング版)
+ * windowは2の冪に切り上げる
+ */
+TokenStream::TokenStream(TokenReader* reader, int window)
+	: Source(NULL), Reader(reader), IsView(false), CurIndex(0), Filled(0), Failed(false) {
+	int size = 2;
+	while (size < window) {
+		size <<= 1;
+	}
+	Tokens.resize(size);
+	Texts.resize(size);
+	Data = Tokens.data();
+	Mask = size - 1;
+	fetchToken();
+}
+
+/*
+ * 次のトークンを切り出してリングバッファに追加する
+ * @return 成功/失敗→T/F
+ */
+bool TokenStream::fetchToken() {
+	int s = slot(Filled);
+	Lexer::Result result = Reader->next(Tokens[s], Texts[s]);
+	Filled++;
+	if (result == Lexer::LEX_END) {
+		Tokens[s] = Token(TOK_EOF, 0, 0, Reader->getLine(), 0x7fffffff);
+		Texts[s].clear();
+	} else if (result == Lexer::LEX_ERROR) {
+		return fail();
+	}
+	return true;
+}
+
+/*
+ * 字句解析の失敗、または保持していないトークンへの巻き戻し
+ * 以降はEOFを返し、hasError()で失敗を通知する
+ * @return false
+ */
+bool TokenStream::fail() {
+	int s = slot(Filled - 1);
+	Tokens[s] = Token(TOK_EOF, 0, 0, Reader->getLine(), 0x7fffffff);
+	Texts[s].clear();
+	CurIndex = Filled - 1;
+	Failed = true;
+	return false;
+}
+
 /*
  * デストラクタ
  */
 TokenStream::~TokenStream() {
-	for (int i = 0; i < Tokens.size(); i++) {
-		SAFE_DELETE(Tokens[i]);
-	}
 	Tokens.clear();
+	if (not IsView) {
+		SAFE_DELETE(Source);
+		SAFE_DELETE(Reader);
+	}
 }
 
 /*
- * トークン取得
- * @return CurIndex番目のToken
+ * 同じトークン列を別の位置から読むためのビューを作る
+ * トークン列と入力バッファは共有するので、ビューより先に元のTokenStreamを破棄してはいけない
+ * 全トークンを保持している場合だけ作れる
+ * @return 先頭を指すビュー、ストリーミング中ならNULL
  */
-Token TokenStream::getToken() {
-	return *Tokens[CurIndex];
+TokenStream* TokenStream::createView() {
+	if (Reader) {
+		return NULL;
+	}
+	TokenStream* view = new TokenStream(Source);
+	view->Data = Data;
+	view->IsView = true;
+	view->Filled = Filled;
+	return view;
 }
 
 /*
@@ -147,7 +941,12 @@ Token TokenStream::getToken() {
  * @return 成功/失敗→T/F
  */
 bool TokenStream::getNextToken() {
-	int siz = Tokens.size();
+	if (Reader and CurIndex + 1 == Filled and getCurType() != TOK_EOF) {
+		if (not fetchToken()) {
+			return false;
+		}
+	}
+	int siz = Filled;
 	if (--siz == CurIndex) {
 		return false;
 	} else if (CurIndex < siz) {
@@ -166,6 +965,9 @@ bool TokenStream::ungetToken(int times) {
 	for (int i = 0; i < times; i++) {
 		if (CurIndex == 0) {
 			return false;
+		} else if (CurIndex == getLowestIndex()) {
+			fprintf(stderr, "cannot unget token beyond lookahead window\n");
+			return fail();
 		} else {
 			CurIndex--;
 		}
@@ -173,17 +975,30 @@ bool TokenStream::ungetToken(int times) {
 	return true;
 }
 
+/*
+ * インデックスを指定位置に戻す
+ * @return 成功/失敗→T/F
+ */
+bool TokenStream::applyTokenIndex(int index) {
+	if (index < getLowestIndex()) {
+		fprintf(stderr, "cannot rewind token beyond lookahead window\n");
+		return fail();
+	}
+	CurIndex = index;
+	return true;
+}
+
 /*
  * 格納されたトークン一覧を表示する
  */
 bool TokenStream::printTokens() {
-	std::vector<Token*>::iterator t_iter = begin(Tokens);
-	while (t_iter != end(Tokens)) {
-		fprintf(stdout, "%d:", (*t_iter)->getTokenType());
-		if ((*t_iter)->getTokenType() != TOK_EOF) {
-			fprintf(stdout, "%s\n", (*t_iter)->getTokenString().c_str());
+	for (int i = getLowestIndex(); i < Filled; i++) {
+		const Token& token = Data[slot(i)];
+		fprintf(stdout, "%d:", token.getTokenType());
+		if (token.getTokenType() != TOK_EOF) {
+			std::string_view str = getTokenString(token);
+			fprintf(stdout, "%.*s\n", (int)str.size(), str.data());
 		}
-		t_iter++;
 	}
 	return true;
-}
\ No newline at end of file
+}
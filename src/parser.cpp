@@ -1,13 +1,121 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <thread>
+#include "interface.hpp"
 #include "parser.hpp"
+#include "simplify.hpp"
+
+/*
+ * 二項演算子の優先順位表
+ * Precが大きいほど強く結合し、同じ優先順位の演算子は左結合
+ * 代入系の演算子(=, $, inc)は式の先頭にある変数名・配列名・配列の要素だけを左辺に取り、連鎖しない
+ * 演算子を増やすときはここに足すだけでよい
+ */
+struct OperatorInfo {
+	const char* Str;
+	BinaryOp Op;
+	int Prec;
+	bool IsAssign;
+	bool ForVariable; // 変数を左辺に取れる
+	bool ForArray; // 配列を左辺に取れる
+	bool ForElement; // 配列の要素(a[i])を左辺に取れる
+};
+
+static constexpr int AssignPrec = 1;
+
+static constexpr OperatorInfo OperatorTable[] = {
+	{"=", OP_ASSIGN, AssignPrec, true, true, false, true},
+	{"$", OP_ANNOTATE, AssignPrec, true, true, true, false},
+	{"inc", OP_INC, AssignPrec, true, false, true, false},
+	{"+", OP_ADD, 2, false, false, false, false},
+	{"-", OP_SUB, 2, false, false, false, false},
+	{"*", OP_MUL, 3, false, false, false, false},
+	{"/", OP_DIV, 3, false, false, false, false},
+};
+
+static constexpr int OperatorNum = sizeof(OperatorTable) / sizeof(OperatorTable[0]);
+
+/*
+ * 一文字の演算子を文字からOperatorTableの添字(+1、0なら演算子でない)に引く表
+ * コンパイル時にOperatorTableから生成する
+ */
+struct OperatorIndexTable {
+	uint8_t Index[256];
+};
+
+static constexpr OperatorIndexTable makeOperatorIndexTable() {
+	OperatorIndexTable t = {};
+	for (int i = 0; i < OperatorNum; i++) {
+		if (OperatorTable[i].Str[1] == '\0') {
+			t.Index[static_cast<unsigned char>(OperatorTable[i].Str[0])] = i + 1;
+		}
+	}
+	return t;
+}
+
+static constexpr OperatorIndexTable OperatorIndex = makeOperatorIndexTable();
+
+static constexpr const OperatorInfo* IncOperator = &OperatorTable[2];
+
+/*
+ * 並列構文解析で関数定義一つについて受け渡す情報
+ */
+struct FunctionSpan {
+	PrototypeAST* Proto;
+	int Order; // 外部宣言の並びでの位置
+	int Begin; // 本文の'{'のトークン位置
+	int End; // 本文の'}'の次のトークン位置
+	FunctionStmtAST* Body; // 解析結果(失敗したらNULL)
+	std::string Error; // 失敗したときのメッセージ
+	uint64_t Hash; // 差分コンパイル用のハッシュ
+	bool Reused; // 前回の解析結果を使うので本文を解析しない
+	std::vector<std::pair<Symbol, int>> Lookups; // 本文から関数として引いた識別子
+};
+
+/*
+ * 整数と四則演算だけからなる式を整数に畳み込む(`$`、incの右辺用)
+ * 一つの演算の畳み込みは簡約と同じfoldBinaryで行う
+ * @param 関数本文、式のノード、結果の書き込み先
+ * @return 畳み込めた：true、畳み込めない：false
+ */
+static bool foldConstant(const FunctionStmtBuilder& body, NodeIndex expr, int64_t& value) {
+	const ExprNode& node = body.getNode(expr);
+	if (node.getValueID() == NumberID) {
+		value = node.getNumberValue();
+		return true;
+	}
+	int64_t lhs, rhs;
+	if (node.getValueID() != BinaryExprID or not foldConstant(body, node.getLHS(), lhs) or not foldConstant(body, node.getRHS(), rhs)) {
+		return false;
+	}
+	return foldBinary(node.getOp(), lhs, rhs, value);
+}
+
+/*
+ * ハッシュ値に64bitの値を混ぜる
+ */
+static uint64_t mixHash(uint64_t h, uint64_t v) {
+	h ^= v * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 32)) * 0xd6e8feb86659fd93ULL;
+	return h ^ (h >> 32);
+}
 
 /*
  * コンストラクタ
  */
-Parser::Parser(std::string filename) {
+Parser::Parser(std::string filename) : TU(NULL), IncSymbol(internSymbol("inc")), FillSymbol(internSymbol("fill")), Consumer(NULL), HasError(false), Threads(1),
+	BlockCursor(0), DeclaredFunctions(NULL), CurOrder(0), DeferError(false), Cache(NULL), LookupLog(NULL) {
 	Tokens = LexicalAnalysis(filename);
 }
 
+/*
+ * コンストラクタ
+ * 字句解析済み(またはストリーミング)のTokenStreamを受け取る
+ */
+Parser::Parser(TokenStream* tokens) : Tokens(tokens), TU(NULL), IncSymbol(internSymbol("inc")), FillSymbol(internSymbol("fill")), Consumer(NULL), HasError(false), Threads(1),
+	BlockCursor(0), DeclaredFunctions(NULL), CurOrder(0), DeferError(false), Cache(NULL), LookupLog(NULL) {}
+
 /*
  * 構文解析実行
  * @return 成功/失敗→T/F
@@ -18,7 +126,17 @@ bool Parser::doParse() {
 		return false;
 	} else {
 		// Tokens->printTokens();
-		return visitTranslationUnit();
+		bool parsed = (Threads != 1 or Cache) and not Consumer ? visitTranslationUnitParallel(Threads) : visitTranslationUnit();
+		if (not parsed) {
+			return false;
+		} else if (Tokens->hasError()) {
+			if (Cache) { // 解析結果を捨てるので、次回は全て解析し直す
+				Cache->clear();
+			}
+			SAFE_DELETE(TU);
+			return false;
+		}
+		return true;
 	}
 }
 
@@ -34,18 +152,188 @@ TranslationUnitAST& Parser::getAST() {
 	}
 }
 
+/*
+ * エラーを表示する
+ * 最初のエラーだけを表示し、DeferErrorのときは表示せずにErrorMessageに残す
+ * @param メッセージ
+ * @return false
+ */
+bool Parser::emitError(const std::string& msg) {
+	if (not HasError) {
+		if (DeferError) {
+			ErrorMessage = msg;
+		} else {
+			fputs(msg.c_str(), stderr);
+		}
+	}
+	HasError = true;
+	return false;
+}
+
+/*
+ * 構文エラーを表示する
+ * 巻き戻しをしないので、最初に見つかったエラーがそのまま原因になる
+ * @param メッセージ
+ * @return false
+ */
+bool Parser::reportError(const char* msg) {
+	if (not HasError and not Tokens->hasError()) {
+		std::string_view str = Tokens->getCurString();
+		return emitError("line " + std::to_string(Tokens->getToken().getLine() + 1) + ": " + msg + " (near '" + std::string(str) + "')\n");
+	}
+	HasError = true;
+	return false;
+}
+
+/*
+ * 現在のトークンが指定した記号か
+ * @param 記号
+ * @return T/F
+ */
+bool Parser::isCurSymbol(char c) {
+	return Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurSymbolChar() == c;
+}
+
+/*
+ * 現在のトークンが指定した記号なら読み進める
+ * @param 記号
+ * @return 読み進めた：true、違う記号：false(エラー表示)
+ */
+bool Parser::expectSymbol(char c) {
+	if (not isCurSymbol(c)) {
+		char msg[] = "expected ' '";
+		msg[10] = c;
+		return reportError(msg);
+	}
+	Tokens->getNextToken();
+	return true;
+}
+
+/*
+ * 現在のトークンを二項演算子として引く
+ * @return 演算子ならOperatorTableの要素、そうでなければNULL
+ */
+const OperatorInfo* Parser::getCurOperator() {
+	if (Tokens->getCurType() == TOK_SYMBOL) {
+		int i = OperatorIndex.Index[static_cast<unsigned char>(Tokens->getCurSymbolChar())];
+		return i ? &OperatorTable[i - 1] : NULL;
+	} else if (Tokens->getCurType() == TOK_IDENTIFIER and Tokens->getCurSymbol() == IncSymbol) {
+		return IncOperator;
+	}
+	return NULL;
+}
+
+/*
+ * 関数として呼べる識別子を引く
+ * 並列構文解析の本文では、解析中の関数より前で宣言・定義された関数だけを引く(逐次版と同じ)
+ * LookupLogがあれば、引いた結果を記録する
+ * @param 識別子、引数の数を返す
+ * @return 関数なら：true、そうでなければ：false
+ */
+bool Parser::lookupFunction(Symbol name, int& param_num) {
+	const int* num = NULL;
+	if (DeclaredFunctions) {
+		const FunctionEntry* entry = DeclaredFunctions->find(name);
+		if (entry and entry->Order < CurOrder) {
+			num = &entry->ParamNum;
+		}
+	} else {
+		num = PrototypeTable.find(name);
+		if (not num) {
+			num = FunctionTable.find(name);
+		}
+	}
+	if (LookupLog) {
+		LookupLog->push_back(std::make_pair(name, num ? *num : -1));
+	}
+	if (not num) {
+		return false;
+	}
+	param_num = *num;
+	return true;
+}
+
+/*
+ * 関数の再定義を確認する
+ * 宣言済みの関数の定義と、引数の数が食い違う宣言はエラー
+ * @param 解析済みのPrototype
+ * @return 問題なし：true、再定義：false(エラー表示)
+ */
+bool Parser::checkRedefinition(PrototypeAST* proto) {
+	const int* defined = FunctionTable.find(proto->getSymbol());
+	if (PrototypeTable.count(proto->getSymbol()) or (defined and *defined != proto->getParamNum())) {
+		return emitError("Function: " + proto->getName().str() + " is redefined\n");
+	}
+	return true;
+}
+
+/*
+ * printnum, inputnumの宣言を追加する
+ * @return true
+ */
+bool Parser::addBuiltinPrototypes() {
+	std::vector<Symbol> param_list;
+	param_list.push_back(internSymbol("i"));
+	TU->addPrototype(newNode<PrototypeAST>(internSymbol("printnum"), newArray(param_list)));
+	TU->addPrototype(newNode<PrototypeAST>(internSymbol("inputnum"), llvm::ArrayRef<Symbol>()));
+	PrototypeTable.set(internSymbol("printnum"), 1);
+	PrototypeTable.set(internSymbol("inputnum"), 0);
+	FunctionOrderTable.set(internSymbol("printnum"), {-1, 1});
+	FunctionOrderTable.set(internSymbol("inputnum"), {-1, 0});
+	return true;
+}
+
+/*
+ * インターフェースファイルにある関数の宣言を追加する
+ * 複数のインターフェースにある同じ関数(と組み込み関数)は、引数の数が同じなら一度だけ追加する
+ * @return 成功：true、引数の数が食い違う宣言がある：false(エラー表示)
+ */
+bool Parser::addImportedPrototypes() {
+	for (const ModuleInterface* iface : Imports) {
+		for (int i = 0; i < iface->getFunctionNum(); i++) {
+			const InterfaceFunction& func = iface->getFunction(i);
+			Symbol name = internSymbol(iface->getString(func.Name));
+			if (const int* num = PrototypeTable.find(name)) {
+				if (*num != (int)func.ParamNum) {
+					return emitError("Function: " + std::string(iface->getString(func.Name)) + " is redefined\n");
+				}
+				continue;
+			}
+			std::vector<Symbol> param_list;
+			std::vector<ValueRange> param_ranges;
+			for (int j = 0; j < (int)func.ParamNum; j++) {
+				const InterfaceParam& param = iface->getParam(func, j);
+				param_list.push_back(internSymbol(iface->getString(param.Name)));
+				param_ranges.push_back(param.Range);
+			}
+			PrototypeAST* proto = newNode<PrototypeAST>(name, newArray(param_list),
+				TU->getArena().copyArray(param_ranges.data(), param_ranges.size()));
+			proto->setResultRange(func.Result);
+			TU->addPrototype(proto);
+			PrototypeTable.set(name, func.ParamNum);
+			FunctionOrderTable.set(name, {-1, (int)func.ParamNum});
+		}
+	}
+	return true;
+}
+
 /*
  * TranslationUnit用構文解析メソッド
  * @return 解析成功/失敗→T/F
  */
 bool Parser::visitTranslationUnit() {
 	TU = new TranslationUnitAST();
-	std::vector<std::string> param_list;
-	param_list.push_back("i");
-	TU->addPrototype(new PrototypeAST("printnum", param_list));
-	TU->addPrototype(new PrototypeAST("inputnum", std::vector<std::string>{}));
-	PrototypeTable["printnum"] = 1;
-	PrototypeTable["inputnum"] = 0;
+	addBuiltinPrototypes();
+	if (not addImportedPrototypes()) {
+		SAFE_DELETE(TU);
+		return false;
+	}
+	for (int i = 0; Consumer and TU->getPrototype(i); i++) {
+		if (not Consumer->consumePrototype(TU->getPrototype(i))) {
+			SAFE_DELETE(TU);
+			return false;
+		}
+	}
 	// ExternalDecl
 	while (true) {
 		if (not visitExternalDeclaration(TU)) {
@@ -60,82 +348,369 @@ bool Parser::visitTranslationUnit() {
 }
 
 
+/*
+ * トップレベルの'{'と、対応する'}'の次の位置を求める
+ * 各スレッドが受け持つ範囲から括弧の位置だけを集め、それを先頭から数えて対応を取る
+ * 対応しない'}'は数えない(前処理はその位置で必ずエラーになる)
+ * @param 全トークンを保持したTokenStream、スレッド数
+ * @return '{'の位置と対応する'}'の次の位置の組(位置の昇順)
+ */
+static std::vector<std::pair<int, int>> findTopLevelBlocks(TokenStream* tokens, int threads) {
+	int token_num = tokens->getTokenNum();
+	std::vector<std::vector<int>> braces(threads); // '{'は位置、'}'は-1-位置
+	auto collect = [&](int i) {
+		int end = (int)((int64_t)token_num * (i + 1) / threads);
+		for (int j = (int)((int64_t)token_num * i / threads); j < end; j++) {
+			const Token& token = tokens->getTokenAt(j);
+			if (token.getTokenType() == TOK_SYMBOL) {
+				char c = (char)token.getNumberValue();
+				if (c == '{') {
+					braces[i].push_back(j);
+				} else if (c == '}') {
+					braces[i].push_back(-1 - j);
+				}
+			}
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) {
+		pool.emplace_back(collect, i);
+	}
+	collect(0);
+	for (std::thread& t : pool) {
+		t.join();
+	}
+
+	std::vector<std::pair<int, int>> blocks;
+	int depth = 0;
+	int open = 0;
+	for (std::vector<int>& list : braces) {
+		for (int pos : list) {
+			if (pos >= 0) {
+				if (depth++ == 0) {
+					open = pos;
+				}
+			} else if (depth > 0 and --depth == 0) {
+				blocks.push_back(std::make_pair(open, -pos));
+			}
+		}
+	}
+	return blocks;
+}
+
+/*
+ * TranslationUnit用構文解析メソッド(並列版)
+ * 1. 外部宣言を先頭から読み、関数宣言を登録しつつ関数定義の本文の範囲を集める
+ * 2. 本文をスレッドごとのParserで並列に解析する(ASTは各Parserが自分のArenaに作る)
+ * 3. 結果を元の順に並べ、ArenaをTUにまとめる
+ * 呼べる関数とエラーメッセージは逐次版と同じになる
+ * @param スレッド数(0ならCPU数)
+ * @return 解析成功/失敗→T/F
+ */
+bool Parser::visitTranslationUnitParallel(int threads) {
+	// 1スレッドあたりこれより少ないトークン数では分割しても速くならない
+	const int min_tokens = 1 << 18;
+	if (threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = std::min(threads, Tokens->getTokenNum() / min_tokens);
+	if (Tokens->isStreaming() or (threads <= 1 and not Cache)) {
+		if (Cache) { // 関数ごとの範囲が分からないので、次回は全て解析し直す
+			Cache->clear();
+		}
+		return visitTranslationUnit();
+	}
+	threads = std::max(threads, 1);
+
+	TU = new TranslationUnitAST();
+	addBuiltinPrototypes();
+	if (not addImportedPrototypes()) {
+		SAFE_DELETE(TU);
+		return false;
+	}
+	TopLevelBlocks = findTopLevelBlocks(Tokens, threads);
+	BlockCursor = 0;
+	DeferError = true;
+	std::vector<FunctionSpan> spans;
+	bool scanned = true;
+	for (int order = 0; ; order++) {
+		if (not scanExternalDeclaration(order, spans)) {
+			scanned = false;
+			break;
+		}
+		if (Tokens->getCurType() == TOK_EOF) {
+			break;
+		}
+	}
+	DeferError = false;
+	if (Cache) {
+		for (FunctionSpan& span : spans) {
+			span.Reused = isReusable(span);
+		}
+	}
+
+	// 前処理で見つかったエラーより前にある本文のエラーを優先する
+	if (not parseFunctionSpans(spans, threads)) {
+		for (FunctionSpan& span : spans) {
+			if (not span.Body and not span.Reused) {
+				fputs(span.Error.c_str(), stderr);
+				break;
+			}
+		}
+		SAFE_DELETE(TU);
+		return false;
+	} else if (not scanned) {
+		fputs(ErrorMessage.c_str(), stderr);
+		SAFE_DELETE(TU);
+		return false;
+	}
+	for (FunctionSpan& span : spans) {
+		TU->addFunction(newNode<FunctionAST>(span.Proto, span.Body));
+	}
+	if (Cache) {
+		updateFunctionCache(spans);
+	}
+	return true;
+}
+
+/*
+ * 並列構文解析の前処理として外部宣言を一つ読む
+ * 関数宣言はそのまま登録し、関数定義はPrototypeだけを読んで本文は対応する'}'の次まで読み飛ばす
+ * 本文は配列の初期化子やfor文の'{'を含みうるので、対応する'}'は入れ子の深さを追って求めたTopLevelBlocksから取る
+ * (見つからなければ入力の最後までを本文とし、本文の解析でエラーにする)
+ * @param 外部宣言の位置、関数定義の本文の範囲の追加先
+ * @return 解析成功/失敗→T/F
+ */
+bool Parser::scanExternalDeclaration(int order, std::vector<FunctionSpan>& spans) {
+	int begin = Tokens->getCurIndex();
+	PrototypeAST* proto = visitPrototype();
+	if (not proto) {
+		return false;
+	}
+	FunctionEntry entry = {order, proto->getParamNum()};
+	if (isCurSymbol(';')) { // FunctionDeclaration
+		if (not visitFunctionDeclaration(proto)) {
+			return false;
+		}
+		TU->addPrototype(proto);
+		FunctionOrderTable.insert(proto->getSymbol(), entry);
+		if (Cache) {
+			DeclarationHashes.set(proto->getSymbol(), hashTokens(begin, Tokens->getCurIndex()));
+		}
+		return true;
+	}
+
+	// FunctionDefinition
+	if (not checkRedefinition(proto)) {
+		return false;
+	}
+	if (not isCurSymbol('{')) {
+		return reportError("expected '{'");
+	}
+	FunctionSpan span = {proto, order, Tokens->getCurIndex(), Tokens->getTokenNum() - 1, NULL, "", 0, false, {}};
+	while (BlockCursor < TopLevelBlocks.size() and TopLevelBlocks[BlockCursor].first < span.Begin) {
+		BlockCursor++;
+	}
+	if (BlockCursor < TopLevelBlocks.size() and TopLevelBlocks[BlockCursor].first == span.Begin) {
+		span.End = TopLevelBlocks[BlockCursor].second;
+	}
+	Tokens->applyTokenIndex(span.End);
+	if (Cache) { // 先にある関数宣言の引数名もコード生成に効くので混ぜる
+		span.Hash = hashTokens(begin, span.End);
+		if (const uint64_t* decl = DeclarationHashes.find(proto->getSymbol())) {
+			span.Hash = mixHash(span.Hash, *decl);
+		}
+	}
+	spans.push_back(span);
+	FunctionTable.set(proto->getSymbol(), proto->getParamNum());
+	FunctionOrderTable.insert(proto->getSymbol(), entry);
+	return true;
+}
+
+/*
+ * 集めた関数本文をスレッドごとのParserで解析する
+ * 本文は少しずつまとめて取り出すので、大きさが偏っていても負荷が均等になる
+ * 解析後、各ParserのArenaをTUのArenaにまとめる
+ * @param 本文の範囲(結果もここに書き込む)、スレッド数
+ * @return 全て成功：true、どれかが失敗：false
+ */
+bool Parser::parseFunctionSpans(std::vector<FunctionSpan>& spans, int threads) {
+	const size_t batch = 16;
+	std::atomic<size_t> next(0);
+	std::vector<Parser*> workers;
+	for (int i = 0; i < threads; i++) {
+		Parser* worker = new Parser(Tokens->createView());
+		worker->TU = new TranslationUnitAST();
+		worker->DeclaredFunctions = &FunctionOrderTable;
+		worker->DeferError = true;
+		workers.push_back(worker);
+	}
+	auto work = [this, &spans, &next](Parser* worker) {
+		for (size_t begin; (begin = next.fetch_add(batch)) < spans.size(); ) {
+			for (size_t i = begin; i < std::min(begin + batch, spans.size()); i++) {
+				FunctionSpan& span = spans[i];
+				if (span.Reused) {
+					continue;
+				}
+				worker->Tokens->applyTokenIndex(span.Begin);
+				worker->CurOrder = span.Order;
+				worker->HasError = false;
+				worker->VariableTable.clear();
+				worker->ArrayTable.clear();
+				worker->LookupLog = Cache ? &span.Lookups : NULL;
+				span.Body = worker->visitFunctionStatement(span.Proto);
+				if (not span.Body) {
+					span.Error = worker->ErrorMessage;
+				}
+			}
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) {
+		pool.emplace_back(work, workers[i]);
+	}
+	work(workers[0]);
+	for (std::thread& t : pool) {
+		t.join();
+	}
+	for (Parser* worker : workers) {
+		TU->getArena().merge(worker->TU->getArena());
+		SAFE_DELETE(worker);
+	}
+	for (FunctionSpan& span : spans) {
+		if (not span.Body and not span.Reused) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * トークン列のハッシュを求める
+ * 行番号や位置は混ぜないので、前に行を足しただけの関数は変わらない
+ * @param 先頭のトークン位置、末尾の次のトークン位置
+ * @return ハッシュ値
+ */
+uint64_t Parser::hashTokens(int begin, int end) {
+	uint64_t h = 0;
+	for (int i = begin; i < end; i++) {
+		const Token& token = Tokens->getTokenAt(i);
+		h = mixHash(h, token.getTokenType());
+		h = mixHash(h, token.getNumberValue());
+	}
+	return h;
+}
+
+/*
+ * 関数定義の前回の解析結果がそのまま使えるか
+ * トークン列が同じでも、本文から引いた識別子が関数かどうか(と引数の数)が変わっていれば解析し直す
+ * @param 前処理で集めた関数定義
+ * @return 使える：true、解析し直す：false
+ */
+bool Parser::isReusable(const FunctionSpan& span) {
+	const FunctionCacheEntry* entry = Cache->find(span.Proto->getSymbol());
+	if (not entry or entry->Hash != span.Hash) {
+		return false;
+	}
+	for (const std::pair<Symbol, int>& lookup : entry->Lookups) {
+		const FunctionEntry* func = FunctionOrderTable.find(lookup.first);
+		int param_num = func and func->Order < span.Order ? func->ParamNum : -1;
+		if (param_num != lookup.second) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * 今回の関数定義でFunctionCacheを置き換える
+ * 前回の関数で今回なくなったものは消える
+ * @param 解析に成功した関数定義
+ * @return true
+ */
+bool Parser::updateFunctionCache(std::vector<FunctionSpan>& spans) {
+	FunctionCache next;
+	for (FunctionSpan& span : spans) {
+		Symbol name = span.Proto->getSymbol();
+		if (span.Reused) {
+			next.set(name, *Cache->find(name));
+			continue;
+		}
+		std::vector<std::pair<Symbol, int>>& lookups = span.Lookups;
+		std::sort(lookups.begin(), lookups.end());
+		lookups.erase(std::unique(lookups.begin(), lookups.end()), lookups.end());
+		next.set(name, {span.Hash, std::move(lookups)});
+	}
+	std::swap(*Cache, next);
+	return true;
+}
+
 /*
  * ExternalDeclaration用構文解析クラス
+ * Prototypeを一度だけ解析し、続くトークンが';'なら関数宣言、'{'なら関数定義とする
  * 解析したPrototypeとFunctionASTをTranslationUnitに追加
  * @param TranslationUnitAST
- * @return true
+ * @return 解析成功/失敗→T/F
  */
 bool Parser::visitExternalDeclaration(TranslationUnitAST* t_unit) {
-	// FunctionDeclaration
-	PrototypeAST* proto = visitFunctionDeclaration();
-	if (proto) {
+	PrototypeAST* proto = visitPrototype();
+	if (not proto) {
+		return false;
+	}
+	if (isCurSymbol(';')) { // FunctionDeclaration
+		if (not visitFunctionDeclaration(proto)) {
+			return false;
+		}
 		t_unit->addPrototype(proto);
-		return true;
+		return not Consumer or Consumer->consumePrototype(proto);
 	}
 	// FunctionDefinition
-	FunctionAST* func_def = visitFunctionDefinition();
-	if (func_def) {
-		t_unit->addFunction(func_def);
-		return true;
+	FunctionAST* func_def = visitFunctionDefinition(proto);
+	if (not func_def) {
+		return false;
 	}
-	return false;
+	t_unit->addFunction(func_def);
+	if (Consumer) {
+		bool consumed = Consumer->consumeFunction(func_def, FunctionNodes);
+		func_def->setBody(NULL);
+		FunctionNodes.release();
+		return consumed;
+	}
+	return true;
 }
 
 /*
  * FunctionDeclaration用構文解析メソッド
- * @return 解析成功：PrototypeAST、失敗：NULL
+ * @param 解析済みのPrototype(現在のトークンは';')
+ * @return 解析成功/失敗→T/F
  */
-PrototypeAST* Parser::visitFunctionDeclaration() {
-	const int tmp = Tokens->getCurIndex();
-	PrototypeAST* proto = visitPrototype();
-	if (not proto) {
-		return NULL;
-	}
-	// prototype
-	if (Tokens->getCurString() == ";") {
-		if (PrototypeTable.count(proto->getName()) or
-			(FunctionTable.count(proto->getName()) and FunctionTable[proto->getName()] != proto->getParamNum())) {
-			fprintf(stderr, "Function: %s is redefined", proto->getName().c_str());
-			SAFE_DELETE(proto);
-			return NULL;
-		}
-		PrototypeTable[proto->getName()] = proto->getParamNum();
-		Tokens->getNextToken();
-		return proto;
-	} else {
-		SAFE_DELETE(proto);
-		Tokens->applyTokenIndex(tmp);
-		return NULL;
+bool Parser::visitFunctionDeclaration(PrototypeAST* proto) {
+	if (not checkRedefinition(proto)) {
+		return false;
 	}
+	PrototypeTable.set(proto->getSymbol(), proto->getParamNum());
+	Tokens->getNextToken();
+	return true;
 }
 
 /*
  * FunctionDefinition用構文解析メソッド
+ * @param 解析済みのPrototype
  * @return 解析成功：FunctionAST、失敗：NULL
  */
-FunctionAST* Parser::visitFunctionDefinition() {
-	const int tmp = Tokens->getCurIndex();
-	PrototypeAST* proto = visitPrototype();
-	if (not proto) {
-		return NULL;
-	} else if (PrototypeTable.count(proto->getName()) or
-		(FunctionTable.count(proto->getName()) and FunctionTable[proto->getName()] != proto->getParamNum())) {
-		fprintf(stderr, "Function: %s is redefined", proto->getName().c_str());
-		SAFE_DELETE(proto);
+FunctionAST* Parser::visitFunctionDefinition(PrototypeAST* proto) {
+	if (not checkRedefinition(proto)) {
 		return NULL;
 	}
 
 	VariableTable.clear();
+	ArrayTable.clear();
 	FunctionStmtAST* func_stmt = visitFunctionStatement(proto);
-	if (func_stmt) {
-		FunctionTable[proto->getName()] = proto->getParamNum();
-		return new FunctionAST(proto, func_stmt);
-	} else {
-		SAFE_DELETE(proto);
-		Tokens->applyTokenIndex(tmp);
+	if (not func_stmt) {
 		return NULL;
 	}
+	FunctionTable.set(proto->getSymbol(), proto->getParamNum());
+	return newNode<FunctionAST>(proto, func_stmt);
 }
 
 /*
@@ -143,622 +718,567 @@ FunctionAST* Parser::visitFunctionDefinition() {
  * @return 解析成功：PrototypeAST、失敗：NULL
  */
 PrototypeAST* Parser::visitPrototype() {
-	std::string func_name;
-	const int tmp = Tokens->getCurIndex();
-	
+	Symbol func_name;
+
 	// type_specifier
-	if (Tokens->getCurType() == TOK_INT) {
-		Tokens->getNextToken();
-	} else {
+	if (Tokens->getCurType() != TOK_INT) {
+		reportError("expected 'int'");
 		return NULL;
 	}
+	Tokens->getNextToken();
 
 	// IDENTIFIER
-	if (Tokens->getCurType() == TOK_IDENTIFIER) {
-		func_name = Tokens->getCurString();
-		Tokens->getNextToken();
-	} else {
-		Tokens->ungetToken(1); // unget TOK_INT
+	if (Tokens->getCurType() != TOK_IDENTIFIER) {
+		reportError("expected function name");
 		return NULL;
 	}
+	func_name = Tokens->getCurSymbol();
+	Tokens->getNextToken();
 
 	// '('
-	if (Tokens->getCurString() == "(") {
-		Tokens->getNextToken();
-	} else {
-		Tokens->ungetToken(2); // unget TOK_INT IDENTIFIER
+	if (not expectSymbol('(')) {
 		return NULL;
 	}
 
 	// parameter_list
-	std::vector<std::string> param_list;
-	bool is_first_param = true;
-	while (true) {
-		// ','
-		if (not is_first_param and Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == ",") {
-			Tokens->getNextToken();
-		}
-		if (Tokens->getCurType() == TOK_INT) {
+	std::vector<Symbol> param_list;
+	if (Tokens->getCurType() == TOK_INT) {
+		while (true) {
+			if (Tokens->getCurType() != TOK_INT) {
+				reportError("expected 'int'");
+				return NULL;
+			}
 			Tokens->getNextToken();
-		} else {
-			break;
-		}
-		if (Tokens->getCurType() == TOK_IDENTIFIER) {
-			if (std::find(begin(param_list), end(param_list), Tokens->getCurString()) != end(param_list)) {
-				Tokens->applyTokenIndex(tmp);
+			if (Tokens->getCurType() != TOK_IDENTIFIER) {
+				reportError("expected parameter name");
+				return NULL;
+			}
+			if (std::find(begin(param_list), end(param_list), Tokens->getCurSymbol()) != end(param_list)) {
+				reportError("duplicate parameter");
 				return NULL;
 			}
-			param_list.push_back(Tokens->getCurString());
+			param_list.push_back(Tokens->getCurSymbol());
+			Tokens->getNextToken();
+			// ','
+			if (not isCurSymbol(',')) {
+				break;
+			}
 			Tokens->getNextToken();
-		} else {
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
 		}
-		is_first_param = false;
 	}
 
 	// ')'
-	if (Tokens->getCurString() == ")") {
-		Tokens->getNextToken();
-		return new PrototypeAST(func_name, param_list);
-	} else {
-		Tokens->applyTokenIndex(tmp);
+	if (not expectSymbol(')')) {
 		return NULL;
 	}
+	std::vector<ValueRange> param_ranges(param_list.size(), ValueRange::unknown()); // コード生成が埋める
+	return newNode<PrototypeAST>(func_name, newArray(param_list),
+		TU->getArena().copyArray(param_ranges.data(), param_ranges.size()));
 }
 
 /*
  * FunctionStatement用構文解析メソッド
+ * '{' 宣言の並び 文の並び '}' の形で、最後の文はreturn文
  * @param 関数名、引数を格納したPrototypeクラスのインスタンス
  * @return 解析成功：FunctionStmtAST、失敗：NULL
  */
 FunctionStmtAST* Parser::visitFunctionStatement(PrototypeAST* proto) {
-	const int tmp = Tokens->getCurIndex();
 	// {
-	if (Tokens->getCurString() == "{") {
-		Tokens->getNextToken();
-	} else {
+	if (not expectSymbol('{')) {
 		return NULL;
 	}
 
-	// create FunctionStatement
-	FunctionStmtAST* func_stmt = new FunctionStmtAST();
-
 	// add parameter to FunctionStatement
+	Body.clear();
+	LoopVariables.clear();
 	for (int i = 0; i < proto->getParamNum(); i++) {
-		VariableDeclAST* vdecl = new VariableDeclAST(proto->getParamName(i));
-		vdecl->setDeclType(VariableDeclAST::param);
-		func_stmt->addVariableDeclaration(vdecl);
-		VariableTable.push_back(vdecl->getName());
-	}
-
-	VariableDeclAST* var_decl;
-	ArrayDeclAST* arr_decl;
-	BaseAST* stmt, * last_stmt;
-
-	// {statement_list}
-	if (stmt = visitStatement()) {
-		while (stmt) {
-			last_stmt = stmt;
-			func_stmt->addStatement(stmt);
-			stmt = visitStatement();
-		}
-	} else if (var_decl = visitVariableDeclaration()) { // variable_declaration list
-		while (var_decl) {
-			var_decl->setDeclType(VariableDeclAST::local);
-			if (std::find(begin(VariableTable), end(VariableTable), var_decl->getName()) != end(VariableTable)) {
-				SAFE_DELETE(var_decl);
-				SAFE_DELETE(func_stmt);
+		Body.addVariableDeclaration(VariableDeclAST(proto->getParamSymbol(i), VariableDeclAST::param));
+		VariableTable.insert(proto->getParamSymbol(i), true);
+	}
+
+	// variable_declaration, array_declaration list
+	while (true) {
+		if (Tokens->getCurType() == TOK_INT) {
+			if (not visitVariableDeclaration()) {
 				return NULL;
 			}
-			func_stmt->addVariableDeclaration(var_decl);
-			VariableTable.push_back(var_decl->getName());
-			// parse Variable Declaration
-			var_decl = visitVariableDeclaration();
-		}
-		if (stmt = visitStatement()) {
-			while (stmt) {
-				last_stmt = stmt;
-				func_stmt->addStatement(stmt);
-				stmt = visitStatement();
-			}
-		}
-	} else if (arr_decl = visitArrayDeclaration()) { // array_declaration list
-		// std::cerr << "hoge\n";
-		while (arr_decl) {
-			arr_decl->setDeclType(ArrayDeclAST::local);
-			if (std::find(begin(ArrayTable), end(ArrayTable), arr_decl->getName()) != end(ArrayTable)) {
-				SAFE_DELETE(arr_decl);
-				SAFE_DELETE(func_stmt);
+		} else if (Tokens->getCurType() == TOK_ARRAY) {
+			if (not visitArrayDeclaration()) {
 				return NULL;
 			}
-			func_stmt->addArrayDeclaration(arr_decl);
-			ArrayTable.push_back(arr_decl->getName());
-			arr_decl = visitArrayDeclaration();
-		}
-		// std::cerr << "hoge" << std::endl;
-
-		if (stmt = visitStatement()) {
-			while (stmt) {
-				last_stmt = stmt;
-				// std::cerr << stmt->getValueID() << std::endl;
-				func_stmt->addStatement(stmt);
-				stmt = visitStatement();
-			}
-		} else if (var_decl = visitVariableDeclaration()) { // variable_declaration list
-			while (var_decl) {
-				var_decl->setDeclType(VariableDeclAST::local);
-				if (std::find(begin(VariableTable), end(VariableTable), var_decl->getName()) != end(VariableTable)) {
-					SAFE_DELETE(var_decl);
-					SAFE_DELETE(func_stmt);
-					return NULL;
-				}
-				func_stmt->addVariableDeclaration(var_decl);
-				VariableTable.push_back(var_decl->getName());
-				// parse Variable Declaration
-				var_decl = visitVariableDeclaration();
-			}
-			if (stmt = visitStatement()) {
-				while (stmt) {
-					last_stmt = stmt;
-					func_stmt->addStatement(stmt);
-					stmt = visitStatement();
-				}
-			}
+		} else {
+			break;
 		}
-	} else { // other
-		SAFE_DELETE(func_stmt);
-		Tokens->applyTokenIndex(tmp);
-		return NULL;
 	}
 
+	// statement_list
+	NodeIndex last_stmt = InvalidNode;
+	while (not isCurSymbol('}')) {
+		if (Tokens->getCurType() == TOK_EOF) {
+			reportError("expected '}'");
+			return NULL;
+		}
+		NodeIndex stmt = visitStatement();
+		if (stmt == InvalidNode) {
+			return NULL;
+		}
+		Body.addStatement(stmt);
+		last_stmt = stmt;
+	}
 
-	// std::cerr << "fuga" << std::endl;
 	// check if last statement is jump_statement
-	if (not last_stmt or not llvm::isa<JumpStmtAST>(last_stmt)) {
-		SAFE_DELETE(func_stmt);
-		Tokens->applyTokenIndex(tmp);
+	if (last_stmt == InvalidNode or Body.getNode(last_stmt).getValueID() != JumpStmtID) {
+		reportError("function must end with a return statement");
 		return NULL;
 	}
 
 	// }
-	// std::cerr << Tokens->getCurString() << std::endl;
-	if (Tokens->getCurString() == "}") {
-		// std::cerr << "piyo" << std::endl;
-		Tokens->getNextToken();
-		return func_stmt;
-	} else {
-		SAFE_DELETE(func_stmt);
-		Tokens->applyTokenIndex(tmp);
-		return NULL;
-	}
+	Tokens->getNextToken();
+	return Body.build(Consumer ? FunctionNodes : TU->getArena());
 }
 
 /*
  * VariableDeclaration用構文解析メソッド
- * @return 解析成功：VariableDeclAST、失敗：NULL
+ * 解析した宣言は現在の関数本文に追加する
+ * @return 解析成功/失敗→T/F
  */
-VariableDeclAST* Parser::visitVariableDeclaration() {
-	std::string name;
+bool Parser::visitVariableDeclaration() {
+	Symbol name;
 	// INT
-	if (Tokens->getCurType() == TOK_INT) {
-		Tokens->getNextToken();
-	} else {
-		return NULL;
-	}
+	Tokens->getNextToken();
 	// IDENTIFIER
-	if (Tokens->getCurType() == TOK_IDENTIFIER) {
-		name = Tokens->getCurString();
-		Tokens->getNextToken();
-	} else {
-		Tokens->ungetToken(1);
-		return NULL;
+	if (Tokens->getCurType() != TOK_IDENTIFIER) {
+		return reportError("expected variable name");
 	}
+	name = Tokens->getCurSymbol();
+	if (VariableTable.count(name)) {
+		return reportError("variable is redeclared");
+	}
+	Tokens->getNextToken();
 	// ';'
-	if (Tokens->getCurString() == ";") {
-		Tokens->getNextToken();
-		return new VariableDeclAST(name);
-	} else {
-		Tokens->ungetToken(2);
-		return NULL;
+	if (not expectSymbol(';')) {
+		return false;
 	}
+	Body.addVariableDeclaration(VariableDeclAST(name, VariableDeclAST::local));
+	VariableTable.insert(name, true);
+	return true;
 }
 
 /*
  * ArrayDeclaration用構文解析メソッド
- * @return 解析成功：ArrayDeclAST、失敗：NULL
+ * 解析した宣言は現在の関数本文に追加する
+ * @return 解析成功/失敗→T/F
  */
-
-ArrayDeclAST* Parser::visitArrayDeclaration() {
-	std::string name;
+bool Parser::visitArrayDeclaration() {
+	Symbol name;
 	size_t size;
 	// ARRAY
-	if (Tokens->getCurType() == TOK_ARRAY) {
-		Tokens->getNextToken();
-		// std::cerr << "1\n"; 
-	} else {
-		return NULL;
-	}
+	Tokens->getNextToken();
 	// IDENTIFIER
-	if (Tokens->getCurType() == TOK_IDENTIFIER) {
-		name = Tokens->getCurString();
-		Tokens->getNextToken();
-	} else {
-		Tokens->ungetToken(1);
-		return NULL;
+	if (Tokens->getCurType() != TOK_IDENTIFIER) {
+		return reportError("expected array name");
 	}
+	name = Tokens->getCurSymbol();
+	if (ArrayTable.count(name)) {
+		return reportError("array is redeclared");
+	}
+	Tokens->getNextToken();
 	// [
-	if (Tokens->getCurString() == "[") {
-		Tokens->getNextToken();
-	} else {
-		Tokens->ungetToken(2);
-		return NULL;
+	if (not expectSymbol('[')) {
+		return false;
 	}
 	// DIGIT
-	if (Tokens->getCurType() == TOK_DIGIT) {
-		size = Tokens->getCurNumVal();
-		Tokens->getNextToken();
-	} else {
-		Tokens->ungetToken(3);
-		return NULL;
+	if (Tokens->getCurType() != TOK_DIGIT) {
+		return reportError("expected array size");
 	}
-	if (Tokens->getCurString() == "]") {
-		Tokens->getNextToken();
-	} else {
-		Tokens->ungetToken(4);
-		return NULL;
+	size = Tokens->getCurNumVal();
+	Tokens->getNextToken();
+	// ]
+	if (not expectSymbol(']')) {
+		return false;
 	}
-	// ';'
-	if (Tokens->getCurString() == ";") {
+	ArrayDeclAST a_decl(name, size, ArrayDeclAST::local);
+	// '=' initializer
+	if (isCurSymbol('=')) {
 		Tokens->getNextToken();
-		return new ArrayDeclAST(name, size);
-	} else {
-		Tokens->ungetToken(5);
-		return NULL;
+		if (not visitArrayInitializer(a_decl)) {
+			return false;
+		}
+	}
+	// ;
+	if (not expectSymbol(';')) {
+		return false;
 	}
+	Body.addArrayDeclaration(a_decl);
+	ArrayTable.insert(name, size);
+	return true;
 	// example:
 	// array a[5];
+	// array a[5] = {1, 2, 3};
+	// array a[5] = fill(-1);
 }
 
 /*
- * Statement用構文解析メソッド
- * @return 解析成功：AST、失敗：NULL
- */
-BaseAST* Parser::visitStatement() {
-	BaseAST* stmt = NULL;
-	if (stmt = visitExpressionStatement()) {
-		return stmt;
-	} else if (stmt = visitJumpStatement()) {
-		return stmt;
-	} else {
-		return NULL;
+ * 配列の初期化子用構文解析メソッド
+ * `fill(v)`か`{v0, v1, ...}`(値は整数のみ、要素数以下)
+ * @param 初期化子を設定する配列宣言
+ * @return 解析成功/失敗→T/F
+ */
+bool Parser::visitArrayInitializer(ArrayDeclAST& a_decl) {
+	int64_t val;
+	// fill '(' INTEGER ')'
+	if (Tokens->getCurType() == TOK_IDENTIFIER and Tokens->getCurSymbol() == FillSymbol) {
+		Tokens->getNextToken();
+		if (not expectSymbol('(') or not visitArrayInitValue(val) or not expectSymbol(')')) {
+			return false;
+		}
+		return a_decl.setFill(val);
+	}
+	// '{' [INTEGER {',' INTEGER}] '}'
+	if (not expectSymbol('{')) {
+		return false;
 	}
+	std::vector<int64_t> values;
+	while (not isCurSymbol('}')) {
+		if (not values.empty() and not expectSymbol(',')) {
+			return false;
+		}
+		if (not visitArrayInitValue(val)) {
+			return false;
+		}
+		values.push_back(val);
+	}
+	Tokens->getNextToken();
+	if (values.size() > a_decl.getSize()) {
+		return reportError("too many array initializers");
+	}
+	return a_decl.setInitList(Body.addArrayInit(values), values.size());
 }
 
 /*
- * ExpressionStatement用構文解析メソッド
- * @return 解析成功：AST、失敗：NULL
+ * 配列の初期化子の値用構文解析メソッド
+ * @param 値の書き込み先
+ * @return 解析成功/失敗→T/F
  */
-BaseAST* Parser::visitExpressionStatement() {
-	BaseAST* assign_expr;
-	// NULL Expression
-	if (Tokens->getCurString() == ";") {
+bool Parser::visitArrayInitValue(int64_t& val) {
+	bool negative = isCurSymbol('-');
+	if (negative) {
 		Tokens->getNextToken();
-		return new NullExprAST();
-	} else if (assign_expr = visitAssignmentExpression()) {
-		if (Tokens->getCurString() == ";") {
-			Tokens->getNextToken();
-			return assign_expr;
-		}
 	}
-	return NULL;
+	if (Tokens->getCurType() != TOK_DIGIT) {
+		return reportError("expected integer in array initializer");
+	}
+	val = negative ? -Tokens->getCurNumVal() : Tokens->getCurNumVal();
+	Tokens->getNextToken();
+	return true;
 }
 
 /*
- * JumpStatement用構文解析メソッド
- * @return 解析成功：AST、失敗：NULL
+ * Statement用構文解析メソッド
+ * 先頭のトークンだけで種類を決める
+ * @return 解析成功：ノードの添字、失敗：InvalidNode
  */
-BaseAST* Parser::visitJumpStatement() {
-	const int tmp = Tokens->getCurIndex();
-	BaseAST* expr;
+NodeIndex Parser::visitStatement() {
 	if (Tokens->getCurType() == TOK_RETURN) {
-		Tokens->getNextToken();
-		if (not (expr = visitAssignmentExpression())) {
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
-		}
-		if (Tokens->getCurString() == ";") {
-			Tokens->getNextToken();
-			return new JumpStmtAST(expr);
-		} else {
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
-		}
+		return visitJumpStatement();
+	} else if (Tokens->getCurType() == TOK_FOR) {
+		return visitLoopStatement();
 	} else {
-		return NULL;
+		return visitExpressionStatement();
 	}
 }
 
 /*
- * AssignmentExpression用構文解析メソッド
- * @return 解析成功：AST、解析失敗：NULL
+ * ExpressionStatement用構文解析メソッド
+ * @return 解析成功：ノードの添字、失敗：InvalidNode
  */
-BaseAST* Parser::visitAssignmentExpression() {
-	const int tmp = Tokens->getCurIndex();
-	// | IDENTIFIER '=' additive_expression
-	BaseAST* lhs;
-	if (Tokens->getCurType() == TOK_IDENTIFIER) {
-		// 変数が宣言されているか確認
-		if (std::find(begin(VariableTable), end(VariableTable), Tokens->getCurString()) != end(VariableTable)) {
-			lhs = new VariableAST(Tokens->getCurString());
-			Tokens->getNextToken();
-			BaseAST* rhs;
-			if (Tokens->getCurType() == TOK_SYMBOL and 
-				Tokens->getCurString() == "=") {
-				Tokens->getNextToken();
-				if (rhs = visitAdditiveExpression(NULL)) {
-					return new BinaryExprAST("=", lhs, rhs);
-				} else {
-					SAFE_DELETE(lhs);
-					Tokens->applyTokenIndex(tmp);
-				}
-			} else if (Tokens->getCurType() == TOK_SYMBOL and
-				Tokens->getCurString() == "$") {
-				Tokens->getNextToken();
-				if (rhs = visitAdditiveExpression(NULL)) {
-					return new BinaryExprAST("$", lhs, rhs); // TODO
-				} else {
-					SAFE_DELETE(lhs);
-					Tokens->applyTokenIndex(tmp);
-				}
-			} else {
-				SAFE_DELETE(lhs);
-				Tokens->applyTokenIndex(tmp);
-			}
-		} else if (std::find(begin(ArrayTable), end(ArrayTable), Tokens->getCurString()) != end(ArrayTable)) {
-			lhs = new ArrayAST(Tokens->getCurString());
-			Tokens->getNextToken();
-			BaseAST* rhs;
-			if (Tokens->getCurType() == TOK_SYMBOL and 
-				Tokens->getCurString() == "=") {
-				Tokens->getNextToken();
-				if (rhs = visitAdditiveExpression(NULL)) {
-					return new BinaryExprAST("=", lhs, rhs);
-				} else {
-					SAFE_DELETE(lhs);
-					Tokens->applyTokenIndex(tmp);
-				}
-			} else if (Tokens->getCurType() == TOK_SYMBOL and
-				Tokens->getCurString() == "$") {
-				Tokens->getNextToken();
-				if (rhs = visitAdditiveExpression(NULL)) {
-					return new BinaryExprAST("$", lhs, rhs); // TODO
-				} else {
-					SAFE_DELETE(lhs);
-					Tokens->applyTokenIndex(tmp);
-				}
-			} else if (Tokens->getCurType() == TOK_IDENTIFIER and 
-				Tokens->getCurString() == "inc") {
-				Tokens->getNextToken();
-				if (rhs = visitAdditiveExpression(NULL)) {
-					return new BinaryExprAST("inc", lhs, rhs);
-				} else {
-					SAFE_DELETE(lhs);
-					Tokens->applyTokenIndex(tmp);	
-				}
-			} else {
-				SAFE_DELETE(lhs);
-				Tokens->applyTokenIndex(tmp);
-			}
-		} else {
-			Tokens->applyTokenIndex(tmp);
-		}
+NodeIndex Parser::visitExpressionStatement() {
+	// NULL Expression
+	if (isCurSymbol(';')) {
+		Tokens->getNextToken();
+		return Body.addNullExpr();
 	}
-	// additive_expression
-	BaseAST* add_expr = visitAdditiveExpression(NULL);
-	if (add_expr) {
-		return add_expr;
+	NodeIndex assign_expr = visitExpression(0);
+	if (assign_expr == InvalidNode or not expectSymbol(';')) {
+		return InvalidNode;
 	}
-	return NULL;
+	return assign_expr;
 }
 
 /*
- * AdditiveExpression用構文解析メソッド
- * @param lhs(左辺)、初回呼び出し時はNULL
- * @return 解析成功：AST、失敗：NULL
+ * JumpStatement用構文解析メソッド
+ * @return 解析成功：ノードの添字、失敗：InvalidNode
  */
-BaseAST* Parser::visitAdditiveExpression(BaseAST* lhs) {
-	const int tmp = Tokens->getCurIndex();
-	if (not lhs) {
-		lhs = visitMultiplicativeExpression(NULL);
-	}
-	if (not lhs) {
-		return NULL;
+NodeIndex Parser::visitJumpStatement() {
+	// RETURN
+	Tokens->getNextToken();
+	NodeIndex expr = visitExpression(0);
+	if (expr == InvalidNode or not expectSymbol(';')) {
+		return InvalidNode;
 	}
-	BaseAST* rhs;
-	// +
-	if (Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == "+") {
-		Tokens->getNextToken();
-		rhs = visitMultiplicativeExpression(NULL);
-		if (rhs) {
-			return visitAdditiveExpression(new BinaryExprAST("+", lhs, rhs));
-		} else {
-			SAFE_DELETE(lhs);
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
-		}
-	} else if (Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == "-") {
-		Tokens->getNextToken();
-		rhs = visitMultiplicativeExpression(NULL);
-		if (rhs) {
-			return visitAdditiveExpression(new BinaryExprAST("-", lhs, rhs));
-		} else {
-			SAFE_DELETE(lhs);
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
-		}
-	}
-	return lhs;
+	return Body.addJumpStmt(expr);
 }
 
 /*
- * MultiplicativeExpression用解析メソッド
- * @param lhs（左辺）、初回呼び出し時はNULL
- * @return 解析成功：AST、失敗：NULL
+ * LoopStatement用構文解析メソッド
+ * `for (i = lo; i < hi; i = i + step) statement`か`for (...) { statement_list }`
+ * iは宣言済みの変数、stepは正の整数。本文ではiに代入できず、returnも書けない
+ * @return 解析成功：ノードの添字、失敗：InvalidNode
  */
-BaseAST* Parser::visitMultiplicativeExpression(BaseAST* lhs) {
-	const int tmp = Tokens->getCurIndex();
-	if (not lhs) {
-		lhs = visitPostfixExpression();
+NodeIndex Parser::visitLoopStatement() {
+	NodeIndex begin = Body.getNodeNum();
+	// FOR '('
+	Tokens->getNextToken();
+	if (not expectSymbol('(')) {
+		return InvalidNode;
 	}
-	if (not lhs) {
-		return NULL;
+	// VARIABLE_IDENTIFIER '=' expression ';'
+	if (Tokens->getCurType() != TOK_IDENTIFIER or not VariableTable.count(Tokens->getCurSymbol())) {
+		reportError("expected loop variable");
+		return InvalidNode;
+	}
+	Symbol var = Tokens->getCurSymbol();
+	if (std::find(LoopVariables.begin(), LoopVariables.end(), var) != LoopVariables.end()) {
+		reportError("loop variable cannot be assigned in the loop body");
+		return InvalidNode;
+	}
+	NodeIndex lhs = Body.addVariable(var);
+	Tokens->getNextToken();
+	if (not expectSymbol('=')) {
+		return InvalidNode;
 	}
-	BaseAST* rhs;
-	// *
-	if (Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == "*") {
+	NodeIndex lower = visitExpression(AssignPrec + 1);
+	if (lower == InvalidNode or not expectSymbol(';')) {
+		return InvalidNode;
+	}
+	NodeIndex init = Body.addBinaryExpr(OP_ASSIGN, lhs, lower);
+	// VARIABLE_IDENTIFIER '<' expression ';'
+	if (Tokens->getCurType() != TOK_IDENTIFIER or Tokens->getCurSymbol() != var) {
+		reportError("loop condition must compare the loop variable");
+		return InvalidNode;
+	}
+	Tokens->getNextToken();
+	if (not expectSymbol('<')) {
+		return InvalidNode;
+	}
+	NodeIndex limit = visitExpression(AssignPrec + 1);
+	if (limit == InvalidNode or not expectSymbol(';')) {
+		return InvalidNode;
+	}
+	// VARIABLE_IDENTIFIER '=' VARIABLE_IDENTIFIER '+' INTEGER ')'
+	for (int i = 0; i < 2; i++) {
+		if (Tokens->getCurType() != TOK_IDENTIFIER or Tokens->getCurSymbol() != var) {
+			reportError("loop increment must add to the loop variable");
+			return InvalidNode;
+		}
 		Tokens->getNextToken();
-		rhs = visitPostfixExpression();
-		if (rhs) {
-			return visitAdditiveExpression(new BinaryExprAST("*", lhs, rhs));
-		} else {
-			SAFE_DELETE(lhs);
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
+		if (not expectSymbol(i == 0 ? '=' : '+')) {
+			return InvalidNode;
 		}
-	} else if (Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == "/") {
+	}
+	if (Tokens->getCurType() != TOK_DIGIT or Tokens->getCurNumVal() < 1) {
+		reportError("loop step must be a positive integer");
+		return InvalidNode;
+	}
+	NodeIndex step = Body.addNumber(Tokens->getCurNumVal());
+	Tokens->getNextToken();
+	if (not expectSymbol(')')) {
+		return InvalidNode;
+	}
+
+	// statement | '{' statement_list '}'
+	LoopVariables.push_back(var);
+	bool block = isCurSymbol('{');
+	if (block) {
 		Tokens->getNextToken();
-		rhs = visitPostfixExpression();
-		if (rhs) {
-			return visitAdditiveExpression(new BinaryExprAST("/", lhs, rhs));
-		} else {
-			SAFE_DELETE(lhs);
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
+	}
+	std::vector<NodeIndex> stmts;
+	while (not block or not isCurSymbol('}')) {
+		if (Tokens->getCurType() == TOK_EOF) {
+			reportError("expected '}'");
+			return InvalidNode;
+		} else if (Tokens->getCurType() == TOK_RETURN) {
+			reportError("return statement is not allowed in a loop body");
+			return InvalidNode;
+		}
+		NodeIndex stmt = visitStatement();
+		if (stmt == InvalidNode) {
+			return InvalidNode;
+		}
+		stmts.push_back(stmt);
+		if (not block) {
+			break;
 		}
 	}
-	return lhs;
+	if (block) {
+		Tokens->getNextToken();
+	}
+	LoopVariables.pop_back();
+	return Body.addLoopStmt(begin, init, limit, step, stmts);
 }
 
 /*
- * PostfixExpression用構文解析メソッド
- * @return 解析成功：AST、失敗：NULL
+ * Expression用構文解析メソッド(Pratt法)
+ * 一次式を読んだ後、優先順位がmin_prec以上の二項演算子が続く限り右辺を読んで結合する
+ * 右辺は一段強い優先順位で読むので、同じ優先順位の演算子は左結合になる
+ * 代入系の演算子は左辺が変数名・配列名そのものの場合だけ受け付け、右辺は代入を含まない式
+ * @param 受け付ける演算子の最小の優先順位(文や括弧の中では0)
+ * @return 解析成功：ノードの添字、失敗：InvalidNode
  */
-BaseAST* Parser::visitPostfixExpression() {
-	const int tmp = Tokens->getCurIndex();
-	// primary_expression
-	BaseAST* prim_expr = visitPrimaryExpression();
-	if (prim_expr) {
-		return prim_expr;
+NodeIndex Parser::visitExpression(int min_prec) {
+	NameKind lhs_kind = NAME_NONE;
+	NodeIndex lhs = visitPrimaryExpression(lhs_kind);
+	if (lhs == InvalidNode) {
+		return InvalidNode;
 	}
-	// FUNCTION_IDENTIFIER
-	if (Tokens->getCurType() == TOK_IDENTIFIER) {
-		// is FUNCTION_IDENTIFIER
-		int param_num;
-		if (PrototypeTable.count(Tokens->getCurString())) {
-			param_num = PrototypeTable[Tokens->getCurString()];
-		} else if (FunctionTable.count(Tokens->getCurString())) {
-			param_num = FunctionTable[Tokens->getCurString()];
-		} else {
-			return NULL;
+	while (const OperatorInfo* op = getCurOperator()) {
+		if (op->Prec < min_prec) {
+			break;
 		}
-
-		// 関数名取得
-		std::string Callee = Tokens->getCurString();
-		Tokens->getNextToken();
-
-		// LEFT PALEN
-		if (Tokens->getCurType() != TOK_SYMBOL or Tokens->getCurString() != "(") {
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
+		if (op->IsAssign and not ((lhs_kind == NAME_VARIABLE and op->ForVariable) or (lhs_kind == NAME_ARRAY and op->ForArray) or
+			(lhs_kind == NAME_ELEMENT and op->ForElement))) {
+			reportError("invalid left-hand side");
+			return InvalidNode;
+		}
+		if (op->Op == OP_ASSIGN and lhs_kind == NAME_VARIABLE and
+			std::find(LoopVariables.begin(), LoopVariables.end(), Body.getNode(lhs).getSymbol()) != LoopVariables.end()) {
+			reportError("loop variable cannot be assigned in the loop body");
+			return InvalidNode;
+		}
+		if (lhs_kind == NAME_ARRAY and not op->IsAssign) {
+			break;
 		}
 		Tokens->getNextToken();
-
-		// argument list
-		std::vector<BaseAST*> args;
-		BaseAST* assign_expr = visitAssignmentExpression();
-		if (assign_expr) {
-			args.push_back(assign_expr);
-			while (Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == ",") {
-				Tokens->getNextToken();
-				// IDENTIFIER
-				assign_expr = visitAssignmentExpression();
-				if (assign_expr) {
-					args.push_back(assign_expr);
-				} else {
-					break;
-				}
-			}
+		NodeIndex rhs = visitExpression(op->Prec + 1);
+		if (rhs == InvalidNode) {
+			return InvalidNode;
 		}
-
-		// 引数の数を確認
-		if (args.size() != param_num) {
-			for (int i = 0; i < args.size(); i++) {
-				SAFE_DELETE(args[i]);
+		// `$`の上限とincの添字は整数にしておく(簡約しない場合もコード生成は整数として読む)
+		if (op->Op == OP_ANNOTATE or op->Op == OP_INC) {
+			int64_t value;
+			if (not foldConstant(Body, rhs, value)) {
+				reportError(op->Op == OP_ANNOTATE ? "annotation bound must be a constant integer" : "inc index must be a constant integer");
+				return InvalidNode;
 			}
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
-		}
-
-		// RIGHT PALEN
-		if (Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == ")") {
-			Tokens->getNextToken();
-			return new CallExprAST(Callee, args);
-		} else {
-			for (int i = 0; i < args.size(); i++) {
-				SAFE_DELETE(args[i]);
+			// incの添字は実行時に検査しないので、ここで配列の範囲に収まることを確かめる
+			if (op->Op == OP_INC and (value < 0 or (uint64_t)value >= *ArrayTable.find(Body.getNode(lhs).getSymbol()))) {
+				reportError("inc index out of range");
+				return InvalidNode;
 			}
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
+			Body.setNode(rhs, ExprNode(value));
 		}
-	} else {
-		return NULL;
+		lhs = Body.addBinaryExpr(op->Op, lhs, rhs);
+		lhs_kind = NAME_NONE;
+	}
+	if (lhs_kind == NAME_ARRAY) {
+		reportError("array cannot be used as a value");
+		return InvalidNode;
 	}
+	return lhs;
 }
 
 /*
  * PrimaryExpression用構文解析メソッド
- * @return 解析成功：AST、失敗：NULL
- */
-BaseAST* Parser::visitPrimaryExpression() {
-	const int tmp = Tokens->getCurIndex();
-	// VARIABLE_IDENTIFIER
-	if (Tokens->getCurType() == TOK_IDENTIFIER and
-		std::find(begin(VariableTable), end(VariableTable), Tokens->getCurString()) != end(VariableTable)) {
-		std::string var_name = Tokens->getCurString();
-		Tokens->getNextToken();
-		return new VariableAST(var_name);
+ * 変数、関数呼び出し、配列名、配列の要素、整数、負の整数、括弧でくくった式のいずれか
+ * 識別子は変数、関数、配列の順に引く
+ * @param 変数名・配列名だった場合にその種類を返す
+ * @return 解析成功：ノードの添字、失敗：InvalidNode
+ */
+NodeIndex Parser::visitPrimaryExpression(NameKind& kind) {
+	kind = NAME_NONE;
+	if (Tokens->getCurType() == TOK_IDENTIFIER) {
+		Symbol name = Tokens->getCurSymbol();
+		// VARIABLE_IDENTIFIER
+		if (VariableTable.count(name)) {
+			Tokens->getNextToken();
+			kind = NAME_VARIABLE;
+			return Body.addVariable(name);
+		}
+		// FUNCTION_IDENTIFIER
+		int param_num;
+		if (lookupFunction(name, param_num)) {
+			return visitCallExpression(name, param_num);
+		}
+		// ARRAY_IDENTIFIER ['[' expression ']']
+		if (ArrayTable.count(name)) {
+			Tokens->getNextToken();
+			if (not isCurSymbol('[')) {
+				kind = NAME_ARRAY;
+				return Body.addArray(name);
+			}
+			Tokens->getNextToken();
+			NodeIndex index = visitExpression(0);
+			if (index == InvalidNode or not expectSymbol(']')) {
+				return InvalidNode;
+			}
+			kind = NAME_ELEMENT;
+			return Body.addElement(name, index);
+		}
+		reportError("undeclared identifier");
+		return InvalidNode;
 	} else if (Tokens->getCurType() == TOK_DIGIT) { // integer
 		auto val = Tokens->getCurNumVal();
 		Tokens->getNextToken();
-		return new NumberAST(val);
-	} else if (Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == "-") { // negative integer
+		return Body.addNumber(val);
+	} else if (isCurSymbol('-')) { // negative integer
 		Tokens->getNextToken();
-		if (Tokens->getCurType() == TOK_DIGIT) {
-			auto val = Tokens->getCurNumVal();
-			Tokens->getNextToken();
-			return new NumberAST(-val);
-		} else {
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
+		if (Tokens->getCurType() != TOK_DIGIT) {
+			reportError("expected integer after '-'");
+			return InvalidNode;
 		}
-	} else if (Tokens->getCurType() == TOK_SYMBOL and Tokens->getCurString() == "(") { // '(' expression ')'
+		auto val = Tokens->getCurNumVal();
 		Tokens->getNextToken();
-		// expression
-		BaseAST* assign_expr;
-		if (not (assign_expr = visitAssignmentExpression())) {
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
+		return Body.addNumber(-val);
+	} else if (isCurSymbol('(')) { // '(' expression ')'
+		Tokens->getNextToken();
+		NodeIndex assign_expr = visitExpression(0);
+		if (assign_expr == InvalidNode or not expectSymbol(')')) {
+			return InvalidNode;
 		}
-		// RIGHT PALEN
-		if (Tokens->getCurString() == ")") {
+		return assign_expr;
+	}
+	reportError("expected expression");
+	return InvalidNode;
+}
+
+/*
+ * 関数呼び出し用構文解析メソッド
+ * @param 関数名(現在のトークン)、引数の数
+ * @return 解析成功：ノードの添字、失敗：InvalidNode
+ */
+NodeIndex Parser::visitCallExpression(Symbol callee, int param_num) {
+	Tokens->getNextToken();
+
+	// LEFT PALEN
+	if (not expectSymbol('(')) {
+		return InvalidNode;
+	}
+
+	// argument list
+	std::vector<NodeIndex> args;
+	if (not isCurSymbol(')')) {
+		while (true) {
+			NodeIndex assign_expr = visitExpression(0);
+			if (assign_expr == InvalidNode) {
+				return InvalidNode;
+			}
+			args.push_back(assign_expr);
+			if (not isCurSymbol(',')) {
+				break;
+			}
 			Tokens->getNextToken();
-			return assign_expr;
-		} else {
-			SAFE_DELETE(assign_expr);
-			Tokens->applyTokenIndex(tmp);
-			return NULL;
 		}
 	}
-	return NULL;
-}
\ No newline at end of file
+
+	// 引数の数を確認
+	if (args.size() != (size_t)param_num) {
+		reportError("wrong number of arguments");
+		return InvalidNode;
+	}
+
+	// RIGHT PALEN
+	if (not expectSymbol(')')) {
+		return InvalidNode;
+	}
+	return Body.addCallExpr(callee, args);
+}
@@ -0,0 +1,383 @@
+#include "simplify.hpp"
+
+#include <algorithm>
+
+/*
+ * 64bitに収まる範囲を作る
+ * 収まらない場合、実際の値は折り返しているので範囲は分からない
+ * @param 下限、上限(128bitで計算したもの)
+ * @return 範囲
+ */
+static ValueRange makeRange(__int128 lower, __int128 upper) {
+	if (lower < INT64_MIN or upper > INT64_MAX) {
+		return ValueRange::unknown();
+	}
+	return {(int64_t)lower, (int64_t)upper};
+}
+
+/*
+ * 二項演算の結果の範囲を求める
+ * 掛け算と、0をまたがない数での割り算は、両辺の端どうしの4通りの結果のうち最小から最大まで
+ * @param 演算子、左辺の範囲、右辺の範囲
+ * @return 結果の範囲
+ */
+static ValueRange computeRange(BinaryOp op, ValueRange lhs, ValueRange rhs) {
+	__int128 ll = lhs.Lower, lu = lhs.Upper, rl = rhs.Lower, ru = rhs.Upper;
+	switch (op) {
+	case OP_ADD:
+		return makeRange(ll + rl, lu + ru);
+	case OP_SUB:
+		return makeRange(ll - ru, lu - rl);
+	case OP_MUL: {
+		__int128 corners[4] = {ll * rl, ll * ru, lu * rl, lu * ru};
+		return makeRange(*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4));
+	}
+	case OP_DIV: {
+		if (rl <= 0 and 0 <= ru) { // 0で割りうる
+			return ValueRange::unknown();
+		}
+		__int128 corners[4] = {ll / rl, ll / ru, lu / rl, lu / ru};
+		return makeRange(*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4));
+	}
+	default:
+		return ValueRange::unknown();
+	}
+}
+
+/*
+ * 二つの範囲を合わせた範囲(どちらの値も含む最小の範囲)
+ */
+static ValueRange joinRange(ValueRange a, ValueRange b) {
+	return {std::min(a.Lower, b.Lower), std::max(a.Upper, b.Upper)};
+}
+
+/*
+ * 簡約実行
+ * 差分コンパイルで前回のままの関数(本文がNULL)は飛ばす
+ * @param TranslationUnitAST
+ * @return true
+ */
+bool Simplifier::doSimplify(TranslationUnitAST& tunit) {
+	for (int i = 0; PrototypeAST* proto = tunit.getPrototype(i); i++) {
+		addPrototype(proto);
+	}
+	for (int i = 0; FunctionAST* func = tunit.getFunction(i); i++) {
+		if (func->getBody()) {
+			simplifyFunction(func->getBody(), tunit.getArena());
+		}
+	}
+	return true;
+}
+
+/*
+ * 関数宣言の戻り値・引数の範囲を覚える(インターフェースファイルから読んだものなど)
+ * 関数定義の範囲はコード生成で決まるので使わない
+ * @param PrototypeAST
+ * @return true
+ */
+bool Simplifier::addPrototype(PrototypeAST* proto) {
+	if (not proto->getResultRange().isUnknown()) {
+		CalleeRanges.set(proto->getSymbol(), proto->getResultRange());
+	}
+	std::vector<ValueRange> params;
+	for (int i = 0; i < proto->getParamNum(); i++) {
+		params.push_back(proto->getParamRange(i));
+	}
+	if (std::any_of(params.begin(), params.end(), [](const ValueRange& range) { return not range.isUnknown(); })) {
+		CalleeParamRanges.set(proto->getSymbol(), params);
+	}
+	return true;
+}
+
+/*
+ * 関数本文の簡約
+ * 文を順に見て、求めたノードごとの範囲はArenaに写して関数本文に持たせる
+ * @param FunctionStmtAST 範囲の写し先のArena
+ * @return true
+ */
+bool Simplifier::simplifyFunction(FunctionStmtAST* func_stmt, Arena& arena) {
+	CurBody = func_stmt;
+	Ranges.assign(func_stmt->getNodeNum(), ValueRange::unknown());
+	VariableRanges.clear();
+	VariableBounds.clear();
+	for (int i = 0; ; i++) {
+		NodeIndex stmt = func_stmt->getStatement(i);
+		if (stmt == InvalidNode) {
+			break;
+		}
+		visitNode(stmt);
+	}
+	func_stmt->setRanges(llvm::ArrayRef(arena.copyArray(Ranges.data(), Ranges.size()), Ranges.size()));
+	return true;
+}
+
+/*
+ * ノードの範囲を求めて簡約する
+ * 子はコード生成と同じ順(左辺、右辺、引数の順)に見る
+ * @param ノードの添字
+ * @return 副作用がない：true、ある(代入・関数呼び出しを含む)：false
+ */
+bool Simplifier::visitNode(NodeIndex i) {
+	const ExprNode& node = CurBody->getNode(i);
+	switch (node.getValueID()) {
+	case NumberID:
+		Ranges[i] = {node.getNumberValue(), node.getNumberValue()};
+		return true;
+	case VariableID:
+		Ranges[i] = getVariableRange(node.getSymbol());
+		if (Ranges[i].Lower == Ranges[i].Upper) {
+			CurBody->setNode(i, ExprNode(Ranges[i].Lower));
+		}
+		return true;
+	case CallExprID: {
+		for (int j = 0; j < CurBody->getArgNum(i); j++) {
+			visitNode(CurBody->getArg(i, j));
+		}
+		const ValueRange* range = CalleeRanges.find(node.getSymbol());
+		Ranges[i] = range ? *range : ValueRange::unknown();
+		narrowArguments(i);
+		return false;
+	}
+	case JumpStmtID:
+		visitNode(node.getExpr());
+		Ranges[i] = Ranges[node.getExpr()];
+		return false;
+	case ElementID: // 要素の値は追わない。添字が範囲外なら止まるので、畳み込んで消さないよう副作用ありとする
+		visitNode(node.getIndex());
+		Ranges[i] = ValueRange::unknown();
+		return false;
+	case BinaryExprID:
+		return visitBinaryExpression(i);
+	case LoopStmtID:
+		return visitLoopStatement(i);
+	default:
+		return true;
+	}
+}
+
+/*
+ * 二項演算の範囲を求めて簡約する
+ * 代入・注釈・incの左辺は値として読まないので、変数のままにしておく
+ * 配列の要素への代入は、添字、右辺の順に見る
+ * @param 二項演算のノード
+ * @return 副作用がない：true、ある：false
+ */
+bool Simplifier::visitBinaryExpression(NodeIndex i) {
+	const ExprNode node = CurBody->getNode(i);
+	const ExprNode& lhs = CurBody->getNode(node.getLHS());
+	switch (node.getOp()) {
+	case OP_ASSIGN:
+		if (lhs.getValueID() == ElementID) {
+			visitNode(lhs.getIndex());
+			visitNode(node.getRHS());
+			Ranges[i] = Ranges[node.getRHS()];
+			return false;
+		}
+		visitNode(node.getRHS());
+		assignVariable(lhs.getSymbol(), Ranges[node.getRHS()]);
+		Ranges[i] = getVariableRange(lhs.getSymbol());
+		return false;
+	case OP_ANNOTATE: {
+		const ExprNode& rhs = CurBody->getNode(node.getRHS());
+		if (lhs.getValueID() == VariableID and rhs.getValueID() == NumberID) {
+			VariableBounds.set(lhs.getSymbol(), rhs.getNumberValue());
+			assignVariable(lhs.getSymbol(), getVariableRange(lhs.getSymbol()));
+		}
+		return false;
+	}
+	case OP_INC:
+		return false;
+	default:
+		break;
+	}
+	bool lhs_pure = visitNode(node.getLHS());
+	bool rhs_pure = visitNode(node.getRHS());
+	Ranges[i] = computeRange(node.getOp(), Ranges[node.getLHS()], Ranges[node.getRHS()]);
+	return foldArithmetic(i, lhs_pure and rhs_pure);
+}
+
+/*
+ * for文の範囲を求めて簡約する
+ * 初期値・上限は入る前に一度だけ求める。本文の中の変数の範囲は[初期値の下限, 上限の上限 - 1]で、
+ * 抜けた後は[初期値の下限, max(初期値の上限, 上限の上限 + 増分 - 1)]になる(for文のノードの範囲はこちら)
+ * 本文で代入する変数(for文のノードの範囲にある代入の左辺)は、本文の前で不明(`$`の上限だけ残る)にし、
+ * 抜けた後は本文の前と最後の範囲を合わせたものにする
+ * @param for文のノード
+ * @return false(副作用あり)
+ */
+bool Simplifier::visitLoopStatement(NodeIndex i) {
+	NodeIndex init = CurBody->getNode(i).getExpr();
+	Symbol var = CurBody->getNode(CurBody->getNode(init).getLHS()).getSymbol();
+	visitNode(init);
+	visitNode(CurBody->getLoopLimit(i));
+	ValueRange lower = Ranges[init];
+	ValueRange limit = Ranges[CurBody->getLoopLimit(i)];
+	int64_t step = CurBody->getNode(CurBody->getLoopStep(i)).getNumberValue();
+	Ranges[CurBody->getLoopStep(i)] = {step, step};
+
+	std::vector<Symbol> assigned;
+	for (NodeIndex j = CurBody->getLoopBegin(i); j < i; j++) {
+		const ExprNode& node = CurBody->getNode(j);
+		if (node.getValueID() == BinaryExprID and node.getOp() == OP_ASSIGN and
+			CurBody->getNode(node.getLHS()).getValueID() == VariableID and CurBody->getNode(node.getLHS()).getSymbol() != var) {
+			assigned.push_back(CurBody->getNode(node.getLHS()).getSymbol());
+		}
+	}
+	// 一回目は入る前の値なので、それも合わせる(`$`の上限を超える値が代入されていた場合)
+	std::vector<ValueRange> entry;
+	for (Symbol v : assigned) {
+		ValueRange before = getVariableRange(v);
+		assignVariable(v, ValueRange::unknown());
+		VariableRanges.set(v, joinRange(before, getVariableRange(v)));
+		entry.push_back(getVariableRange(v));
+	}
+	// i < limitなので、本文の中ではlimitの上限 - 1以下(limitが最小値なら本文は実行されない)
+	int64_t upper = limit.hasUpper() ? (int64_t)std::max((__int128)lower.Lower, (__int128)limit.Upper - 1) : INT64_MAX;
+	assignVariable(var, {lower.Lower, upper});
+	LoopDepth++;
+	for (int j = 0; j < CurBody->getLoopStmtNum(i); j++) {
+		visitNode(CurBody->getLoopStmt(i, j));
+	}
+	LoopDepth--;
+
+	for (size_t j = 0; j < assigned.size(); j++) {
+		VariableRanges.set(assigned[j], joinRange(entry[j], getVariableRange(assigned[j])));
+	}
+	ValueRange exit = ValueRange::unknown();
+	if (limit.hasUpper() and lower.hasUpper()) {
+		exit = makeRange(lower.Lower, std::max((__int128)lower.Upper, (__int128)limit.Upper + step - 1));
+	}
+	assignVariable(var, exit);
+	Ranges[i] = getVariableRange(var);
+	return false;
+}
+
+/*
+ * 引数の範囲が分かっている関数に渡した変数を、その範囲に狭める
+ * 引数の範囲は呼び出される側の前提(引数の`$`の上限)なので、呼び出した後の変数もその範囲にある
+ * for文の本文では使わない(本文を一度も実行しなければ、抜けた後には成り立たない)
+ * @param 関数呼び出しのノード
+ * @return 狭めた：true、狭めていない：false
+ */
+bool Simplifier::narrowArguments(NodeIndex i) {
+	const std::vector<ValueRange>* params = CalleeParamRanges.find(CurBody->getNode(i).getSymbol());
+	if (not params or LoopDepth > 0) {
+		return false;
+	}
+	bool narrowed = false;
+	for (int j = 0; j < CurBody->getArgNum(i) and j < (int)params->size(); j++) {
+		const ExprNode& arg = CurBody->getNode(CurBody->getArg(i, j));
+		if (arg.getValueID() != VariableID) {
+			continue;
+		}
+		ValueRange range = getVariableRange(arg.getSymbol());
+		range = {std::max(range.Lower, (*params)[j].Lower), std::min(range.Upper, (*params)[j].Upper)};
+		// 必ず範囲外の値を渡している場合は、前提を信じない
+		if (range.Lower <= range.Upper) {
+			VariableRanges.set(arg.getSymbol(), range);
+			narrowed = true;
+		}
+	}
+	return narrowed;
+}
+
+/*
+ * 算術演算を簡約する
+ * 1. 副作用がなく値が一つに決まるなら整数にする(両辺が整数なら、折り返す場合も構文解析と同じfoldBinaryで畳み込む)
+ * 2. 単位元との演算なら相手の式にする(相手の式のノードを写す)
+ * 3. (x+c1)+c2、(x-c1)+c2などはx+(c1+c2)に、(x*c1)*c2はx*(c1*c2)にする
+ *    (左辺の定数のノードをまとめた定数に書き換えて使う。64bitで折り返すので結果は変わらない)
+ * @param 算術演算のノード、副作用がないか
+ * @return 副作用がない：true、ある：false
+ */
+bool Simplifier::foldArithmetic(NodeIndex i, bool pure) {
+	ValueRange range = Ranges[i];
+	if (pure and range.Lower == range.Upper) {
+		CurBody->setNode(i, ExprNode(range.Lower));
+		return true;
+	}
+	const ExprNode node = CurBody->getNode(i);
+	const ExprNode lhs = CurBody->getNode(node.getLHS());
+	const ExprNode rhs = CurBody->getNode(node.getRHS());
+	BinaryOp op = node.getOp();
+
+	// 1.
+	int64_t value;
+	if (lhs.getValueID() == NumberID and rhs.getValueID() == NumberID and
+		foldBinary(op, lhs.getNumberValue(), rhs.getNumberValue(), value)) {
+		CurBody->setNode(i, ExprNode(value));
+		Ranges[i] = {value, value};
+		return true;
+	}
+
+	// 2.
+	if (rhs.getValueID() == NumberID) {
+		int64_t c = rhs.getNumberValue();
+		if ((c == 0 and (op == OP_ADD or op == OP_SUB)) or (c == 1 and (op == OP_MUL or op == OP_DIV))) {
+			CurBody->setNode(i, lhs);
+			return pure;
+		}
+	}
+	if (lhs.getValueID() == NumberID) {
+		int64_t c = lhs.getNumberValue();
+		if ((c == 0 and op == OP_ADD) or (c == 1 and op == OP_MUL)) {
+			CurBody->setNode(i, rhs);
+			return pure;
+		}
+	}
+
+	// 3.
+	if (rhs.getValueID() != NumberID or lhs.getValueID() != BinaryExprID or
+		CurBody->getNode(lhs.getRHS()).getValueID() != NumberID) {
+		return pure;
+	}
+	int64_t c1 = CurBody->getNode(lhs.getRHS()).getNumberValue();
+	int64_t c2 = rhs.getNumberValue();
+	int64_t c;
+	BinaryOp combined;
+	if ((op == OP_ADD or op == OP_SUB) and (lhs.getOp() == OP_ADD or lhs.getOp() == OP_SUB)) {
+		c = lhs.getOp() == OP_ADD ? c1 : wrapSub(0, c1);
+		c = op == OP_ADD ? wrapAdd(c, c2) : wrapSub(c, c2);
+		combined = OP_ADD;
+	} else if (op == OP_MUL and lhs.getOp() == OP_MUL) {
+		c = wrapMul(c1, c2);
+		combined = OP_MUL;
+	} else {
+		return pure;
+	}
+	if ((combined == OP_ADD and c == 0) or (combined == OP_MUL and c == 1)) {
+		CurBody->setNode(i, CurBody->getNode(lhs.getLHS()));
+		return pure;
+	}
+	CurBody->setNode(lhs.getRHS(), ExprNode(c));
+	Ranges[lhs.getRHS()] = {c, c};
+	CurBody->setNode(i, ExprNode(BinaryExprID, combined, lhs.getLHS(), lhs.getRHS()));
+	return pure;
+}
+
+/*
+ * 変数に代入した後の範囲を記録する
+ * `$`の上限があれば、それ以降の値は上限以下とする
+ * (代入した値が明らかに上限を超えるときは、代入した値の方を信じる)
+ * @param 変数、代入した値の範囲
+ * @return true
+ */
+bool Simplifier::assignVariable(Symbol var, ValueRange range) {
+	const int64_t* bound = VariableBounds.find(var);
+	if (bound and range.Lower <= *bound) {
+		range.Upper = std::min(range.Upper, *bound);
+	}
+	VariableRanges.set(var, range);
+	return true;
+}
+
+/*
+ * 変数の現在の範囲を取得する
+ * まだ代入していない変数(引数、初期化していない局所変数)は不明
+ * @param 変数
+ * @return 範囲
+ */
+ValueRange Simplifier::getVariableRange(Symbol var) {
+	const ValueRange* range = VariableRanges.find(var);
+	return range ? *range : ValueRange::unknown();
+}
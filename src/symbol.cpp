@@ -0,0 +1,61 @@
+#include "symbol.hpp"
+
+#include <cstring>
+
+/*
+ * デストラクタ
+ */
+SymbolTable::~SymbolTable() {
+	for (size_t i = 0; i < Blocks.size(); i++) {
+		SAFE_DELETEA(Blocks[i]);
+	}
+	Blocks.clear();
+}
+
+/*
+ * 文字列を'\0'終端でブロックにコピーする
+ * @param コピーする文字列
+ * @return コピー先の先頭
+ */
+const char* SymbolTable::store(std::string_view str) {
+	const size_t block_size = 1 << 16;
+	size_t need = str.size() + 1;
+	if (need > BlockRest) {
+		size_t size = need > block_size ? need : block_size;
+		BlockCur = new char[size];
+		BlockRest = size;
+		Blocks.push_back(BlockCur);
+	}
+	char* p = BlockCur;
+	memcpy(p, str.data(), str.size());
+	p[str.size()] = '\0';
+	BlockCur += need;
+	BlockRest -= need;
+	return p;
+}
+
+/*
+ * 識別子を登録してIDを取得する
+ * 登録済みなら既存のIDを返す
+ * @param 識別子の文字列
+ * @return Symbol
+ */
+Symbol SymbolTable::intern(std::string_view str) {
+	auto it = Index.find(str);
+	if (it != Index.end()) {
+		return it->second;
+	}
+	std::string_view name(store(str), str.size());
+	Symbol sym = Names.size();
+	Names.push_back(name);
+	Index.emplace(name, sym);
+	return sym;
+}
+
+/*
+ * プログラム全体で共有する識別子表
+ */
+SymbolTable& getSymbolTable() {
+	static SymbolTable table;
+	return table;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+# incのstoreがvolatileにならないことを確かめる(volatileだとmem2reg・GVN・LICMがかからない)
+# 範囲外のincの添字(実行時に検査しない)が構文解析でエラーになることも確かめる
+# 使い方: ./test/inc.sh (./bin/dccをビルドしてから実行する)
+set -e
+cd "$(dirname "$0")/.."
+out=$(mktemp)
+trap 'rm -f "$out" "$out.dc"' EXIT
+for opt in "" -direct-ssa -narrow "-array-stack-limit 0 -large-arrays heap" "-array-stack-limit 0 -large-arrays global"; do
+	./bin/dcc $opt ./test/inc.dc -o "$out"
+	if ! grep -q "store" "$out"; then
+		echo "FAIL ($opt): incのstoreがありません"
+		exit 1
+	fi
+	if grep -q "volatile" "$out"; then
+		echo "FAIL ($opt): incのstoreがvolatileです"
+		grep -n "volatile" "$out"
+		exit 1
+	fi
+done
+for index in 10 -1 "5 * 2" "4294967296 + 3"; do
+	printf 'int main() {\n\tarray a[10];\n\ta inc %s;\n\treturn 0;\n}\n' "$index" > "$out.dc"
+	if ./bin/dcc "$out.dc" -o "$out" 2> /dev/null; then
+		echo "FAIL: a inc $index がエラーになりません"
+		exit 1
+	fi
+done
+echo "OK"
@@ -0,0 +1,16 @@
+#!/bin/sh
+# -narrowで、Loadの型より広い範囲(ループの中の`$`の上限だけの範囲など)を!rangeに書いても結果が変わらないことを確かめる
+# 使い方: ./test/narrow_range.sh (./bin/dccをビルドしてから実行する。lliを使う)
+cd "$(dirname "$0")/.."
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+for opt in "" -narrow; do
+	./bin/dcc $opt ./test/narrow_range.dc -o "$out" || exit 1
+	lli "$out"
+	result=$?
+	if [ "$result" -ne 3 ]; then
+		echo "FAIL ($opt): 3ではなく$result"
+		exit 1
+	fi
+done
+echo "OK"